@@ -5,7 +5,9 @@
 #include <list>
 #include <string>
 #include <iomanip>
+#ifndef ORDER_BOOK_NO_LIBPCAP
 #include <pcap.h>
+#endif
 #include <cstring>
 #include <cstdint>
 #include <arpa/inet.h>
@@ -14,30 +16,61 @@
 #include <cmath>
 #include <chrono>
 #include <thread>
-
-#pragma pack(push, 1)
+#include <memory>
+#include <array>
+#include <type_traits>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <csignal>
+#include <ctime>
+#include <tuple>
+#include "top_of_book.h"
+#if defined(ORDER_BOOK_LATENCY) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#ifdef ORDER_BOOK_BENCH
+#include <random>
+#include <new>
+#include <cstdlib>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
 
 // Order Definition
+// Pool node linked into its price level's queue; laid out naturally, with
+// the link pointers aligned, since it never goes on the wire
 struct Order {
     uint64_t orderID;
+    Order* prev;
+    Order* next;
     uint32_t price;
     uint32_t volume;
     char side;
-    std::string firmID;
-
-    Order(uint64_t id, uint32_t p, uint32_t v, char s, const std::string& f)
-        : orderID(id), price(p), volume(v), side(s), firmID(f) {}
-    
-    bool operator==(const Order& other) const {
-        return orderID == other.orderID;
-    }
+    char firmID[4];
 };
+static_assert(sizeof(Order) == 40, "Order pool nodes should stay 40 bytes");
+
+#pragma pack(push, 1)
 
 // Bar Definition
+// Prices are raw scaled integers; divide by the symbol's price divisor to print
 struct bar_t {
-    double high;
-    double low;
-    double prev_close;
+    uint32_t high;
+    uint32_t low;
+    uint32_t prev_close;
     uint64_t volume;
     uint64_t update_count;
 };
@@ -324,502 +357,4788 @@ struct RetailPriceImprovementMessage {
 
 #pragma pack(pop)
 
-class OrderBook {
-private:
-    std::unordered_map<uint64_t, Order*> orderMap;
-    std::map<uint32_t, std::list<Order>> bids;
-    std::map<uint32_t, std::list<Order>> asks;
-    std::vector<uint32_t> top10Bids;
-    std::vector<uint32_t> top10Asks;
-
-    std::vector<uint32_t> getTopPrices(const std::map<uint32_t, std::list<Order>>& book, bool reverse = false) const {
-        std::vector<uint32_t> topPrices;
-        if (reverse) {
-            for (auto it = book.rbegin(); it != book.rend() && topPrices.size() < 10; ++it) {
-                topPrices.push_back(it->first);
-            }
-        } else {
-            for (auto it = book.begin(); it != book.end() && topPrices.size() < 10; ++it) {
-                topPrices.push_back(it->first);
-            }
-        }
-        return topPrices;
+// Message Size Table
+// MsgSize of each message type as published in the XDP specification,
+// header included; zero for types this parser does not know. Checked
+// against the packed structs below so a layout mistake fails the build.
+constexpr size_t messageWireSize(uint16_t messageType) {
+    switch (messageType) {
+        case MSG_TYPE_SEQUENCE_NUMBER_RESET: return 14;
+        case MSG_TYPE_SOURCE_TIME_REFERENCE: return 16;
+        case MSG_TYPE_SYMBOL_INDEX_MAPPING: return 44;
+        case MSG_TYPE_SYMBOL_CLEAR: return 20;
+        case MSG_TYPE_SECURITY_STATUS: return 46;
+        case MSG_TYPE_ADD_ORDER: return 39;
+        case MSG_TYPE_MODIFY_ORDER: return 35;
+        case MSG_TYPE_DELETE_ORDER: return 25;
+        case MSG_TYPE_ORDER_EXECUTION: return 42;
+        case MSG_TYPE_REPLACE_ORDER: return 42;
+        case MSG_TYPE_IMBALANCE: return 73;
+        case MSG_TYPE_ADD_ORDER_REFRESH: return 43;
+        case MSG_TYPE_NON_DISPLAYED_TRADE: return 33;
+        case MSG_TYPE_CROSS_TRADE: return 29;
+        case MSG_TYPE_TRADE_CANCEL: return 20;
+        case MSG_TYPE_CROSS_CORRECTION: return 24;
+        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT: return 17;
+        default: return 0;
     }
-    void recalculateBar(uint32_t symbolIndex, const std::map<uint32_t,
-                        std::list<Order>>& bids, uint8_t priceScaleCode, 
-                        std::unordered_map<uint32_t, bar_t>& symbolBars) const {
-        auto it = symbolBars.find(symbolIndex);
-        if (it == symbolBars.end()) {
-            std::cerr << "No bar found for SymbolIndex " << symbolIndex << "\n";
-            return;
-        }
+}
 
-        auto& bar = it->second;
-        bar.high = std::numeric_limits<double>::lowest();
-        bar.low = std::numeric_limits<double>::max();
+template <typename Message>
+constexpr bool matchesWireSize(uint16_t messageType) {
+    return sizeof(XDPMessageHeader) + sizeof(Message) == messageWireSize(messageType);
+}
+static_assert(matchesWireSize<SequenceNumberResetMessage>(MSG_TYPE_SEQUENCE_NUMBER_RESET), "Sequence Number Reset layout");
+static_assert(matchesWireSize<SourceTimeReferenceMessage>(MSG_TYPE_SOURCE_TIME_REFERENCE), "Source Time Reference layout");
+static_assert(matchesWireSize<SymbolIndexMappingMessage>(MSG_TYPE_SYMBOL_INDEX_MAPPING), "Symbol Index Mapping layout");
+static_assert(matchesWireSize<SymbolClearMessage>(MSG_TYPE_SYMBOL_CLEAR), "Symbol Clear layout");
+static_assert(matchesWireSize<SecurityStatusMessage>(MSG_TYPE_SECURITY_STATUS), "Security Status layout");
+static_assert(matchesWireSize<AddOrderMessage>(MSG_TYPE_ADD_ORDER), "Add Order layout");
+static_assert(matchesWireSize<ModifyOrderMessage>(MSG_TYPE_MODIFY_ORDER), "Modify Order layout");
+static_assert(matchesWireSize<DeleteOrderMessage>(MSG_TYPE_DELETE_ORDER), "Delete Order layout");
+static_assert(matchesWireSize<OrderExecutionMessage>(MSG_TYPE_ORDER_EXECUTION), "Order Execution layout");
+static_assert(matchesWireSize<ReplaceOrderMessage>(MSG_TYPE_REPLACE_ORDER), "Replace Order layout");
+static_assert(matchesWireSize<ImbalanceMessage>(MSG_TYPE_IMBALANCE), "Imbalance layout");
+static_assert(matchesWireSize<AddOrderRefreshMessage>(MSG_TYPE_ADD_ORDER_REFRESH), "Add Order Refresh layout");
+static_assert(matchesWireSize<NonDisplayedTradeMessage>(MSG_TYPE_NON_DISPLAYED_TRADE), "Non-Displayed Trade layout");
+static_assert(matchesWireSize<CrossTradeMessage>(MSG_TYPE_CROSS_TRADE), "Cross Trade layout");
+static_assert(matchesWireSize<TradeCancelMessage>(MSG_TYPE_TRADE_CANCEL), "Trade Cancel layout");
+static_assert(matchesWireSize<CrossCorrectionMessage>(MSG_TYPE_CROSS_CORRECTION), "Cross Correction layout");
+static_assert(matchesWireSize<RetailPriceImprovementMessage>(MSG_TYPE_RETAIL_PRICE_IMPROVEMENT), "Retail Price Improvement layout");
+
+// Offset of the symbolIndex field in each message body, SIZE_MAX for
+// messages that do not belong to a symbol
+constexpr size_t messageSymbolOffset(uint16_t messageType) {
+    switch (messageType) {
+        case MSG_TYPE_SYMBOL_INDEX_MAPPING: return offsetof(SymbolIndexMappingMessage, symbolIndex);
+        case MSG_TYPE_SYMBOL_CLEAR: return offsetof(SymbolClearMessage, symbolIndex);
+        case MSG_TYPE_SECURITY_STATUS: return offsetof(SecurityStatusMessage, symbolIndex);
+        case MSG_TYPE_ADD_ORDER: return offsetof(AddOrderMessage, symbolIndex);
+        case MSG_TYPE_MODIFY_ORDER: return offsetof(ModifyOrderMessage, symbolIndex);
+        case MSG_TYPE_DELETE_ORDER: return offsetof(DeleteOrderMessage, symbolIndex);
+        case MSG_TYPE_ORDER_EXECUTION: return offsetof(OrderExecutionMessage, symbolIndex);
+        case MSG_TYPE_REPLACE_ORDER: return offsetof(ReplaceOrderMessage, symbolIndex);
+        case MSG_TYPE_IMBALANCE: return offsetof(ImbalanceMessage, symbolIndex);
+        case MSG_TYPE_ADD_ORDER_REFRESH: return offsetof(AddOrderRefreshMessage, symbolIndex);
+        case MSG_TYPE_NON_DISPLAYED_TRADE: return offsetof(NonDisplayedTradeMessage, symbolIndex);
+        case MSG_TYPE_CROSS_TRADE: return offsetof(CrossTradeMessage, symbolIndex);
+        case MSG_TYPE_TRADE_CANCEL: return offsetof(TradeCancelMessage, symbolIndex);
+        case MSG_TYPE_CROSS_CORRECTION: return offsetof(CrossCorrectionMessage, symbolIndex);
+        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT: return offsetof(RetailPriceImprovementMessage, symbolIndex);
+        default: return SIZE_MAX;
+    }
+}
 
-        for (const auto& [price, orders] : bids) {
-            double adjustedPrice = static_cast<double>(price) / std::pow(10, priceScaleCode);
+// Source Time Stamp Definition
+// The source time fields of one message: nanoseconds within the second,
+// and the second itself for the messages that carry it
+struct SourceTimeStamp {
+    bool hasSeconds = false;
+    uint32_t seconds = 0;
+    uint32_t nanoseconds = 0;
+};
 
-            if (adjustedPrice > bar.high) {
-                bar.high = adjustedPrice;
-            }
-            if (adjustedPrice < bar.low) {
-                bar.low = adjustedPrice;
-            }
-        }
+// Read a message body's source time; false for messages without one or too
+// short to hold it
+bool messageSourceTime(uint16_t messageType, const uint8_t* body, size_t size, SourceTimeStamp& stamp) {
+    size_t wireSize = messageWireSize(messageType);
+    if (wireSize == 0 || size + sizeof(XDPMessageHeader) < wireSize) {
+        return false;
     }
-
-public:
-    void clearOrders() {
-        bids.clear();
-        asks.clear();
-        orderMap.clear();
-        std::cout << "Order book cleared.\n";
+    switch (messageType) {
+        case MSG_TYPE_SEQUENCE_NUMBER_RESET:
+        case MSG_TYPE_SYMBOL_CLEAR:
+        case MSG_TYPE_SECURITY_STATUS:
+        case MSG_TYPE_IMBALANCE:
+        case MSG_TYPE_ADD_ORDER_REFRESH:
+            stamp.hasSeconds = true;
+            std::memcpy(&stamp.seconds, body, sizeof(stamp.seconds));
+            std::memcpy(&stamp.nanoseconds, body + sizeof(uint32_t), sizeof(stamp.nanoseconds));
+            return true;
+        case MSG_TYPE_SOURCE_TIME_REFERENCE:
+            stamp.hasSeconds = true;
+            std::memcpy(&stamp.seconds, body + offsetof(SourceTimeReferenceMessage, sourceTime), sizeof(stamp.seconds));
+            stamp.nanoseconds = 0;
+            return true;
+        case MSG_TYPE_ADD_ORDER:
+        case MSG_TYPE_MODIFY_ORDER:
+        case MSG_TYPE_DELETE_ORDER:
+        case MSG_TYPE_ORDER_EXECUTION:
+        case MSG_TYPE_REPLACE_ORDER:
+        case MSG_TYPE_NON_DISPLAYED_TRADE:
+        case MSG_TYPE_CROSS_TRADE:
+        case MSG_TYPE_TRADE_CANCEL:
+        case MSG_TYPE_CROSS_CORRECTION:
+        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT:
+            stamp.hasSeconds = false;
+            std::memcpy(&stamp.nanoseconds, body, sizeof(stamp.nanoseconds));
+            return true;
+        default:
+            return false;
     }
-    void addOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
-                  uint64_t orderID, uint32_t price, uint32_t volume, char side, 
-                  const std::string& firmID, bool& top10Changed,
-                  const std::unordered_map<uint32_t, uint8_t>& symbolPriceScaleCodes,
-                  std::unordered_map<uint32_t, bar_t>& symbolBars) {
-        Order newOrder(orderID, price, volume, side, firmID);
-        auto& bookSide = (side == 'B') ? bids : asks;
+}
 
-        bookSide[price].push_back(newOrder);
-        orderMap[orderID] = &bookSide[price].back();
+// Typed view of a message body in place in the packet buffer. The message
+// structs are packed to alignment 1, so each field read is a single unaligned
+// little-endian load and nothing is copied. Callers check the size first.
+template <typename Message>
+const Message& messageView(const uint8_t* buffer) {
+    static_assert(alignof(Message) == 1, "message structs must be packed");
+    static_assert(std::is_trivially_copyable<Message>::value, "message structs must be plain data");
+    return *reinterpret_cast<const Message*>(buffer);
+}
 
-        const auto& newTopBids = getTopPrices(bids, true);
-        const auto& newTopAsks = getTopPrices(asks);
+// Log Level Definition
+enum class LogLevel : uint8_t {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off
+};
 
-        top10Changed = (newTopBids != top10Bids || newTopAsks != top10Asks);
-        if (top10Changed) {
-            top10Bids = newTopBids;
-            top10Asks = newTopAsks;
-        }
+// Log Event Definition
+// Every line the engine prints while replaying is one of these events. The
+// comment after each lists what the record's args hold.
+enum class LogEvent : uint8_t {
+    MessageProcessed,        // message type
+    UnknownMessage,          // message type
+    InvalidMessageSize,      // message type, size, expected size
+    PacketTooShort,          //
+    PacketSizeMismatch,      // expected, actual
+    MessageHeaderTooShort,   //
+    InvalidMessageHeader,    // message size
+    EthernetError,           //
+    NonIPv4Packet,           //
+    IPv4Error,               //
+    NonUDPPacket,            //
+    UDPError,                //
+    PayloadTooLong,          //
+    CaptureTruncated,        //
+    DatagramTruncated,       // received length
+    SequenceGap,             // channel, expected sequence number, received sequence number
+    SequenceGapLost,         // channel, first missing sequence number, message count
+    OrderAdded,              // order ID
+    OrderModifying,          // order ID
+    OrderModified,           // order ID
+    OrderExecuting,          // order ID
+    OrderExecuted,           // order ID, price, volume
+    OrderDeleted,            // order ID
+    OrderNotFound,           // order ID, operation (0 modify, 1 execute, 2 delete)
+    ExecutionTooLarge,       // order ID
+    VolumeTooLarge,          // order ID, volume
+    LevelNotFound,           // price
+    BookModeLocked,          //
+    BookCleared,             //
+    SymbolCleared,           // symbol index; text is the symbol name
+    NoBookForSymbol,         // symbol index
+    SymbolOutOfRange,        // symbol index
+    BookTitle,               // symbol index, mapped; text is the symbol name
+    BookHeader,              // symbol index; text is the symbol name
+    BookSide,                // 0 bids, 1 asks
+    BookSideEnd,             //
+    DepthLevel,              // price, price divisor bits, volume, order count
+    DepthOrders,             // up to two (order ID, volume) pairs, ID 0 = unused
+    DepthLevelEnd,           // changed
+    BarsBegin,               //
+    Bar,                     // high << 32 | low, previous close, volume, price divisor bits; text is the symbol name
+    BarsEmpty,               //
+    BarsEnd,                 //
+    OhlcvBar,                // start time ns, interval ns, open << 32 | high, price divisor bits; text is the symbol name
+    OhlcvBarEnd,             // low << 32 | close, volume, VWAP bits, trades << 9 | complete << 8 | price scale code
+    PrintingBars,            // elapsed seconds
+    AuctionUpdate,           // paired << 32 | total imbalance, match << 32 | reference price, changed fields << 16 | side << 8 | auction type, price divisor bits; text is the symbol name
+    GroupEnd                 // closes a group of records that must print together
+};
 
-        if (side == 'B') {
-            auto barIt = symbolBars.find(symbolIndex);
-            if (barIt != symbolBars.end()) {
-                auto& bar = barIt->second;
+// Log Record Definition
+// Fixed-size binary form of one event, a cache line each. Producers only
+// fill in numbers; all text formatting happens on the logger thread or
+// offline from a raw dump.
+struct alignas(64) LogRecord {
+    LogEvent event;
+    LogLevel level;
+    uint16_t flags;
+    uint32_t symbolIndex;
+    uint64_t args[4];
+    char text[24];
+};
+static_assert(sizeof(LogRecord) == 64, "LogRecord should fill one cache line");
 
-                double adjustedPrice = static_cast<double>(price) / std::pow(10, symbolPriceScaleCodes.at(symbolIndex));
+inline uint64_t doubleBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+inline double bitsDouble(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
 
-                if (adjustedPrice > bar.high) {
-                    bar.high = adjustedPrice;
-                }
-                if (adjustedPrice < bar.low) {
-                    bar.low = adjustedPrice;
-                }
-                bar.volume += volume;
+const char* messageName(uint16_t messageType) {
+    switch (messageType) {
+        case MSG_TYPE_SEQUENCE_NUMBER_RESET: return "Sequence Number Reset";
+        case MSG_TYPE_SOURCE_TIME_REFERENCE: return "Source Time Reference";
+        case MSG_TYPE_SYMBOL_INDEX_MAPPING: return "Symbol Index Mapping";
+        case MSG_TYPE_SYMBOL_CLEAR: return "Symbol Clear";
+        case MSG_TYPE_SECURITY_STATUS: return "Security Status";
+        case MSG_TYPE_ADD_ORDER: return "Add Order";
+        case MSG_TYPE_MODIFY_ORDER: return "Modify Order";
+        case MSG_TYPE_DELETE_ORDER: return "Delete Order";
+        case MSG_TYPE_ORDER_EXECUTION: return "Order Execution";
+        case MSG_TYPE_REPLACE_ORDER: return "Replace Order";
+        case MSG_TYPE_IMBALANCE: return "Imbalance";
+        case MSG_TYPE_ADD_ORDER_REFRESH: return "Add Order Refresh";
+        case MSG_TYPE_NON_DISPLAYED_TRADE: return "Non Displayed Trade";
+        case MSG_TYPE_CROSS_TRADE: return "Cross Trade";
+        case MSG_TYPE_TRADE_CANCEL: return "Trade Cancel";
+        case MSG_TYPE_CROSS_CORRECTION: return "Cross Correction";
+        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT: return "Retail Price Improvement";
+        default: return "Unknown";
+    }
+}
 
-                bar.update_count++;
-            }
+// Format a bar interval the way --bars takes it, e.g. 1s, 5m, 250ms
+std::string formatDuration(uint64_t nanoseconds) {
+    static const std::pair<uint64_t, const char*> units[] = {
+        {3600000000000ull, "h"}, {60000000000ull, "m"}, {1000000000ull, "s"}, {1000000ull, "ms"}};
+    for (const auto& unit : units) {
+        if (nanoseconds % unit.first == 0) {
+            return std::to_string(nanoseconds / unit.first) + unit.second;
         }
-
-        std::cout << "Added Order: " << orderID << "\n";
     }
-    void modifyOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
-                     uint64_t orderID, uint32_t price, uint32_t volume,
-                     uint8_t positionChange, char side, bool& top10Changed,
-                     const std::unordered_map<uint32_t, uint8_t>& symbolPriceScaleCodes,
-                     std::unordered_map<uint32_t, bar_t>& symbolBars) {
-        auto it = orderMap.find(orderID);
-        
-        if (it != orderMap.end()) {
-            Order* order = it->second;
-
-            std::cout << "Modifying Order: " << order->orderID << "\n";
-
-            bool wasBid = (order->side == 'B');
-            bool isBid = (side == 'B');
+    return std::to_string(nanoseconds) + "ns";
+}
 
-            bool recalculate;
-            if (wasBid) {
-                auto barIt = symbolBars.find(symbolIndex);
-                if (barIt != symbolBars.end()) {
-                    auto& bar = barIt->second;
-                    double adjustedPrice = static_cast<double>(order->price) / std::pow(10, symbolPriceScaleCodes.at(symbolIndex));
-            
-                    if (adjustedPrice == bar.high || adjustedPrice == bar.low) {
-                        recalculate = true;
-                    }
-                    bar.volume -= order->volume;
-                    bar.update_count++;
-                }
+// Format one record as the text the engine used to print directly
+void formatLogRecord(const LogRecord& record, std::ostream& out) {
+    const uint64_t* args = record.args;
+    switch (record.event) {
+        case LogEvent::MessageProcessed:
+            out << messageName(static_cast<uint16_t>(args[0])) << " Message Processed.\n";
+            break;
+        case LogEvent::UnknownMessage:
+            out << "Unknown message type: " << args[0] << "\n";
+            break;
+        case LogEvent::InvalidMessageSize:
+            out << "Invalid message size for type " << args[0] << ": " << args[1]
+                << " (expected " << args[2] << ")\n";
+            break;
+        case LogEvent::PacketTooShort:
+            out << "[Error] Insufficient data for Packet Header\n";
+            break;
+        case LogEvent::PacketSizeMismatch:
+            out << "[Error] Packet size mismatch. Expected: " << args[0] << ", Actual: " << args[1] << "\n";
+            break;
+        case LogEvent::MessageHeaderTooShort:
+            out << "[Error] Insufficient data for Message Header\n";
+            break;
+        case LogEvent::InvalidMessageHeader:
+            out << "[Error] Invalid message size " << args[0] << "\n";
+            break;
+        case LogEvent::EthernetError:
+            out << "Error parsing Ethernet header\n";
+            break;
+        case LogEvent::NonIPv4Packet:
+            out << "Skipping non-IPv4 packet\n";
+            break;
+        case LogEvent::IPv4Error:
+            out << "Error parsing IPv4 header\n";
+            break;
+        case LogEvent::NonUDPPacket:
+            out << "Skipping non-UDP packet\n";
+            break;
+        case LogEvent::UDPError:
+            out << "Error parsing UDP header\n";
+            break;
+        case LogEvent::PayloadTooLong:
+            out << "[Error] UDP payload exceeds packet length\n";
+            break;
+        case LogEvent::SequenceGap:
+            out << "[Warning] Sequence gap on channel " << args[0] << ": expected " << args[1]
+                << ", received " << args[2] << "\n";
+            break;
+        case LogEvent::SequenceGapLost:
+            out << "[Warning] Channel " << args[0] << " lost " << args[2] << " message(s) from sequence "
+                << args[1] << ": no line delivered them in time\n";
+            break;
+        case LogEvent::DatagramTruncated:
+            out << "[Error] Datagram of " << args[0] << " bytes truncated to the receive buffer\n";
+            break;
+        case LogEvent::CaptureTruncated:
+            out << "[Error] Capture file ends in the middle of a record\n";
+            break;
+        case LogEvent::OrderAdded:
+            out << "Added Order: " << args[0] << "\n";
+            break;
+        case LogEvent::OrderModifying:
+            out << "Modifying Order: " << args[0] << "\n";
+            break;
+        case LogEvent::OrderModified:
+            out << "Order Modified. New Order ID: " << args[0] << "\n";
+            break;
+        case LogEvent::OrderExecuting:
+            out << "Executing Order: " << args[0] << "\n";
+            break;
+        case LogEvent::OrderExecuted:
+            out << "Order Executed: " << args[0] << "\n"
+                << "  Price: " << args[1] << "\n"
+                << "  Volume: " << args[2] << "\n";
+            break;
+        case LogEvent::OrderDeleted:
+            out << "Deleted Order: " << args[0] << "\n";
+            break;
+        case LogEvent::OrderNotFound: {
+            static const char* const operations[] = {"modification", "execution", "deletion"};
+            out << "Order ID " << args[0] << " not found for " << operations[args[1] % 3] << "\n";
+            break;
+        }
+        case LogEvent::ExecutionTooLarge:
+            out << "Error: Execution volume exceeds order volume for Order ID " << args[0] << "\n";
+            break;
+        case LogEvent::VolumeTooLarge:
+            out << "Error: Volume " << args[1] << " of Order ID " << args[0]
+                << " is too large for a market-by-price book\n";
+            break;
+        case LogEvent::LevelNotFound:
+            out << "Price level not found for order: Price=" << args[0] << "\n";
+            break;
+        case LogEvent::BookModeLocked:
+            out << "Cannot change book mode while orders are resting\n";
+            break;
+        case LogEvent::BookCleared:
+            out << "Order book cleared.\n";
+            break;
+        case LogEvent::SymbolCleared:
+            out << "Cleared Order Book for Symbol: " << record.text
+                << " (SymbolIndex: " << record.symbolIndex << ")\n";
+            break;
+        case LogEvent::NoBookForSymbol:
+            out << "No order book found for SymbolIndex: " << record.symbolIndex << "\n";
+            break;
+        case LogEvent::SymbolOutOfRange:
+            out << "SymbolIndex " << record.symbolIndex << " out of range\n";
+            break;
+        case LogEvent::BookTitle:
+            if (args[0]) {
+                out << "Order Book for Symbol: " << record.text << " (SymbolIndex: " << record.symbolIndex << ")\n";
+            } else {
+                out << "Order Book for SymbolIndex: " << record.symbolIndex << " (Symbol not found in mappings)\n";
             }
-
-            order->price = price;
-            order->volume = volume;
-            order->side = side;
-
-            if (isBid) {
-                auto barIt = symbolBars.find(symbolIndex);
-                if (barIt != symbolBars.end()) {
-                    auto& bar = barIt->second;
-                    double adjustedPrice = static_cast<double>(price) / std::pow(10, symbolPriceScaleCodes.at(symbolIndex));
-
-                    if (recalculate) {
-                        recalculateBar(symbolIndex, bids, symbolPriceScaleCodes.at(symbolIndex), symbolBars);
-                    }
-                    bar.volume += volume;
-                    bar.update_count++;
+            break;
+        case LogEvent::BookHeader:
+            out << "\nOrder Book for Symbol: " << record.text << " (SymbolIndex: " << record.symbolIndex << ")\n";
+            break;
+        case LogEvent::BookSide:
+            out << (args[0] == 0 ? "Top 10 Bids:\n" : "Top 10 Asks:\n");
+            break;
+        case LogEvent::BookSideEnd:
+            out << "\n";
+            break;
+        case LogEvent::DepthLevel:
+            out << "Price " << (args[0] / bitsDouble(args[1])) << ": Vol=" << args[2]
+                << " Orders=" << args[3] << " ";
+            break;
+        case LogEvent::DepthOrders:
+            for (int i = 0; i < 4; i += 2) {
+                if (args[i] != 0) {
+                    out << "[ID=" << args[i] << ", Vol=" << args[i + 1] << "] ";
                 }
             }
-
-            const auto& newTopBids = getTopPrices(bids, true);
-            const auto& newTopAsks = getTopPrices(asks);
-
-            top10Changed = (newTopBids != top10Bids || newTopAsks != top10Asks);
-            if (top10Changed) {
-                top10Bids = newTopBids;
-                top10Asks = newTopAsks;
+            break;
+        case LogEvent::DepthLevelEnd:
+            out << (args[0] ? "*\n" : "\n");
+            break;
+        case LogEvent::BarsBegin:
+        case LogEvent::BarsEnd:
+            out << "--------------------------------------\n";
+            break;
+        case LogEvent::Bar: {
+            double priceDivisor = bitsDouble(args[3]);
+            double high = static_cast<uint32_t>(args[0] >> 32) / priceDivisor;
+            double low = static_cast<uint32_t>(args[0]) / priceDivisor;
+            double prevClose = args[1] / priceDivisor;
+            out << "Symbol: " << record.text
+                << "  High: " << high
+                << "  Low: " << low
+                << "  Previous Close: " << prevClose
+                << "  Volume: " << args[2];
+
+            float change_percent = (high - prevClose) / prevClose * 100;
+            std::string change_arrow;
+            if (change_percent < 0) {
+                change_arrow = "↓";
+            } else if (change_percent > 0) {
+                change_arrow = "↑";
+            } else {
+                change_arrow = "↕";
             }
 
-            std::cout << "Order Modified. New Order ID: " << order->orderID << "\n";
-        } else {
-            std::cerr << "Order ID " << orderID << " not found for modification\n";
+            out << "  Percent Change: " << change_arrow << " " << round(change_percent * 100.0) / 100.0 << "%\n";
+            break;
+        }
+        case LogEvent::BarsEmpty:
+            out << "No bars with updates to print.\n";
+            break;
+        case LogEvent::OhlcvBar: {
+            double priceDivisor = bitsDouble(args[3]);
+            out << "Bar " << record.text << " " << formatDuration(args[1]) << " from "
+                << args[0] / 1000000000 << "." << std::setw(9) << std::setfill('0') << args[0] % 1000000000
+                << std::setfill(' ') << ": Open " << static_cast<uint32_t>(args[2] >> 32) / priceDivisor
+                << " High " << static_cast<uint32_t>(args[2]) / priceDivisor;
+            break;
+        }
+        case LogEvent::OhlcvBarEnd: {
+            double priceDivisor = std::pow(10, args[3] & 0xFF);
+            out << " Low " << static_cast<uint32_t>(args[0] >> 32) / priceDivisor
+                << " Close " << static_cast<uint32_t>(args[0]) / priceDivisor
+                << " Volume " << args[1] << " VWAP " << bitsDouble(args[2]) / priceDivisor
+                << " Trades " << (args[3] >> 9) << (((args[3] >> 8) & 1) ? "\n" : " (partial)\n");
+            break;
         }
+        case LogEvent::PrintingBars:
+            out << "Printing bars at " << args[0] << " seconds.\n";
+            break;
+        case LogEvent::AuctionUpdate: {
+            double priceDivisor = bitsDouble(args[3]);
+            out << "Imbalance " << record.text << ": Auction " << static_cast<char>(args[2])
+                << " Side " << static_cast<char>(args[2] >> 8) << " Imbalance " << static_cast<uint32_t>(args[0])
+                << " Paired " << (args[0] >> 32) << " Reference " << static_cast<uint32_t>(args[1]) / priceDivisor
+                << " Match " << (args[1] >> 32) / priceDivisor << " (" << __builtin_popcountll(args[2] >> 16)
+                << " field(s) changed)\n";
+            break;
+        }
+        case LogEvent::GroupEnd:
+            break;
     }
-    void orderExecution(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
-                    uint64_t orderID, uint64_t tradeID, uint32_t price, uint32_t volume,
-                    uint8_t printableFlag, char tradeCond1, char tradeCond2, 
-                    char tradeCond3, char tradeCond4, bool& top10Changed) {
-        auto it = orderMap.find(orderID);
-
-        if (it != orderMap.end()) {
-            Order* order = it->second;
-
-            std::cout << "Executing Order: " << order->orderID << "\n";
-
-            if (order->volume >= volume) {
-                order->volume -= volume;
-            } else {
-                std::cerr << "Error: Execution volume exceeds order volume for Order ID " << orderID << "\n";
-                return;
-            }
-
-            if (order->volume == 0) {
-                auto& bookSide = (order->side == 'B') ? bids : asks;
-                auto levelIt = bookSide.find(order->price);
-
-                if (levelIt != bookSide.end()) {
-                    auto& orderList = levelIt->second;
-                    auto orderInList = std::find_if(orderList.begin(), orderList.end(),
-                        [&](const Order& o) { return o.orderID == order->orderID; });
+}
 
-                    if (orderInList != orderList.end()) {
-                        orderList.erase(orderInList);
+// SPSC Ring Definition
+// Single-producer single-consumer ring of fixed-size entries. The producer
+// owns `head`, the consumer owns `tail`; each keeps a cached copy of the
+// other's index so the shared cache lines are only touched when the cached
+// view runs out.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
 
-                        if (orderList.empty()) {
-                            bookSide.erase(levelIt);
-                        }
-                    }
-                }
+private:
+    std::unique_ptr<T[]> entries{new T[Capacity]};
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cachedTail = 0;
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t cachedHead = 0;
 
-                orderMap.erase(it);
+public:
+    // Producer side; false when the ring is full
+    bool push(const T& entry) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail == Capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail == Capacity) {
+                return false;
             }
-
-            const auto& newTopBids = getTopPrices(bids, true);
-            const auto& newTopAsks = getTopPrices(asks);
-
-            top10Changed = (newTopBids != top10Bids || newTopAsks != top10Asks);
-            if (top10Changed) {
-                top10Bids = newTopBids;
-                top10Asks = newTopAsks;
+        }
+        entries[h & (Capacity - 1)] = entry;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    // Consumer side; nullptr when the ring is empty
+    const T* front() {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t == cachedHead) {
+                return nullptr;
             }
-
-            std::cout << "Order Executed: " << orderID << "\n"
-                      << "  Price: " << price << "\n"
-                      << "  Volume: " << volume << "\n";
-        } else {
-            std::cerr << "Order ID " << orderID << " not found for execution\n";
         }
+        return &entries[t & (Capacity - 1)];
     }
-    void replaceOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
-                  uint64_t oldOrderID, uint64_t newOrderID, uint32_t price, 
-                  uint32_t volume, char side, bool& top10Changed,
-                  const std::unordered_map<uint32_t, uint8_t>& symbolPriceScaleCodes,
-                  std::unordered_map<uint32_t, bar_t>& symbolBars) {
-        deleteOrder(sourceTimeNS, symbolIndex, symbolSeqNum, oldOrderID, top10Changed, symbolPriceScaleCodes, symbolBars);
-
-        addOrder(sourceTimeNS, symbolIndex, symbolSeqNum, newOrderID, price, volume, side, "", top10Changed, symbolPriceScaleCodes, symbolBars);
+    void pop() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
-    void deleteOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
-                     uint64_t orderID, bool& top10Changed,
-                     const std::unordered_map<uint32_t, uint8_t>& symbolPriceScaleCodes,
-                     std::unordered_map<uint32_t, bar_t>& symbolBars) {
-        auto it = orderMap.find(orderID);
-        
-        if (it != orderMap.end()) {
-            Order* order = it->second;
-            auto& bookSide = (order->side == 'B') ? bids : asks;
-
-            bool recalculate;
-            if (order->side == 'B') {
-                auto barIt = symbolBars.find(symbolIndex);
-                if (barIt != symbolBars.end()) {
-                    auto& bar = barIt->second;
-
-                    bar.volume -= order->volume;
+};
 
-                    uint8_t priceScaleCode = symbolPriceScaleCodes.at(symbolIndex);
-                    double adjustedPrice = static_cast<double>(order->price) / std::pow(10, priceScaleCode);
+using LogRing = SpscRing<LogRecord, 1 << 16>;
+
+// Logger Definition
+// Asynchronous sink for LogRecords. Each producing thread gets its own ring
+// the first time it logs; a background thread drains the rings and either
+// formats the records (warnings and errors to stderr, the rest to stdout) or
+// appends them unformatted to a raw dump for decodeLog. Records written
+// between beginGroup and endGroup, such as the lines of one depth snapshot,
+// come out together even when several threads are logging. Records below the
+// threshold are dropped before anything is built, so --log-level off costs
+// one compare per event.
+class Logger {
+public:
+    static constexpr size_t kMaxRings = 64;
+    static constexpr uint16_t kContinued = 1;
+    static constexpr char kRawMagic[8] = {'O', 'B', 'L', 'O', 'G', '0', '1', '\0'};
 
-                    if (adjustedPrice == bar.high || adjustedPrice == bar.low) {
-                        bool recalculate = true;
+private:
+    LogLevel threshold = LogLevel::Debug;
+    std::FILE* rawFile = nullptr;
+    std::array<std::unique_ptr<LogRing>, kMaxRings> rings;
+    std::atomic<size_t> ringCount{0};
+    std::mutex registerMutex;
+    std::atomic<bool> running{false};
+    std::thread worker;
+    std::atomic<uint64_t> stalls{0};
+    uint64_t written = 0;
+    static inline thread_local unsigned groupDepth = 0;
+
+    LogRing* registerRing() {
+        std::lock_guard<std::mutex> lock(registerMutex);
+        size_t index = ringCount.load(std::memory_order_relaxed);
+        if (index == kMaxRings) {
+            return nullptr;
+        }
+        rings[index] = std::make_unique<LogRing>();
+        ringCount.store(index + 1, std::memory_order_release);
+        return rings[index].get();
+    }
+    void emit(const LogRecord& record) {
+        if (record.event == LogEvent::GroupEnd) {
+            return;
+        }
+        if (rawFile != nullptr) {
+            std::fwrite(&record, sizeof(record), 1, rawFile);
+        } else {
+            formatLogRecord(record, record.level >= LogLevel::Warning ? std::cerr : std::cout);
+        }
+        written++;
+    }
+    void run() {
+        while (true) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            size_t drained = 0;
+            size_t count = ringCount.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                // Stay on this ring until any group it is in the middle of ends
+                bool inGroup = false;
+                while (true) {
+                    const LogRecord* record = rings[i]->front();
+                    if (record == nullptr) {
+                        if (!inGroup) {
+                            break;
+                        }
+                        std::this_thread::yield();
+                        continue;
                     }
+                    inGroup = (record->flags & kContinued) != 0;
+                    emit(*record);
+                    rings[i]->pop();
+                    drained++;
                 }
             }
-
-            auto levelIt = bookSide.find(order->price);
-            if (levelIt != bookSide.end()) {
-                auto& orderList = levelIt->second;
-
-                auto orderInList = std::find_if(orderList.begin(), orderList.end(),
-                    [&](const Order& o) { return o.orderID == order->orderID; });
-                
-                if (orderInList != orderList.end()) {
-                    orderList.erase(orderInList);
-
-                    if (orderList.empty()) {
-                        bookSide.erase(levelIt);
-                    }
-                } else {
-                    std::cerr << "Order not found in price level for deletion: " << orderID << "\n";
+            if (drained == 0) {
+                if (stopping) {
+                    break;
                 }
-            } else {
-                std::cerr << "Price level not found for order deletion: Price=" << order->price << "\n";
-            }
-
-            orderMap.erase(it);
-
-            if (recalculate) {
-                uint8_t priceScaleCode = symbolPriceScaleCodes.at(symbolIndex);
-                recalculateBar(symbolIndex, bids, priceScaleCode, symbolBars);
-            }
-
-            const auto& newTopBids = getTopPrices(bids, true);
-            const auto& newTopAsks = getTopPrices(asks);
-
-            top10Changed = (newTopBids != top10Bids || newTopAsks != top10Asks);
-            if (top10Changed) {
-                top10Bids = newTopBids;
-                top10Asks = newTopAsks;
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
             }
-
-            std::cout << "Deleted Order: " << orderID << "\n";
-        } else {
-            std::cerr << "Order ID " << orderID << " not found for deletion\n";
         }
     }
-    void printOrderBook(uint32_t symbolIndex,
-                        const std::unordered_map<uint32_t, std::string>& symbolMappings,
-                        const std::unordered_map<uint32_t, uint8_t>& symbolPriceScaleCodes) const {
-        auto symbolIt = symbolMappings.find(symbolIndex);
-        std::string symbolName = (symbolIt != symbolMappings.end()) ? symbolIt->second : "Unknown";
 
-        auto scaleIt = symbolPriceScaleCodes.find(symbolIndex);
-        uint8_t priceScaleCode = (scaleIt != symbolPriceScaleCodes.end()) ? scaleIt->second : 0;
-        double priceDivisor = std::pow(10, priceScaleCode);
-
-        std::cout << "\nOrder Book for Symbol: " << symbolName << " (SymbolIndex: " << symbolIndex << ")\n";
+public:
+    ~Logger() {
+        stop();
+    }
 
-        std::cout << "Top 10 Bids:\n";
-        for (const auto& price : top10Bids) {
-            const auto& orders = bids.at(price);
-            std::cout << "Price " << (price / priceDivisor) << ": ";
-            for (const auto& order : orders) {
-                std::cout << "[ID=" << order.orderID << ", Vol=" << order.volume << "] ";
+    // Start the background thread; `rawPath` switches to a raw record dump
+    bool start(LogLevel level, const char* rawPath = nullptr) {
+        threshold = level;
+        if (rawPath != nullptr) {
+            rawFile = std::fopen(rawPath, "wb");
+            if (rawFile == nullptr) {
+                std::cerr << "Error opening log file: " << rawPath << "\n";
+                return false;
             }
-            std::cout << "\n";
+            uint32_t recordSize = sizeof(LogRecord);
+            std::fwrite(kRawMagic, sizeof(kRawMagic), 1, rawFile);
+            std::fwrite(&recordSize, sizeof(recordSize), 1, rawFile);
         }
-        std::cout << "\n";
-
-        std::cout << "Top 10 Asks:\n";
-        for (const auto& price : top10Asks) {
-            const auto& orders = asks.at(price);
-            std::cout << "Price " << (price / priceDivisor) << ": ";
-            for (const auto& order : orders) {
-                std::cout << "[ID=" << order.orderID << ", Vol=" << order.volume << "] ";
-            }
-            std::cout << "\n";
+        running.store(true, std::memory_order_release);
+        worker = std::thread(&Logger::run, this);
+        return true;
+    }
+    // Drain every ring and stop the background thread
+    void stop() {
+        if (!worker.joinable()) {
+            return;
         }
-        std::cout << "\n";
+        running.store(false, std::memory_order_release);
+        worker.join();
+        if (rawFile != nullptr) {
+            std::fclose(rawFile);
+            rawFile = nullptr;
+        }
+        std::cout.flush();
     }
-};
-
-// Global variables
-std::unordered_map<uint32_t, OrderBook> symbolOrderBooks;
-uint32_t currentSymbolIndex = 0;
-std::unordered_map<uint32_t, std::string> symbolMappings;
-std::unordered_map<uint32_t, uint8_t> symbolPriceScaleCodes;
-std::unordered_map<uint32_t, bar_t> symbolBars;
 
-// Print All Bars Function
-void printAllBars(const std::unordered_map<uint32_t, bar_t>& symbolBars, 
-                  const std::unordered_map<uint32_t, std::string>& symbolMappings) {
-    bool printed = false;
-    std::cout << "--------------------------------------\n";
-    for (const auto& [symbolIndex, bar] : symbolBars) {
-        if (bar.update_count > 0) {
-            auto symbolIt = symbolMappings.find(symbolIndex);
-            std::string symbolName = (symbolIt != symbolMappings.end()) ? symbolIt->second : "Unknown";
-
-            std::cout << "Symbol: " << symbolName 
-                      << "  High: " << bar.high 
-                      << "  Low: " << bar.low 
-                      << "  Previous Close: " << bar.prev_close
-                      << "  Volume: " << bar.volume;
-            
-            float change_percent = (bar.high - bar.prev_close) / bar.prev_close * 100;
-            std::string change_arrow;
-            if (change_percent < 0) {
-                change_arrow = "↓";
-            } else if (change_percent > 0) {
-                change_arrow = "↑";
-            } else {
-                change_arrow = "↕";
+    bool enabled(LogLevel level) const {
+        return level >= threshold;
+    }
+    // Queue a record on the calling thread's ring, waiting while it is full
+    void write(const LogRecord& entry) {
+        LogRecord record = entry;
+        if (groupDepth > 0) {
+            record.flags |= kContinued;
+        }
+        if (!running.load(std::memory_order_relaxed)) {
+            emit(record);
+            return;
+        }
+        thread_local LogRing* ring = nullptr;
+        if (ring == nullptr) {
+            ring = registerRing();
+            if (ring == nullptr) {
+                return;
             }
-
-            std::cout << "  Percent Change: " << change_arrow << " " << round(change_percent * 100.0) / 100.0 << "%\n";
-            printed = true;
+        }
+        while (!ring->push(record)) {
+            stalls.fetch_add(1, std::memory_order_relaxed);
+            std::this_thread::yield();
         }
     }
-    if (!printed) {
-        std::cout << "No bars with updates to print.\n";
-    }
-    std::cout << "--------------------------------------\n";
-}
 
-// Symbol Clear Order Function
-void symbolClear(uint32_t symbolIndex, 
-                 const std::unordered_map<uint32_t, std::string>& symbolMappings) {
-    auto it = symbolOrderBooks.find(symbolIndex);
-    if (it != symbolOrderBooks.end()) {
-        auto& orderBook = it->second;
-        orderBook.clearOrders();
-
-        auto symbolIt = symbolMappings.find(symbolIndex);
-        std::string symbolName = (symbolIt != symbolMappings.end()) ? symbolIt->second : "Unknown";
-
-        std::cout << "Cleared Order Book for Symbol: " << symbolName 
-                  << " (SymbolIndex: " << symbolIndex << ")\n";
-    } else {
-        std::cerr << "No order book found for SymbolIndex: " << symbolIndex << "\n";
+    void beginGroup() {
+        groupDepth++;
     }
-}
-
-// Add Order Function
-void addOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
-              uint64_t orderID, uint32_t price, uint32_t volume, char side, 
-              const std::string& firmID) {
-    bool symbolChanged = (symbolIndex != currentSymbolIndex);
-    if (symbolChanged) {
-        currentSymbolIndex = symbolIndex;
+    void endGroup() {
+        if (--groupDepth == 0) {
+            LogRecord record{};
+            record.event = LogEvent::GroupEnd;
+            record.level = LogLevel::Info;
+            write(record);
+        }
     }
 
-    auto& orderBook = symbolOrderBooks[symbolIndex];
+    void printStats() const {
+        std::cout << "Log: " << written << " record(s), " << stalls.load() << " stall(s) on a full ring\n";
+    }
+};
 
-    bool top10Changed = false;
-    orderBook.addOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, price, volume, side, firmID, top10Changed, symbolPriceScaleCodes, symbolBars);
+extern Logger logger;
 
-    if (symbolChanged || top10Changed) {
-        orderBook.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
+// Log an event with up to four numeric args
+inline void logEvent(LogLevel level, LogEvent event, uint64_t arg0 = 0, uint64_t arg1 = 0,
+                     uint64_t arg2 = 0, uint64_t arg3 = 0) {
+    if (!logger.enabled(level)) {
+        return;
     }
+    LogRecord record{};
+    record.event = event;
+    record.level = level;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    record.args[3] = arg3;
+    logger.write(record);
 }
-
-// Modify Order Function
-void modifyOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
-                 uint64_t orderID, uint32_t price, uint32_t volume,
-                 uint8_t positionChange, char side) {
-    bool symbolChanged = (symbolIndex != currentSymbolIndex);
-    if (symbolChanged) {
-        currentSymbolIndex = symbolIndex;
+// Log a per-symbol event carrying the symbol's name
+inline void logSymbolEvent(LogLevel level, LogEvent event, uint32_t symbolIndex, const std::string& name,
+                           uint64_t arg0 = 0, uint64_t arg1 = 0, uint64_t arg2 = 0, uint64_t arg3 = 0) {
+    if (!logger.enabled(level)) {
+        return;
     }
+    LogRecord record{};
+    record.event = event;
+    record.level = level;
+    record.symbolIndex = symbolIndex;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    record.args[3] = arg3;
+    std::memcpy(record.text, name.data(), std::min(name.size(), sizeof(record.text) - 1));
+    logger.write(record);
+}
 
-    auto& orderBook = symbolOrderBooks[symbolIndex];
-
-    bool top10Changed = false;
-    orderBook.modifyOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, price, volume, positionChange, side, top10Changed, symbolPriceScaleCodes, symbolBars);
-
-    if (symbolChanged || top10Changed) {
-        orderBook.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
+// Parse a --log-level name; false if it is not one
+bool parseLogLevel(const std::string& name, LogLevel& level) {
+    static const std::pair<const char*, LogLevel> levels[] = {
+        {"debug", LogLevel::Debug}, {"info", LogLevel::Info}, {"warning", LogLevel::Warning},
+        {"error", LogLevel::Error}, {"off", LogLevel::Off}};
+    for (const auto& entry : levels) {
+        if (name == entry.first) {
+            level = entry.second;
+            return true;
+        }
     }
+    return false;
 }
 
-// Order Execution Function
-void orderExecution(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
-                    uint64_t orderID, uint64_t tradeID, uint32_t price, uint32_t volume,
-                    uint8_t printableFlag, char tradeCond1, char tradeCond2, 
-                    char tradeCond3, char tradeCond4) {
-    bool symbolChanged = (symbolIndex != currentSymbolIndex);
-    if (symbolChanged) {
-        currentSymbolIndex = symbolIndex;
+// Decode Log Function
+// Format a raw dump written with --log-raw
+int decodeLog(const char* path, LogLevel threshold) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        std::cerr << "Error opening log file: " << path << "\n";
+        return 1;
     }
+    char magic[sizeof(Logger::kRawMagic)];
+    uint32_t recordSize = 0;
+    if (std::fread(magic, sizeof(magic), 1, file) != 1 || std::memcmp(magic, Logger::kRawMagic, sizeof(magic)) != 0 ||
+        std::fread(&recordSize, sizeof(recordSize), 1, file) != 1 || recordSize != sizeof(LogRecord)) {
+        std::cerr << "Not a raw order book log: " << path << "\n";
+        std::fclose(file);
+        return 1;
+    }
+    LogRecord record;
+    while (std::fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.level >= threshold) {
+            formatLogRecord(record, record.level >= LogLevel::Warning ? std::cerr : std::cout);
+        }
+    }
+    std::fclose(file);
+    return 0;
+}
 
-    auto& orderBook = symbolOrderBooks[symbolIndex];
-
-    bool top10Changed = false;
-    orderBook.orderExecution(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, tradeID, 
-                             price, volume, printableFlag, tradeCond1, tradeCond2, 
-                             tradeCond3, tradeCond4, top10Changed);
+// Auction Field Definition
+// The Imbalance message fields an auction state tracks, in message order;
+// bit N of a change mask is field N
+enum class AuctionField : uint8_t {
+    ReferencePrice,
+    PairedQty,
+    TotalImbalanceQty,
+    MarketImbalanceQty,
+    AuctionTime,
+    AuctionType,
+    ImbalanceSide,
+    ContinuousBookClearingPrice,
+    AuctionInterestClearingPrice,
+    SsrFilingPrice,
+    IndicativeMatchPrice,
+    UpperCollar,
+    LowerCollar,
+    AuctionStatus,
+    FreezeStatus,
+    NumExtensions,
+    UnpairedQty,
+    UnpairedSide,
+    SignificantImbalance,
+    Count
+};
 
-    if (symbolChanged || top10Changed) {
-        orderBook.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
-    }
+const char* auctionFieldName(uint8_t field) {
+    static const char* const names[] = {
+        "referencePrice", "pairedQty", "totalImbalanceQty", "marketImbalanceQty", "auctionTime",
+        "auctionType", "imbalanceSide", "continuousBookClearingPrice", "auctionInterestClearingPrice",
+        "ssrFilingPrice", "indicativeMatchPrice", "upperCollar", "lowerCollar", "auctionStatus",
+        "freezeStatus", "numExtensions", "unpairedQty", "unpairedSide", "significantImbalance"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(AuctionField::Count),
+                  "a name for every auction field");
+    return field < static_cast<uint8_t>(AuctionField::Count) ? names[field] : "unknown";
 }
 
-// Replace Order Function
-void replaceOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
+// Market Data Record Definitions
+// Binary output for downstream consumers, laid out in the style of SBE: each
+// message is an 8-byte header followed by a fixed root block whose fields
+// sit at naturally aligned offsets, little-endian, padding spelled out.
+// Consumers skip blocks by blockLength, so templates can grow at the end.
+// Prices are raw feed integers; the symbol definition carries the scale.
+constexpr uint16_t kMdSchemaId = 1;
+constexpr uint16_t kMdSchemaVersion = 1;
+constexpr size_t kMdMaxBlock = 48;
+
+enum class MdTemplate : uint16_t {
+    SymbolDefinition = 1,
+    Bbo = 2,
+    LevelDelta = 3,
+    Trade = 4,
+    BarClose = 5,
+    Ohlcv = 6,
+    AuctionUpdate = 7,
+};
+
+struct MdHeader {
+    uint16_t blockLength;
+    uint16_t templateId;
+    uint16_t schemaId;
+    uint16_t version;
+};
+
+// Sent when a symbol is mapped, and for every mapped symbol after a restore
+struct MdSymbolDefinition {
+    static constexpr MdTemplate kTemplate = MdTemplate::SymbolDefinition;
+    uint32_t symbolIndex;
+    uint32_t prevClosePrice;
+    char symbol[16];
+    uint8_t priceScaleCode;
+    uint8_t marketByPrice;
+    uint8_t padding[2];
+};
+
+// Top of book after either inside level changed; empty sides are all zero
+struct MdBbo {
+    static constexpr MdTemplate kTemplate = MdTemplate::Bbo;
+    uint64_t bidVolume;
+    uint64_t askVolume;
+    uint32_t symbolIndex;
+    uint32_t sourceTimeNS;
+    uint32_t symbolSeqNum;
+    uint32_t bidPrice;
+    uint32_t askPrice;
+    uint32_t bidOrders;
+    uint32_t askOrders;
+    uint32_t padding;
+};
+
+// New contents of visible level `level` (0 is the inside) of one side.
+// Levels are positional: kLevelCleared means the side now has fewer levels.
+struct MdLevelDelta {
+    static constexpr MdTemplate kTemplate = MdTemplate::LevelDelta;
+    static constexpr uint8_t kLevelSet = 0;
+    static constexpr uint8_t kLevelCleared = 1;
+    uint64_t volume;
+    uint32_t symbolIndex;
+    uint32_t sourceTimeNS;
+    uint32_t symbolSeqNum;
+    uint32_t price;
+    uint32_t orderCount;
+    char side;
+    uint8_t level;
+    uint8_t action;
+    uint8_t padding;
+};
+
+// An execution against a resting order ('E', with its side), a
+// non-displayed trade ('N') or a cross ('X', crossID in tradeID)
+struct MdTrade {
+    static constexpr MdTemplate kTemplate = MdTemplate::Trade;
+    uint64_t tradeID;
+    uint64_t orderID;
+    uint32_t symbolIndex;
+    uint32_t sourceTimeNS;
+    uint32_t symbolSeqNum;
+    uint32_t price;
+    uint32_t volume;
+    char tradeType;
+    char side;
+    uint8_t printableFlag;
+    char tradeConditions[4];
+    uint8_t padding[5];
+};
+
+// A symbol's bar as of a bar interval
+struct MdBarClose {
+    static constexpr MdTemplate kTemplate = MdTemplate::BarClose;
+    uint64_t volume;
+    uint64_t updateCount;
+    uint32_t symbolIndex;
+    uint32_t high;
+    uint32_t low;
+    uint32_t prevClose;
+};
+
+// A closed source-time bar of printable trades; VWAP is rounded to the
+// price's scale. Bars still open at exit are sent as they stand.
+struct MdOhlcvBar {
+    static constexpr MdTemplate kTemplate = MdTemplate::Ohlcv;
+    uint64_t startNS;
+    uint64_t volume;
+    uint32_t symbolIndex;
+    uint32_t intervalMS;
+    uint32_t open;
+    uint32_t high;
+    uint32_t low;
+    uint32_t close;
+    uint32_t vwap;
+    uint32_t trades;
+};
+
+// One Imbalance message field that changed; chars and small counts are
+// widened into value. A symbol's first Imbalance message sends every field.
+struct MdAuctionUpdate {
+    static constexpr MdTemplate kTemplate = MdTemplate::AuctionUpdate;
+    uint32_t symbolIndex;
+    uint32_t sourceTimeNS;
+    uint32_t symbolSeqNum;
+    uint32_t value;
+    uint8_t field;
+    uint8_t padding[3];
+};
+
+static_assert(sizeof(MdHeader) == 8, "MdHeader layout changed");
+static_assert(sizeof(MdSymbolDefinition) == 28, "MdSymbolDefinition layout changed");
+static_assert(sizeof(MdBbo) == 48, "MdBbo layout changed");
+static_assert(sizeof(MdLevelDelta) == 32, "MdLevelDelta layout changed");
+static_assert(sizeof(MdTrade) == 48, "MdTrade layout changed");
+static_assert(sizeof(MdBarClose) == 32, "MdBarClose layout changed");
+static_assert(sizeof(MdOhlcvBar) == 48, "MdOhlcvBar layout changed");
+static_assert(sizeof(MdAuctionUpdate) == 20, "MdAuctionUpdate layout changed");
+
+// Market Data Record Definition
+// One message as queued from a book thread to the publisher
+struct alignas(64) MdRecord {
+    MdHeader header;
+    uint8_t block[kMdMaxBlock];
+};
+static_assert(sizeof(MdRecord) == 64, "MdRecord should fill one cache line");
+
+using MdRing = SpscRing<MdRecord, 1 << 16>;
+
+// Market Data Publisher Definition
+// Same shape as the Logger: book threads copy fixed records into their own
+// ring and a background thread drains the rings into the sinks, so the
+// message path never formats or makes a system call. The file sink appends
+// header and block of each message after a short file header. The
+// shared-memory sink is a broadcast ring of 64-byte slots in /dev/shm; each
+// slot carries the global sequence number of the message in it, zeroed
+// while it is rewritten, so readers at any pace can tell a good copy from
+// one they were lapped on. Messages of one symbol stay in order; with
+// --threads, different shards interleave.
+class MarketDataPublisher {
+public:
+    static constexpr size_t kMaxRings = 64;
+    static constexpr char kFileMagic[8] = {'O', 'B', 'M', 'D', 'A', 'T', '0', '1'};
+    static constexpr char kShmMagic[8] = {'O', 'B', 'M', 'D', 'S', 'H', 'M', '1'};
+
+    struct ShmHeader {
+        char magic[8];
+        uint16_t schemaId;
+        uint16_t version;
+        uint32_t slotSize;
+        uint64_t slotCount;
+        alignas(64) std::atomic<uint64_t> writeSequence;
+    };
+    struct alignas(64) ShmSlot {
+        std::atomic<uint64_t> sequence;
+        MdHeader header;
+        uint8_t block[kMdMaxBlock];
+    };
+    static_assert(sizeof(ShmHeader) == 128, "ShmHeader layout changed");
+    static_assert(sizeof(ShmSlot) == 64, "ShmSlot layout changed");
+
+private:
+    bool active = false;
+    std::FILE* file = nullptr;
+    ShmHeader* shm = nullptr;
+    ShmSlot* slots = nullptr;
+    size_t shmBytes = 0;
+    uint64_t slotMask = 0;
+    uint64_t sequence = 0;
+    std::array<std::unique_ptr<MdRing>, kMaxRings> rings;
+    std::atomic<size_t> ringCount{0};
+    std::mutex registerMutex;
+    std::atomic<bool> running{false};
+    std::thread worker;
+    std::atomic<uint64_t> stalls{0};
+    std::array<uint64_t, 8> published{};
+
+    MdRing* registerRing() {
+        std::lock_guard<std::mutex> lock(registerMutex);
+        size_t index = ringCount.load(std::memory_order_relaxed);
+        if (index == kMaxRings) {
+            return nullptr;
+        }
+        rings[index] = std::make_unique<MdRing>();
+        ringCount.store(index + 1, std::memory_order_release);
+        return rings[index].get();
+    }
+    void emit(const MdRecord& record) {
+        sequence++;
+        if (file != nullptr) {
+            std::fwrite(&record.header, sizeof(record.header) + record.header.blockLength, 1, file);
+        }
+        if (shm != nullptr) {
+            ShmSlot& slot = slots[(sequence - 1) & slotMask];
+            slot.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.header = record.header;
+            std::memcpy(slot.block, record.block, sizeof(slot.block));
+            slot.sequence.store(sequence, std::memory_order_release);
+            shm->writeSequence.store(sequence, std::memory_order_release);
+        }
+        published[record.header.templateId < published.size() ? record.header.templateId : 0]++;
+    }
+    void run() {
+        while (true) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            size_t drained = 0;
+            size_t count = ringCount.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                while (const MdRecord* record = rings[i]->front()) {
+                    emit(*record);
+                    rings[i]->pop();
+                    drained++;
+                }
+            }
+            if (drained == 0) {
+                if (stopping) {
+                    break;
+                }
+                if (file != nullptr) {
+                    std::fflush(file);
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+        }
+    }
+
+public:
+    ~MarketDataPublisher() {
+        stop();
+        if (shm != nullptr) {
+            munmap(shm, shmBytes);
+        }
+    }
+
+    // Append messages to a file
+    bool openFile(const char* path) {
+        file = std::fopen(path, "wb");
+        if (file == nullptr) {
+            std::cerr << "Error opening market data file: " << path << "\n";
+            return false;
+        }
+        uint16_t schema[2] = {kMdSchemaId, kMdSchemaVersion};
+        std::fwrite(kFileMagic, sizeof(kFileMagic), 1, file);
+        std::fwrite(schema, sizeof(schema), 1, file);
+        active = true;
+        return true;
+    }
+    // Create (or replace) the shared-memory ring /dev/shm/NAME with room for
+    // `slotCount` messages, rounded up to a power of two
+    bool openShm(const char* name, size_t slotCount) {
+        std::string path = (name[0] == '/') ? name : std::string("/") + name;
+        size_t count = 1;
+        while (count < std::max<size_t>(slotCount, 2)) {
+            count <<= 1;
+        }
+        int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Error creating shared memory " << path << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        shmBytes = sizeof(ShmHeader) + count * sizeof(ShmSlot);
+        void* mapping = MAP_FAILED;
+        if (ftruncate(fd, shmBytes) == 0) {
+            mapping = mmap(nullptr, shmBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Error mapping shared memory " << path << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        shm = static_cast<ShmHeader*>(mapping);
+        slots = reinterpret_cast<ShmSlot*>(static_cast<uint8_t*>(mapping) + sizeof(ShmHeader));
+        slotMask = count - 1;
+        shm->schemaId = kMdSchemaId;
+        shm->version = kMdSchemaVersion;
+        shm->slotSize = sizeof(ShmSlot);
+        shm->slotCount = count;
+        shm->writeSequence.store(0, std::memory_order_relaxed);
+        // Readers wait for the magic, so it goes in last
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(shm->magic, kShmMagic, sizeof(kShmMagic));
+        active = true;
+        return true;
+    }
+    void start() {
+        if (!active) {
+            return;
+        }
+        running.store(true, std::memory_order_release);
+        worker = std::thread(&MarketDataPublisher::run, this);
+    }
+    // Drain every ring and stop the background thread
+    void stop() {
+        if (!worker.joinable()) {
+            return;
+        }
+        running.store(false, std::memory_order_release);
+        worker.join();
+        if (file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool enabled() const {
+        return active;
+    }
+    // Queue one message, waiting while the calling thread's ring is full
+    template <typename Block>
+    void publish(const Block& block) {
+        static_assert(sizeof(Block) <= kMdMaxBlock, "Market data block does not fit a record");
+        MdRecord record;
+        record.header = {sizeof(Block), static_cast<uint16_t>(Block::kTemplate), kMdSchemaId, kMdSchemaVersion};
+        std::memcpy(record.block, &block, sizeof(Block));
+        write(record);
+    }
+    // Queue a record on the calling thread's ring. Not part of publish, whose
+    // every instantiation would otherwise get a ring of its own per thread.
+    void write(const MdRecord& record) {
+        if (!running.load(std::memory_order_relaxed)) {
+            emit(record);
+            return;
+        }
+        thread_local MdRing* ring = nullptr;
+        if (ring == nullptr) {
+            ring = registerRing();
+            if (ring == nullptr) {
+                return;
+            }
+        }
+        while (!ring->push(record)) {
+            stalls.fetch_add(1, std::memory_order_relaxed);
+            std::this_thread::yield();
+        }
+    }
+
+    void printStats() const {
+        if (!active) {
+            return;
+        }
+        std::cout << "Market data: " << sequence << " message(s) (" << published[1] << " definition(s), "
+                  << published[2] << " BBO, " << published[3] << " level delta(s), " << published[4]
+                  << " trade(s), " << published[5] << " bar(s), " << published[6] << " OHLCV bar(s), " << published[7]
+                  << " auction update(s)), " << stalls.load() << " stall(s) on a full ring\n";
+    }
+};
+
+extern MarketDataPublisher marketData;
+
+// Top Of Book Publisher Definition
+// Writes each symbol's ten best levels a side into its slot of a /dev/shm
+// segment through the TopOfBookWriter in top_of_book.h. A slot is only
+// ever written by the book thread that owns its symbol, so writes take no
+// lock, and a seqlock lets readers in other processes take consistent
+// copies without ever holding the writer up.
+class TopOfBookPublisher {
+private:
+    TopOfBookWriter writer;
+    bool opened = false;
+    std::atomic<uint64_t> outOfRange{0};
+
+public:
+    // Create /dev/shm/NAME with a slot for each symbol index below `symbols`,
+    // replacing any existing segment
+    bool open(const char* name, uint32_t symbols) {
+        if (!writer.open(name, symbols)) {
+            std::cerr << "Error creating shared memory " << name << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        opened = true;
+        return true;
+    }
+    bool enabled() const {
+        return opened;
+    }
+
+    void write(uint32_t symbolIndex, const TobBook& book) {
+        if (!writer.write(symbolIndex, book)) {
+            outOfRange.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void printStats() const {
+        if (!enabled()) {
+            return;
+        }
+        uint64_t writes = 0, symbols = 0;
+        for (uint32_t symbolIndex = 0; symbolIndex < writer.capacity(); ++symbolIndex) {
+            uint32_t version = writer.version(symbolIndex);
+            writes += version;
+            symbols += (version != 0);
+        }
+        std::cout << "Top of book: " << writes << " write(s) to " << symbols << " of " << writer.capacity()
+                  << " slot(s), " << outOfRange.load() << " for symbols past the last slot\n";
+    }
+};
+
+extern TopOfBookPublisher topOfBook;
+
+// Format one market data message as a line of text
+void formatMdMessage(const MdHeader& header, const uint8_t* block, std::ostream& out) {
+    auto view = [&](auto& fields) {
+        std::memcpy(&fields, block, std::min<size_t>(sizeof(fields), header.blockLength));
+    };
+    switch (static_cast<MdTemplate>(header.templateId)) {
+        case MdTemplate::SymbolDefinition: {
+            MdSymbolDefinition m{};
+            view(m);
+            out << "Definition symbol=" << m.symbolIndex << " " << std::string(m.symbol, strnlen(m.symbol, sizeof(m.symbol)))
+                << " scale=" << unsigned(m.priceScaleCode) << " prevClose=" << m.prevClosePrice
+                << " mbp=" << unsigned(m.marketByPrice) << "\n";
+            break;
+        }
+        case MdTemplate::Bbo: {
+            MdBbo m{};
+            view(m);
+            out << "BBO symbol=" << m.symbolIndex << " seq=" << m.symbolSeqNum << " time=" << m.sourceTimeNS
+                << " bid=" << m.bidVolume << "@" << m.bidPrice << "/" << m.bidOrders
+                << " ask=" << m.askVolume << "@" << m.askPrice << "/" << m.askOrders << "\n";
+            break;
+        }
+        case MdTemplate::LevelDelta: {
+            MdLevelDelta m{};
+            view(m);
+            out << "Level symbol=" << m.symbolIndex << " seq=" << m.symbolSeqNum << " time=" << m.sourceTimeNS
+                << " side=" << m.side << " level=" << unsigned(m.level);
+            if (m.action == MdLevelDelta::kLevelCleared) {
+                out << " cleared\n";
+            } else {
+                out << " " << m.volume << "@" << m.price << "/" << m.orderCount << "\n";
+            }
+            break;
+        }
+        case MdTemplate::Trade: {
+            MdTrade m{};
+            view(m);
+            out << "Trade symbol=" << m.symbolIndex << " seq=" << m.symbolSeqNum << " time=" << m.sourceTimeNS
+                << " type=" << m.tradeType << " " << m.volume << "@" << m.price << " tradeID=" << m.tradeID;
+            if (m.tradeType == 'E') {
+                out << " orderID=" << m.orderID << " side=" << m.side;
+            }
+            out << " printable=" << unsigned(m.printableFlag) << "\n";
+            break;
+        }
+        case MdTemplate::BarClose: {
+            MdBarClose m{};
+            view(m);
+            out << "Bar symbol=" << m.symbolIndex << " high=" << m.high << " low=" << m.low
+                << " prevClose=" << m.prevClose << " volume=" << m.volume << " updates=" << m.updateCount << "\n";
+            break;
+        }
+        case MdTemplate::Ohlcv: {
+            MdOhlcvBar m{};
+            view(m);
+            out << "OHLCV symbol=" << m.symbolIndex << " interval=" << formatDuration(m.intervalMS * 1000000ull)
+                << " start=" << m.startNS << " open=" << m.open << " high=" << m.high << " low=" << m.low
+                << " close=" << m.close << " volume=" << m.volume << " vwap=" << m.vwap << " trades=" << m.trades << "\n";
+            break;
+        }
+        case MdTemplate::AuctionUpdate: {
+            MdAuctionUpdate m{};
+            view(m);
+            out << "Auction symbol=" << m.symbolIndex << " seq=" << m.symbolSeqNum << " time=" << m.sourceTimeNS
+                << " " << auctionFieldName(m.field) << "=" << m.value << "\n";
+            break;
+        }
+        default:
+            out << "Unknown template " << header.templateId << " (" << header.blockLength << " bytes)\n";
+            break;
+    }
+}
+
+// Decode Market Data Function
+// Format a file written with --md-out
+int decodeMarketData(const char* path) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        std::cerr << "Error opening market data file: " << path << "\n";
+        return 1;
+    }
+    char magic[sizeof(MarketDataPublisher::kFileMagic)];
+    uint16_t schema[2];
+    if (std::fread(magic, sizeof(magic), 1, file) != 1 ||
+        std::memcmp(magic, MarketDataPublisher::kFileMagic, sizeof(magic)) != 0 ||
+        std::fread(schema, sizeof(schema), 1, file) != 1 || schema[0] != kMdSchemaId) {
+        std::cerr << "Not an order book market data file: " << path << "\n";
+        std::fclose(file);
+        return 1;
+    }
+    MdHeader header;
+    std::vector<uint8_t> block;
+    while (std::fread(&header, sizeof(header), 1, file) == 1) {
+        block.resize(header.blockLength);
+        if (header.blockLength > 0 && std::fread(block.data(), header.blockLength, 1, file) != 1) {
+            std::cerr << "Truncated market data message\n";
+            break;
+        }
+        formatMdMessage(header, block.data(), std::cout);
+    }
+    std::fclose(file);
+    return 0;
+}
+
+// Read Top Of Book Function
+// Print every published book in a segment written with --tob-shm
+int readTopOfBook(const char* name) {
+    TopOfBookReader reader;
+    if (!reader.open(name)) {
+        std::cerr << "Not an order book top of book segment: " << name << "\n";
+        return 1;
+    }
+    TobBook book;
+    for (uint32_t symbolIndex = 0; symbolIndex < reader.capacity(); ++symbolIndex) {
+        if (!reader.read(symbolIndex, book)) {
+            continue;
+        }
+        double priceDivisor = std::pow(10, book.priceScaleCode);
+        std::cout << std::string(book.symbol, strnlen(book.symbol, sizeof(book.symbol))) << " symbol=" << symbolIndex
+                  << " seq=" << book.symbolSeqNum << " time=" << book.sourceTimeNS << " levels="
+                  << unsigned(book.bidCount) << "/" << unsigned(book.askCount);
+        if (book.bidCount > 0) {
+            std::cout << " bid=" << book.bids[0].volume << "@" << book.bids[0].price / priceDivisor;
+        }
+        if (book.askCount > 0) {
+            std::cout << " ask=" << book.asks[0].volume << "@" << book.asks[0].price / priceDivisor;
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+// Latency Histogram Definition
+// Log-linear buckets in the style of HdrHistogram: values below 32 get a
+// bucket each, and every power of two above that is split into 32 equal
+// sub-buckets, so a recorded value is off by at most ~3%. Counters are
+// relaxed atomics, so any thread can record and read without a lock.
+class LatencyHistogram {
+private:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr uint64_t kSubBuckets = 1ull << kSubBucketBits;
+    static constexpr size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    std::array<std::atomic<uint64_t>, kBuckets> counts{};
+    std::atomic<uint64_t> maxValue{0};
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        unsigned shift = 63 - __builtin_clzll(value) - kSubBucketBits + 1;
+        return shift * kSubBuckets + (value >> (shift - 1)) - kSubBuckets;
+    }
+    // Highest value that lands in bucket `index`
+    static uint64_t bucketTop(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        unsigned shift = index / kSubBuckets;
+        uint64_t sub = index % kSubBuckets + kSubBuckets;
+        return ((sub + 1) << (shift - 1)) - 1;
+    }
+
+public:
+    void record(uint64_t value) {
+        counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = maxValue.load(std::memory_order_relaxed);
+        while (value > seen && !maxValue.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto& bucket : counts) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    uint64_t max() const {
+        return maxValue.load(std::memory_order_relaxed);
+    }
+    // Upper bound of the bucket holding the q-quantile of `total` samples
+    uint64_t quantile(double q, uint64_t total) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank && seen > 0) {
+                return std::min(bucketTop(i), max());
+            }
+        }
+        return max();
+    }
+};
+
+#ifdef ORDER_BOOK_LATENCY
+inline uint64_t readTSC() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Latency Timer Definition
+// Records the TSC ticks between construction and destruction
+class LatencyTimer {
+private:
+    LatencyHistogram& histogram;
+    uint64_t start;
+
+public:
+    explicit LatencyTimer(LatencyHistogram& histogram) : histogram(histogram), start(readTSC()) {}
+    ~LatencyTimer() {
+        histogram.record(readTSC() - start);
+    }
+};
+
+// Latency Stats Definition
+// One histogram per pipeline stage, per message type and per book depth
+// tier. Ticks are converted to nanoseconds with a rate measured against
+// steady_clock over the whole run, so no calibration pause is needed.
+class LatencyStats {
+public:
+    static constexpr size_t kTiers = 3;
+
+    LatencyHistogram packetRead;
+    LatencyHistogram pillarStream;
+    std::array<LatencyHistogram, 256> messages;
+    std::array<LatencyHistogram, kTiers> bookUpdates;
+
+private:
+    uint64_t startTicks = readTSC();
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    double nanosPerTick() const {
+        uint64_t ticks = readTSC() - startTicks;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime);
+        return ticks ? static_cast<double>(elapsed.count()) / ticks : 1.0;
+    }
+    static void printRow(std::ostream& out, const std::string& name, const LatencyHistogram& histogram,
+                         double scale) {
+        uint64_t total = histogram.count();
+        if (total == 0) {
+            return;
+        }
+        out << "  " << std::left << std::setw(28) << name << std::right << std::setw(12) << total;
+        for (double q : {0.5, 0.99, 0.999}) {
+            out << std::setw(10) << static_cast<uint64_t>(histogram.quantile(q, total) * scale);
+        }
+        out << std::setw(10) << static_cast<uint64_t>(histogram.max() * scale) << "\n";
+    }
+
+public:
+    // Book depth tier of a symbol by the price levels it holds
+    LatencyHistogram& bookUpdate(size_t priceLevels) {
+        return bookUpdates[priceLevels < 64 ? 0 : priceLevels < 1024 ? 1 : 2];
+    }
+
+    // Block SIGUSR1 and dump on it from a thread of its own. Must run before
+    // any other thread starts so they all inherit the blocked mask.
+    void startSignalDumps() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        std::thread([this, signals]() {
+            int signal;
+            while (sigwait(&signals, &signal) == 0) {
+                print(std::cerr);
+            }
+        }).detach();
+    }
+
+    void print(std::ostream& out) const {
+        static const char* const tiers[kTiers] = {"book < 64 levels", "book < 1024 levels", "book >= 1024 levels"};
+        static std::mutex printMutex;
+        std::lock_guard<std::mutex> lock(printMutex);
+
+        double scale = nanosPerTick();
+        out << "Latency (ns)" << std::string(18, ' ') << std::setw(12) << "count" << std::setw(10) << "p50"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << "\n";
+        printRow(out, "packet read", packetRead, scale);
+        printRow(out, "parsePillarStream", pillarStream, scale);
+        for (size_t type = 0; type < messages.size(); ++type) {
+            printRow(out, std::to_string(type) + " " + messageName(static_cast<uint16_t>(type)),
+                     messages[type], scale);
+        }
+        for (size_t tier = 0; tier < kTiers; ++tier) {
+            printRow(out, std::string("update, ") + tiers[tier], bookUpdates[tier], scale);
+        }
+        out << std::flush;
+    }
+};
+
+extern LatencyStats latencyStats;
+
+// Time the rest of the enclosing scope into `histogram`. Without
+// ORDER_BOOK_LATENCY the macro is an empty statement and its argument is
+// never evaluated.
+#define LATENCY_SCOPE(histogram) LatencyTimer latencyTimer(histogram)
+#else
+#define LATENCY_SCOPE(histogram) do {} while (0)
+#endif
+
+// Price Level Definition
+// Aggregate volume and order count are kept for every level; the order queue
+// is only linked for books that keep per-order detail.
+struct PriceLevel {
+    Order* head = nullptr;
+    Order* tail = nullptr;
+    uint64_t totalVolume = 0;
+    uint32_t orderCount = 0;
+
+    bool empty() const {
+        return orderCount == 0;
+    }
+    void addAggregate(uint32_t volume) {
+        orderCount++;
+        totalVolume += volume;
+    }
+    void removeAggregate(uint32_t volume) {
+        orderCount--;
+        totalVolume -= volume;
+    }
+    void pushBack(Order* order) {
+        order->prev = tail;
+        order->next = nullptr;
+        if (tail != nullptr) {
+            tail->next = order;
+        } else {
+            head = order;
+        }
+        tail = order;
+        addAggregate(order->volume);
+    }
+    void unlink(Order* order) {
+        removeAggregate(order->volume);
+        if (order->prev != nullptr) {
+            order->prev->next = order->next;
+        } else {
+            head = order->next;
+        }
+        if (order->next != nullptr) {
+            order->next->prev = order->prev;
+        } else {
+            tail = order->prev;
+        }
+        order->prev = nullptr;
+        order->next = nullptr;
+    }
+};
+
+// Order Pool Definition
+// Order nodes are carved out of preallocated slabs and recycled through a
+// free list, so adding and removing orders never touches the heap. Running
+// out of slab space allocates another slab and counts as an exhaustion.
+class OrderPool {
+private:
+    static constexpr size_t kDefaultSlabOrders = 1 << 20;
+
+    size_t slabOrders;
+    std::vector<std::unique_ptr<Order[]>> slabs;
+    size_t slabUsed = 0;
+    Order* freeList = nullptr;
+    size_t inUse = 0;
+    size_t highWater = 0;
+    size_t exhaustionCount = 0;
+
+    void addSlab() {
+        slabs.emplace_back(new Order[slabOrders]);
+        slabUsed = 0;
+    }
+
+public:
+    explicit OrderPool(size_t slabOrders = kDefaultSlabOrders) : slabOrders(slabOrders) {
+        addSlab();
+    }
+    OrderPool(const OrderPool&) = delete;
+    OrderPool& operator=(const OrderPool&) = delete;
+
+    Order* acquire() {
+        Order* order;
+        if (freeList != nullptr) {
+            order = freeList;
+            freeList = order->next;
+        } else {
+            if (slabUsed == slabOrders) {
+                exhaustionCount++;
+                addSlab();
+            }
+            order = &slabs.back()[slabUsed++];
+        }
+        if (++inUse > highWater) {
+            highWater = inUse;
+        }
+        return order;
+    }
+    void release(Order* order) {
+        order->next = freeList;
+        freeList = order;
+        inUse--;
+    }
+    void printStats() const {
+        std::cout << "Order pool: " << slabs.size() << " slab(s) of " << slabOrders
+                  << " orders, in use " << inUse << ", high water " << highWater
+                  << ", exhausted " << exhaustionCount << " time(s)\n";
+    }
+};
+
+// Convert a symbol's MPV (quoted with 4 implied decimals) into raw price ticks
+uint32_t tickFromMPV(uint16_t mpv, uint8_t priceScaleCode) {
+    uint64_t tick = mpv;
+    for (uint8_t i = 4; i < priceScaleCode; ++i) {
+        tick *= 10;
+    }
+    for (uint8_t i = priceScaleCode; i < 4; ++i) {
+        tick /= 10;
+    }
+    return (tick == 0 || tick > UINT32_MAX) ? 1 : static_cast<uint32_t>(tick);
+}
+
+// Price Ladder Definition
+// One side of a book stored as a contiguous window of levels indexed by
+// (price - base) / tick. The best level always lives inside the window and is
+// tracked by a cursor; levels worse than the window are parked in an overflow
+// map and pulled back in when the window re-centers.
+class PriceLadder {
+private:
+    static constexpr size_t kInitialLevels = 256;
+    static constexpr size_t kMaxLevels = 16384;
+
+    bool descending;
+    uint32_t tick = 1;
+    uint32_t base = 0;
+    std::vector<PriceLevel> levels;
+    size_t activeLevels = 0;
+    int64_t bestIdx = -1;
+    int64_t worstIdx = -1;
+    std::map<uint32_t, PriceLevel> overflow;
+
+    bool inWindow(uint32_t price) const {
+        return price >= base && (price - base) % tick == 0 &&
+               (price - base) / tick < levels.size();
+    }
+    size_t indexOf(uint32_t price) const {
+        return (price - base) / tick;
+    }
+    uint32_t priceAt(size_t idx) const {
+        return base + static_cast<uint32_t>(idx) * tick;
+    }
+    bool isBetter(uint32_t a, uint32_t b) const {
+        return descending ? a > b : a < b;
+    }
+    uint32_t alignDown(uint64_t price) const {
+        return static_cast<uint32_t>(price - price % tick);
+    }
+
+    // Highest base for a window of `size` levels whose top price,
+    // base + (size - 1) * tick, still fits in a uint32
+    uint32_t maxBaseFor(size_t size) const {
+        uint64_t span = static_cast<uint64_t>(tick) * (size - 1);
+        return span <= UINT32_MAX ? alignDown(UINT32_MAX - span) : 0;
+    }
+    // Base for a window of `size` levels that puts `price` near the better
+    // end, leaving a quarter of the window as headroom for improving prices.
+    uint32_t baseFor(uint32_t price, size_t size) const {
+        uint64_t span = static_cast<uint64_t>(tick) * size;
+        uint64_t offset = descending ? span - span / 4 : span / 4;
+        return std::min(price > offset ? alignDown(price - offset) : 0, maxBaseFor(size));
+    }
+
+    void scanForBest(int64_t from) {
+        bestIdx = -1;
+        if (activeLevels == 0) {
+            return;
+        }
+        int64_t step = descending ? -1 : 1;
+        for (int64_t i = from; i >= 0 && i < static_cast<int64_t>(levels.size()); i += step) {
+            if (!levels[i].empty()) {
+                bestIdx = i;
+                return;
+            }
+        }
+    }
+
+    void scanForWorst(int64_t from) {
+        worstIdx = -1;
+        if (activeLevels == 0) {
+            return;
+        }
+        int64_t step = descending ? 1 : -1;
+        for (int64_t i = from; i >= 0 && i < static_cast<int64_t>(levels.size()); i += step) {
+            if (!levels[i].empty()) {
+                worstIdx = i;
+                return;
+            }
+        }
+    }
+
+    // Move the window to [newBase, newBase + newSize * tick), spilling active
+    // levels that fall outside into the overflow map and absorbing overflow
+    // levels that now fit. The window is pulled down if it would run past the
+    // top of the price range.
+    void relocate(uint32_t newBase, size_t newSize) {
+        newBase = std::min(newBase, maxBaseFor(newSize));
+        std::vector<PriceLevel> next(newSize);
+        uint64_t newEnd = newBase + static_cast<uint64_t>(newSize) * tick;
+
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (levels[i].empty()) {
+                continue;
+            }
+            uint32_t price = priceAt(i);
+            if (price >= newBase && price < newEnd) {
+                next[(price - newBase) / tick] = std::move(levels[i]);
+            } else {
+                overflow.emplace(price, std::move(levels[i]));
+            }
+        }
+
+        auto it = overflow.lower_bound(newBase);
+        while (it != overflow.end() && it->first < newEnd) {
+            if ((it->first - newBase) % tick != 0) {
+                ++it;
+                continue;
+            }
+            next[(it->first - newBase) / tick] = std::move(it->second);
+            it = overflow.erase(it);
+        }
+
+        levels.swap(next);
+        base = newBase;
+        activeLevels = 0;
+        for (const auto& level : levels) {
+            if (!level.empty()) {
+                activeLevels++;
+            }
+        }
+        scanForBest(descending ? static_cast<int64_t>(levels.size()) - 1 : 0);
+        scanForWorst(descending ? 0 : static_cast<int64_t>(levels.size()) - 1);
+    }
+
+    // Re-center the window on the best overflow level once the window empties
+    void refillFromOverflow() {
+        if (overflow.empty()) {
+            return;
+        }
+        uint32_t best = descending ? overflow.rbegin()->first : overflow.begin()->first;
+        relocate(baseFor(best, levels.size()), levels.size());
+    }
+
+public:
+    explicit PriceLadder(bool descending) : descending(descending) {}
+
+    bool empty() const {
+        return bestIdx < 0;
+    }
+    // Levels with orders, in the window and in overflow
+    size_t levelCount() const {
+        return activeLevels + overflow.size();
+    }
+    uint32_t bestPrice() const {
+        return priceAt(static_cast<size_t>(bestIdx));
+    }
+    // Worst resting price: the far end of the overflow map, else the window's
+    // worst cursor. Only valid when the ladder is not empty.
+    uint32_t worstPrice() const {
+        if (!overflow.empty()) {
+            return descending ? overflow.begin()->first : overflow.rbegin()->first;
+        }
+        return priceAt(static_cast<size_t>(worstIdx));
+    }
+
+    // Change the tick size, rebuilding the window around the current best
+    void setTick(uint32_t newTick) {
+        if (newTick == 0 || newTick == tick) {
+            return;
+        }
+        uint32_t best = empty() ? 0 : bestPrice();
+        for (size_t i = 0; i < levels.size(); ++i) {
+            if (!levels[i].empty()) {
+                overflow.emplace(priceAt(i), std::move(levels[i]));
+            }
+        }
+        size_t size = levels.empty() ? kInitialLevels : levels.size();
+        levels.clear();
+        activeLevels = 0;
+        bestIdx = -1;
+        worstIdx = -1;
+        tick = newTick;
+        base = alignDown(base);
+        if (!overflow.empty()) {
+            relocate(baseFor(best, size), size);
+        }
+    }
+
+    PriceLevel* find(uint32_t price) {
+        if (inWindow(price)) {
+            return &levels[indexOf(price)];
+        }
+        auto it = overflow.find(price);
+        return (it != overflow.end()) ? &it->second : nullptr;
+    }
+    const PriceLevel* find(uint32_t price) const {
+        return const_cast<PriceLadder*>(this)->find(price);
+    }
+
+    // Get the level for a price, creating it (and moving the window) if needed.
+    // The caller must add an order to the returned level before the next call.
+    PriceLevel& getOrCreate(uint32_t price) {
+        if (price % tick != 0) {
+            uint32_t a = tick, b = price;
+            while (b != 0) {
+                uint32_t r = a % b;
+                a = b;
+                b = r;
+            }
+            setTick(a);
+        }
+
+        if (levels.empty()) {
+            levels.resize(kInitialLevels);
+            base = baseFor(price, levels.size());
+        }
+
+        if (!inWindow(price)) {
+            if (empty() && overflow.empty()) {
+                base = baseFor(price, levels.size());
+            } else {
+                uint64_t lo = std::min<uint64_t>(base, price);
+                uint64_t top = base + static_cast<uint64_t>(levels.size() - 1) * tick;
+                uint64_t hi = std::max<uint64_t>(top, price);
+                size_t needed = static_cast<size_t>((hi - lo) / tick + 1);
+
+                if (needed <= kMaxLevels) {
+                    size_t size = levels.size();
+                    while (size < needed + needed / 4 && size < kMaxLevels) {
+                        size *= 2;
+                    }
+                    size = std::min(size, kMaxLevels);
+                    uint64_t slack = (static_cast<uint64_t>(size) - needed) * tick;
+                    uint64_t newBase = (price < base) ? (lo > slack ? lo - slack : 0) : lo;
+                    relocate(alignDown(newBase), size);
+                } else if (isBetter(price, bestPrice())) {
+                    relocate(baseFor(price, kMaxLevels), kMaxLevels);
+                } else {
+                    return overflow[price];
+                }
+            }
+        }
+
+        size_t idx = indexOf(price);
+        PriceLevel& level = levels[idx];
+        if (level.empty()) {
+            activeLevels++;
+            if (bestIdx < 0 || isBetter(price, bestPrice())) {
+                bestIdx = static_cast<int64_t>(idx);
+            }
+            if (worstIdx < 0 || isBetter(priceAt(static_cast<size_t>(worstIdx)), price)) {
+                worstIdx = static_cast<int64_t>(idx);
+            }
+        }
+        return level;
+    }
+
+    // Notify the ladder that the level at `price` has become empty
+    void release(uint32_t price) {
+        if (!inWindow(price)) {
+            overflow.erase(price);
+            return;
+        }
+        activeLevels--;
+        int64_t idx = static_cast<int64_t>(indexOf(price));
+        if (idx == worstIdx) {
+            scanForWorst(worstIdx);
+        }
+        if (idx == bestIdx) {
+            scanForBest(bestIdx);
+            if (bestIdx < 0) {
+                refillFromOverflow();
+            }
+        }
+    }
+
+    // Visit up to maxLevels non-empty levels from best to worst
+    template <typename Fn>
+    void forEachLevel(size_t maxLevels, Fn&& fn) const {
+        size_t visited = 0;
+        if (bestIdx >= 0) {
+            int64_t step = descending ? -1 : 1;
+            for (int64_t i = bestIdx; i >= 0 && i < static_cast<int64_t>(levels.size()) && visited < maxLevels; i += step) {
+                if (!levels[i].empty()) {
+                    fn(priceAt(static_cast<size_t>(i)), levels[i]);
+                    visited++;
+                }
+            }
+        }
+        if (descending) {
+            for (auto it = overflow.rbegin(); it != overflow.rend() && visited < maxLevels; ++it, ++visited) {
+                fn(it->first, it->second);
+            }
+        } else {
+            for (auto it = overflow.begin(); it != overflow.end() && visited < maxLevels; ++it, ++visited) {
+                fn(it->first, it->second);
+            }
+        }
+    }
+
+    void clear() {
+        levels.clear();
+        overflow.clear();
+        activeLevels = 0;
+        bestIdx = -1;
+        worstIdx = -1;
+    }
+};
+
+// Order Reference Definition
+// What the order index stores per order: the pooled node for books that keep
+// queue detail, or the order's side, price and size packed inline for
+// market-by-price books, which keep no nodes at all and refuse sizes past
+// kVolumeMask. All-zero bits mark an empty index slot; packed references
+// always carry the live bit.
+union OrderRef {
+    static constexpr uint64_t kLive = 1ull << 63;
+    static constexpr uint64_t kBid = 1ull << 62;
+    static constexpr uint32_t kVolumeMask = (1u << 30) - 1;
+
+    Order* node;
+    uint64_t bits = 0;
+
+    static OrderRef fromNode(Order* order) {
+        OrderRef ref;
+        ref.node = order;
+        return ref;
+    }
+    static OrderRef packed(char side, uint32_t price, uint32_t volume) {
+        OrderRef ref;
+        ref.bits = kLive | (side == 'B' ? kBid : 0) |
+                   (static_cast<uint64_t>(volume & kVolumeMask) << 32) | price;
+        return ref;
+    }
+    char side() const {
+        return (bits & kBid) ? 'B' : 'S';
+    }
+    uint32_t price() const {
+        return static_cast<uint32_t>(bits);
+    }
+    uint32_t volume() const {
+        return static_cast<uint32_t>(bits >> 32) & kVolumeMask;
+    }
+};
+
+// Order Index Definition
+// Open-addressing hash table from order ID to OrderRef. Linear probing with
+// backward-shift deletion keeps probe chains short without tombstones. The
+// table is sized up front so a full session runs without rehashing; if it
+// does pass the load limit it doubles and the rehash is counted.
+class OrderIndex {
+public:
+    static constexpr size_t kDefaultCapacity = 1024;
+
+private:
+    struct Slot {
+        uint64_t orderID;
+        OrderRef ref;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    unsigned shift = 64;
+    size_t count = 0;
+    size_t peakCount = 0;
+    size_t initialCapacity;
+    size_t rehashCount = 0;
+
+    size_t home(uint64_t orderID) const {
+        return static_cast<size_t>((orderID * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+    void allocate(size_t capacity) {
+        size_t size = 16;
+        unsigned bits = 4;
+        while (size < capacity + capacity / 2) {
+            size *= 2;
+            bits++;
+        }
+        slots.assign(size, Slot{0, OrderRef()});
+        mask = size - 1;
+        shift = 64 - bits;
+    }
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        allocate(old.size());
+        rehashCount++;
+        for (const Slot& slot : old) {
+            if (slot.ref.bits != 0) {
+                size_t i = home(slot.orderID);
+                while (slots[i].ref.bits != 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+
+public:
+    // A capacity of zero defers allocation until the first insert
+    explicit OrderIndex(size_t capacity = kDefaultCapacity) : initialCapacity(capacity) {
+        if (capacity > 0) {
+            allocate(capacity);
+        }
+    }
+
+    // The returned reference stays valid until the next insert or erase
+    OrderRef* find(uint64_t orderID) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        for (size_t i = home(orderID); slots[i].ref.bits != 0; i = (i + 1) & mask) {
+            if (slots[i].orderID == orderID) {
+                return &slots[i].ref;
+            }
+        }
+        return nullptr;
+    }
+    void insert(uint64_t orderID, OrderRef ref) {
+        if (slots.empty()) {
+            allocate(initialCapacity > 0 ? initialCapacity : kDefaultCapacity);
+        } else if ((count + 1) * 4 > slots.size() * 3) {
+            grow();
+        }
+        size_t i = home(orderID);
+        while (slots[i].ref.bits != 0) {
+            if (slots[i].orderID == orderID) {
+                slots[i].ref = ref;
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+        slots[i] = Slot{orderID, ref};
+        if (++count > peakCount) {
+            peakCount = count;
+        }
+    }
+    bool erase(uint64_t orderID) {
+        if (slots.empty()) {
+            return false;
+        }
+        size_t i = home(orderID);
+        while (slots[i].orderID != orderID || slots[i].ref.bits == 0) {
+            if (slots[i].ref.bits == 0) {
+                return false;
+            }
+            i = (i + 1) & mask;
+        }
+
+        // Pull later entries of the probe chain back into the hole
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (slots[j].ref.bits == 0) {
+                break;
+            }
+            size_t k = home(slots[j].orderID);
+            bool between = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!between) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = Slot{0, OrderRef()};
+        count--;
+        return true;
+    }
+    void clear() {
+        std::fill(slots.begin(), slots.end(), Slot{0, OrderRef()});
+        count = 0;
+    }
+    // Visit every entry as fn(orderID, ref), in table order
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Slot& slot : slots) {
+            if (slot.ref.bits != 0) {
+                fn(slot.orderID, slot.ref);
+            }
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+    size_t capacity() const {
+        return slots.size();
+    }
+    size_t peak() const {
+        return peakCount;
+    }
+    size_t rehashes() const {
+        return rehashCount;
+    }
+};
+
+// Number of price levels per side that are visible to consumers
+constexpr uint8_t kDepthLevels = 10;
+static_assert(kTobDepth == kDepthLevels, "the shared-memory top of book holds the visible levels");
+
+// Visible Depth Definition
+// Prices of the visible levels on one side as of the last update
+struct VisibleDepth {
+    std::array<uint32_t, kDepthLevels> prices{};
+    uint8_t count = 0;
+};
+
+// Depth Update Definition
+// Bit i of a side's mask is set when visible level i changed. Once a message
+// adds or removes a visible level, the side's prices from before are kept
+// so positions are flagged by where prices ended up, not by each step.
+struct DepthUpdate {
+    struct SideBefore {
+        bool taken = false;
+        uint8_t count;
+        uint16_t touched;
+        std::array<uint32_t, kDepthLevels> prices;
+    };
+
+    uint16_t bidLevels = 0;
+    uint16_t askLevels = 0;
+    SideBefore bidBefore;
+    SideBefore askBefore;
+
+    bool changed() const {
+        return (bidLevels | askLevels) != 0;
+    }
+};
+
+class OrderBook;
+
+// Symbol Hot State Definition
+// Everything an order message touches for its symbol, kept in one cache line
+struct alignas(64) SymbolHot {
+    OrderBook* book = nullptr;
+    double priceDivisor = 1.0;
+    bar_t bar = {};
+    uint8_t priceScaleCode = 0;
+    bool hasBar = false;
+    // Visible levels changed since the last publication, with conflation
+    uint16_t pendingBidLevels = 0;
+    uint16_t pendingAskLevels = 0;
+    uint32_t pendingSourceTimeNS = 0;
+    uint32_t pendingSymbolSeqNum = 0;
+};
+static_assert(sizeof(SymbolHot) == 64, "SymbolHot must fit in one cache line");
+
+class OrderBook {
+private:
+    OrderPool* pool;
+    OrderIndex localIndex;
+    OrderIndex* orderIndex;
+    bool marketByPrice = false;
+    PriceLadder bids{true};
+    PriceLadder asks{false};
+    VisibleDepth bidDepth;
+    VisibleDepth askDepth;
+
+    // Record an update at `price` on one side, working out from the price
+    // alone which visible positions it moved. Updates worse than the last
+    // visible level are rejected with a single comparison, a change at a
+    // visible price flags just that position, and a new level is slotted in
+    // by price. Only a visible level emptying out of a full side re-reads the
+    // ladder, for the level that moves up into view.
+    void touchDepth(char side, uint32_t price, DepthUpdate& update) {
+        bool isBid = (side == 'B');
+        auto& depth = isBid ? bidDepth : askDepth;
+        uint16_t& mask = isBid ? update.bidLevels : update.askLevels;
+        auto& before = isBid ? update.bidBefore : update.askBefore;
+
+        if (depth.count == kDepthLevels) {
+            uint32_t boundary = depth.prices[kDepthLevels - 1];
+            if (isBid ? price < boundary : price > boundary) {
+                return;
+            }
+        }
+
+        // First visible position whose price is not better than `price`
+        uint8_t position = 0;
+        while (position < depth.count &&
+               (isBid ? depth.prices[position] > price : depth.prices[position] < price)) {
+            position++;
+        }
+        const PriceLevel* level = (isBid ? bids : asks).find(price);
+        bool resting = level != nullptr && !level->empty();
+        bool visible = position < depth.count && depth.prices[position] == price;
+        if (visible == resting) {
+            if (visible) {
+                mask |= static_cast<uint16_t>(1u << position);
+                if (before.taken) {
+                    before.touched |= static_cast<uint16_t>(1u << position);
+                }
+            }
+            return;
+        }
+
+        if (!before.taken) {
+            before.taken = true;
+            before.count = depth.count;
+            before.touched = mask;
+            before.prices = depth.prices;
+        }
+        if (resting) {
+            // A new level, pushing the ones behind it back
+            uint8_t last = std::min<uint8_t>(depth.count, kDepthLevels - 1);
+            for (uint8_t i = last; i > position; --i) {
+                depth.prices[i] = depth.prices[i - 1];
+            }
+            depth.prices[position] = price;
+            depth.count = std::min<uint8_t>(depth.count + 1, kDepthLevels);
+            before.touched |= static_cast<uint16_t>(1u << position);
+        } else if (depth.count < kDepthLevels) {
+            // Every level was visible, so the ones behind simply move up
+            for (uint8_t i = position; i + 1 < depth.count; ++i) {
+                depth.prices[i] = depth.prices[i + 1];
+            }
+            depth.count--;
+        } else {
+            depth.count = 0;
+            (isBid ? bids : asks).forEachLevel(kDepthLevels, [&](uint32_t levelPrice, const PriceLevel&) {
+                depth.prices[depth.count++] = levelPrice;
+            });
+        }
+
+        uint16_t moved = 0;
+        for (uint8_t i = 0; i < std::max(before.count, depth.count); ++i) {
+            if (i >= before.count || i >= depth.count || before.prices[i] != depth.prices[i]) {
+                moved |= static_cast<uint16_t>(1u << i);
+            }
+        }
+        mask = before.touched | moved;
+    }
+    // Print the visible levels of one side, marking the ones that changed
+    void printDepth(const PriceLadder& book, const VisibleDepth& depth,
+                    uint16_t changedLevels, double priceDivisor) const {
+        for (uint8_t i = 0; i < depth.count; ++i) {
+            uint32_t price = depth.prices[i];
+            const PriceLevel* level = book.find(price);
+            logEvent(LogLevel::Info, LogEvent::DepthLevel, price, doubleBits(priceDivisor),
+                     level->totalVolume, level->orderCount);
+            for (const Order* order = level->head; order != nullptr; order = order->next) {
+                const Order* second = order->next;
+                logEvent(LogLevel::Info, LogEvent::DepthOrders, order->orderID, order->volume,
+                         second ? second->orderID : 0, second ? second->volume : 0);
+                if (second == nullptr) {
+                    break;
+                }
+                order = second;
+            }
+            logEvent(LogLevel::Info, LogEvent::DepthLevelEnd, (changedLevels >> i) & 1u);
+        }
+    }
+    // Extend the bar's high and low with a bid resting at `price`
+    static void extendBar(bar_t& bar, uint32_t price) {
+        if (price > bar.high) {
+            bar.high = price;
+        }
+        if (price < bar.low) {
+            bar.low = price;
+        }
+    }
+    // Re-read the bar's high and low from the bid ladder after an extreme
+    // was removed: both ends of the ladder are tracked, so this is O(1)
+    void recalculateBar(bar_t& bar) const {
+        if (bids.empty()) {
+            bar.high = 0;
+            bar.low = UINT32_MAX;
+            return;
+        }
+        bar.high = bids.bestPrice();
+        bar.low = bids.worstPrice();
+    }
+
+    // Market-by-price books pack each order's size into 30 bits, so larger
+    // orders are refused rather than stored truncated
+    bool volumeFits(uint64_t orderID, uint32_t volume) const {
+        if (marketByPrice && volume > OrderRef::kVolumeMask) {
+            logEvent(LogLevel::Error, LogEvent::VolumeTooLarge, orderID, volume);
+            return false;
+        }
+        return true;
+    }
+
+    // Side, price and size of an order regardless of how it is stored
+    struct OrderState {
+        char side;
+        uint32_t price;
+        uint32_t volume;
+    };
+    OrderState stateOf(OrderRef ref) const {
+        if (marketByPrice) {
+            return {ref.side(), ref.price(), ref.volume()};
+        }
+        return {ref.node->side, ref.node->price, ref.node->volume};
+    }
+
+    // Rest a new order at the back of its price level
+    void insertOrder(uint64_t orderID, char side, uint32_t price, uint32_t volume, const char* firmID) {
+        auto& level = ((side == 'B') ? bids : asks).getOrCreate(price);
+        if (marketByPrice) {
+            level.addAggregate(volume);
+            orderIndex->insert(orderID, OrderRef::packed(side, price, volume));
+            return;
+        }
+
+        Order* order = pool->acquire();
+        order->orderID = orderID;
+        order->price = price;
+        order->volume = volume;
+        order->side = side;
+        std::memset(order->firmID, 0, sizeof(order->firmID));
+        std::memcpy(order->firmID, firmID, strnlen(firmID, sizeof(order->firmID)));
+
+        level.pushBack(order);
+        orderIndex->insert(orderID, OrderRef::fromNode(order));
+    }
+    // Take an order off its price level, dropping the level once empty
+    void detachOrder(OrderRef ref) {
+        OrderState state = stateOf(ref);
+        auto& bookSide = (state.side == 'B') ? bids : asks;
+        PriceLevel* level = bookSide.find(state.price);
+        if (level == nullptr) {
+            logEvent(LogLevel::Error, LogEvent::LevelNotFound, state.price);
+            return;
+        }
+        if (marketByPrice) {
+            level->removeAggregate(state.volume);
+        } else {
+            level->unlink(ref.node);
+        }
+        if (level->empty()) {
+            bookSide.release(state.price);
+        }
+    }
+    // Remove an order from the book and the index
+    void eraseOrder(uint64_t orderID, OrderRef ref) {
+        detachOrder(ref);
+        if (!marketByPrice) {
+            pool->release(ref.node);
+        }
+        orderIndex->erase(orderID);
+    }
+    // Change an order's size in place, keeping its queue position
+    void resizeOrder(OrderRef& ref, uint32_t volume) {
+        OrderState state = stateOf(ref);
+        PriceLevel* level = ((state.side == 'B') ? bids : asks).find(state.price);
+        if (level != nullptr) {
+            level->totalVolume = level->totalVolume - state.volume + volume;
+        }
+        if (marketByPrice) {
+            ref = OrderRef::packed(state.side, state.price, volume);
+        } else {
+            ref.node->volume = volume;
+        }
+    }
+    // Move an order to the back of the queue at a new price and side
+    void requeueOrder(OrderRef& ref, char side, uint32_t price, uint32_t volume) {
+        detachOrder(ref);
+        auto& level = ((side == 'B') ? bids : asks).getOrCreate(price);
+        if (marketByPrice) {
+            level.addAggregate(volume);
+            ref = OrderRef::packed(side, price, volume);
+            return;
+        }
+        ref.node->price = price;
+        ref.node->volume = volume;
+        ref.node->side = side;
+        level.pushBack(ref.node);
+    }
+
+    // Return every resting order to the pool and drop it from the index.
+    // Market-by-price books always own their index, so they just clear it.
+    void releaseOrders() {
+        if (marketByPrice) {
+            orderIndex->clear();
+            return;
+        }
+        for (PriceLadder* bookSide : {&bids, &asks}) {
+            bookSide->forEachLevel(SIZE_MAX, [&](uint32_t, const PriceLevel& level) {
+                Order* order = level.head;
+                while (order != nullptr) {
+                    Order* next = order->next;
+                    orderIndex->erase(order->orderID);
+                    pool->release(order);
+                    order = next;
+                }
+            });
+        }
+    }
+
+public:
+    // Orders are looked up in sharedIndex when given, otherwise in an index
+    // owned by this book with room for indexCapacity orders
+    explicit OrderBook(OrderPool* pool, OrderIndex* sharedIndex = nullptr,
+                       size_t indexCapacity = OrderIndex::kDefaultCapacity)
+        : pool(pool), localIndex(sharedIndex ? 0 : indexCapacity),
+          orderIndex(sharedIndex ? sharedIndex : &localIndex) {}
+    OrderBook(const OrderBook&) = delete;
+    OrderBook& operator=(const OrderBook&) = delete;
+    ~OrderBook() {
+        releaseOrders();
+    }
+    const OrderIndex& index() const {
+        return *orderIndex;
+    }
+    size_t priceLevels() const {
+        return bids.levelCount() + asks.levelCount();
+    }
+    bool isMarketByPrice() const {
+        return marketByPrice;
+    }
+
+    // Visit every resting order as fn(orderID, side, price, volume, firmID),
+    // bids then asks, best level first and in queue order within a level.
+    // Market-by-price books keep no queues; theirs come sorted by side,
+    // price and order ID so the order does not depend on the index layout.
+    template <typename Fn>
+    void forEachOrder(Fn&& fn) const {
+        if (marketByPrice) {
+            static const char noFirm[sizeof(Order::firmID)] = {};
+            std::vector<std::pair<uint64_t, OrderRef>> orders;
+            orderIndex->forEach([&](uint64_t orderID, OrderRef ref) {
+                orders.emplace_back(orderID, ref);
+            });
+            std::sort(orders.begin(), orders.end(), [](const auto& a, const auto& b) {
+                return std::make_tuple(a.second.side(), a.second.price(), a.first) <
+                       std::make_tuple(b.second.side(), b.second.price(), b.first);
+            });
+            for (const auto& [orderID, ref] : orders) {
+                fn(orderID, ref.side(), ref.price(), ref.volume(), noFirm);
+            }
+            return;
+        }
+        for (const PriceLadder* bookSide : {&bids, &asks}) {
+            bookSide->forEachLevel(SIZE_MAX, [&](uint32_t, const PriceLevel& level) {
+                for (const Order* order = level.head; order != nullptr; order = order->next) {
+                    fn(order->orderID, order->side, order->price, order->volume, order->firmID);
+                }
+            });
+        }
+    }
+    // Rest an order read back from a checkpoint: no bar update, nothing
+    // logged, and the visible depth is left for rebuildDepth
+    void restoreOrder(uint64_t orderID, char side, uint32_t price, uint32_t volume, const char* firmID) {
+        insertOrder(orderID, side, price, volume, firmID);
+    }
+    // Re-read the visible levels of both sides from the ladders
+    void rebuildDepth() {
+        for (bool isBid : {true, false}) {
+            auto& depth = isBid ? bidDepth : askDepth;
+            depth.count = 0;
+            (isBid ? bids : asks).forEachLevel(kDepthLevels, [&](uint32_t levelPrice, const PriceLevel&) {
+                depth.prices[depth.count++] = levelPrice;
+            });
+        }
+    }
+
+    // Switch between full depth and market-by-price. Only possible while the
+    // book is empty; market-by-price books always use their own index.
+    bool setMarketByPrice(bool enabled) {
+        if (enabled == marketByPrice) {
+            return true;
+        }
+        if (!bids.empty() || !asks.empty()) {
+            logEvent(LogLevel::Warning, LogEvent::BookModeLocked);
+            return false;
+        }
+        marketByPrice = enabled;
+        if (enabled) {
+            orderIndex = &localIndex;
+        }
+        return true;
+    }
+    void setTickSize(uint32_t tick) {
+        bids.setTick(tick);
+        asks.setTick(tick);
+    }
+    // Empty the book; returns the visible levels that went away
+    DepthUpdate clearOrders() {
+        DepthUpdate cleared = visibleLevels();
+        releaseOrders();
+        bids.clear();
+        asks.clear();
+        bidDepth.count = 0;
+        askDepth.count = 0;
+        logEvent(LogLevel::Info, LogEvent::BookCleared);
+        return cleared;
+    }
+    void addOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
+                  uint64_t orderID, uint32_t price, uint32_t volume, char side, 
+                  const char* firmID, DepthUpdate& update,
+                  SymbolHot& symbol) {
+        if (!volumeFits(orderID, volume)) {
+            return;
+        }
+        insertOrder(orderID, side, price, volume, firmID);
+        touchDepth(side, price, update);
+
+        if (side == 'B' && symbol.hasBar) {
+            auto& bar = symbol.bar;
+            extendBar(bar, price);
+            bar.volume += volume;
+            bar.update_count++;
+        }
+
+        logEvent(LogLevel::Info, LogEvent::OrderAdded, orderID);
+    }
+    void modifyOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
+                     uint64_t orderID, uint32_t price, uint32_t volume,
+                     uint8_t positionChange, char side, DepthUpdate& update,
+                     SymbolHot& symbol) {
+        OrderRef* ref = orderIndex->find(orderID);
+        
+        if (ref != nullptr) {
+            if (!volumeFits(orderID, volume)) {
+                return;
+            }
+            OrderState old = stateOf(*ref);
+
+            logEvent(LogLevel::Info, LogEvent::OrderModifying, orderID);
+
+            bool wasBid = (old.side == 'B');
+            bool isBid = (side == 'B');
+
+            bool recalculate = false;
+            if (wasBid && symbol.hasBar) {
+                auto& bar = symbol.bar;
+                recalculate = (old.price == bar.high || old.price == bar.low);
+                bar.volume -= old.volume;
+                bar.update_count++;
+            }
+
+            if (old.price != price || old.side != side || positionChange != 0) {
+                requeueOrder(*ref, side, price, volume);
+                touchDepth(old.side, old.price, update);
+            } else {
+                resizeOrder(*ref, volume);
+            }
+            touchDepth(side, price, update);
+
+            if (symbol.hasBar) {
+                auto& bar = symbol.bar;
+                if (recalculate) {
+                    recalculateBar(bar);
+                }
+                if (isBid) {
+                    extendBar(bar, price);
+                    bar.volume += volume;
+                    bar.update_count++;
+                }
+            }
+
+            logEvent(LogLevel::Info, LogEvent::OrderModified, orderID);
+        } else {
+            logEvent(LogLevel::Warning, LogEvent::OrderNotFound, orderID, 0);
+        }
+    }
+    void orderExecution(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
+                    uint64_t orderID, uint64_t tradeID, uint32_t price, uint32_t volume,
+                    uint8_t printableFlag, char tradeCond1, char tradeCond2, 
+                    char tradeCond3, char tradeCond4, DepthUpdate& update) {
+        OrderRef* ref = orderIndex->find(orderID);
+
+        if (ref != nullptr) {
+            OrderState state = stateOf(*ref);
+
+            logEvent(LogLevel::Info, LogEvent::OrderExecuting, orderID);
+
+            if (state.volume < volume) {
+                logEvent(LogLevel::Error, LogEvent::ExecutionTooLarge, orderID);
+                return;
+            }
+
+            if (state.volume == volume) {
+                eraseOrder(orderID, *ref);
+            } else {
+                resizeOrder(*ref, state.volume - volume);
+            }
+            touchDepth(state.side, state.price, update);
+
+            if (marketData.enabled()) {
+                MdTrade trade{};
+                trade.tradeID = tradeID;
+                trade.orderID = orderID;
+                trade.symbolIndex = symbolIndex;
+                trade.sourceTimeNS = sourceTimeNS;
+                trade.symbolSeqNum = symbolSeqNum;
+                trade.price = price;
+                trade.volume = volume;
+                trade.tradeType = 'E';
+                trade.side = state.side;
+                trade.printableFlag = printableFlag;
+                trade.tradeConditions[0] = tradeCond1;
+                trade.tradeConditions[1] = tradeCond2;
+                trade.tradeConditions[2] = tradeCond3;
+                trade.tradeConditions[3] = tradeCond4;
+                marketData.publish(trade);
+            }
+
+            logEvent(LogLevel::Info, LogEvent::OrderExecuted, orderID, price, volume);
+        } else {
+            logEvent(LogLevel::Warning, LogEvent::OrderNotFound, orderID, 1);
+        }
+    }
+    void replaceOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
                   uint64_t oldOrderID, uint64_t newOrderID, uint32_t price, 
-                  uint32_t volume, char side, 
-                  const std::unordered_map<uint32_t, std::string>& symbolMappings) {
-    bool symbolChanged = (symbolIndex != currentSymbolIndex);
+                  uint32_t volume, char side, DepthUpdate& update,
+                  SymbolHot& symbol) {
+        deleteOrder(sourceTimeNS, symbolIndex, symbolSeqNum, oldOrderID, update, symbol);
+
+        addOrder(sourceTimeNS, symbolIndex, symbolSeqNum, newOrderID, price, volume, side, "", update, symbol);
+    }
+    void deleteOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
+                     uint64_t orderID, DepthUpdate& update,
+                     SymbolHot& symbol) {
+        OrderRef* ref = orderIndex->find(orderID);
+        
+        if (ref != nullptr) {
+            OrderState state = stateOf(*ref);
+
+            bool recalculate = false;
+            if (state.side == 'B' && symbol.hasBar) {
+                auto& bar = symbol.bar;
+                bar.volume -= state.volume;
+                recalculate = (state.price == bar.high || state.price == bar.low);
+            }
+
+            eraseOrder(orderID, *ref);
+            touchDepth(state.side, state.price, update);
+
+            if (recalculate) {
+                recalculateBar(symbol.bar);
+            }
+
+            logEvent(LogLevel::Info, LogEvent::OrderDeleted, orderID);
+        } else {
+            logEvent(LogLevel::Warning, LogEvent::OrderNotFound, orderID, 2);
+        }
+    }
+    void printOrderBook(uint32_t symbolIndex, const std::string& symbolName, double priceDivisor,
+                        const DepthUpdate& update = DepthUpdate()) const {
+        if (!logger.enabled(LogLevel::Info)) {
+            return;
+        }
+        logger.beginGroup();
+        logSymbolEvent(LogLevel::Info, LogEvent::BookHeader, symbolIndex, symbolName);
+
+        logEvent(LogLevel::Info, LogEvent::BookSide, 0);
+        printDepth(bids, bidDepth, update.bidLevels, priceDivisor);
+        logEvent(LogLevel::Info, LogEvent::BookSideEnd);
+
+        logEvent(LogLevel::Info, LogEvent::BookSide, 1);
+        printDepth(asks, askDepth, update.askLevels, priceDivisor);
+        logEvent(LogLevel::Info, LogEvent::BookSideEnd);
+        logger.endGroup();
+    }
+
+    // Every visible level of both sides, flagged as changed
+    DepthUpdate visibleLevels() const {
+        DepthUpdate all;
+        all.bidLevels = static_cast<uint16_t>((1u << bidDepth.count) - 1);
+        all.askLevels = static_cast<uint16_t>((1u << askDepth.count) - 1);
+        return all;
+    }
+    // Publish the levels flagged in `update` as level deltas, then the top
+    // of book if either inside level was among them
+    void publishUpdate(uint32_t symbolIndex, uint32_t sourceTimeNS, uint32_t symbolSeqNum,
+                       const DepthUpdate& update) const {
+        for (bool isBid : {true, false}) {
+            const auto& ladder = isBid ? bids : asks;
+            const auto& depth = isBid ? bidDepth : askDepth;
+            uint16_t mask = isBid ? update.bidLevels : update.askLevels;
+            for (uint8_t i = 0; i < kDepthLevels; ++i) {
+                if (((mask >> i) & 1u) == 0) {
+                    continue;
+                }
+                MdLevelDelta delta{};
+                delta.symbolIndex = symbolIndex;
+                delta.sourceTimeNS = sourceTimeNS;
+                delta.symbolSeqNum = symbolSeqNum;
+                delta.side = isBid ? 'B' : 'S';
+                delta.level = i;
+                if (i < depth.count) {
+                    const PriceLevel* level = ladder.find(depth.prices[i]);
+                    delta.price = depth.prices[i];
+                    delta.volume = level->totalVolume;
+                    delta.orderCount = level->orderCount;
+                    delta.action = MdLevelDelta::kLevelSet;
+                } else {
+                    delta.action = MdLevelDelta::kLevelCleared;
+                }
+                marketData.publish(delta);
+            }
+        }
+        if (((update.bidLevels | update.askLevels) & 1u) == 0) {
+            return;
+        }
+        MdBbo bbo{};
+        bbo.symbolIndex = symbolIndex;
+        bbo.sourceTimeNS = sourceTimeNS;
+        bbo.symbolSeqNum = symbolSeqNum;
+        if (bidDepth.count > 0) {
+            const PriceLevel* level = bids.find(bidDepth.prices[0]);
+            bbo.bidPrice = bidDepth.prices[0];
+            bbo.bidVolume = level->totalVolume;
+            bbo.bidOrders = level->orderCount;
+        }
+        if (askDepth.count > 0) {
+            const PriceLevel* level = asks.find(askDepth.prices[0]);
+            bbo.askPrice = askDepth.prices[0];
+            bbo.askVolume = level->totalVolume;
+            bbo.askOrders = level->orderCount;
+        }
+        marketData.publish(bbo);
+    }
+    // Copy the visible levels into a shared-memory top of book
+    void fillTopOfBook(TobBook& book) const {
+        book.bidCount = bidDepth.count;
+        book.askCount = askDepth.count;
+        for (uint8_t i = 0; i < bidDepth.count; ++i) {
+            const PriceLevel* level = bids.find(bidDepth.prices[i]);
+            book.bids[i] = {level->totalVolume, bidDepth.prices[i], level->orderCount};
+        }
+        for (uint8_t i = 0; i < askDepth.count; ++i) {
+            const PriceLevel* level = asks.find(askDepth.prices[i]);
+            book.asks[i] = {level->totalVolume, askDepth.prices[i], level->orderCount};
+        }
+    }
+};
+
+// Symbol Reference Definition
+// Reference data from the symbol mapping, only read off the hot path
+struct SymbolRef {
+    std::string name = "Unknown";
+    bool mapped = false;
+    SymbolIndexMappingMessage mapping = {};
+};
+
+// Symbol Table Definition
+// Per-symbol state in flat vectors indexed directly by symbolIndex, which XDP
+// assigns densely from zero. Hot state and reference data live apart so the
+// order path only pulls in one cache line per message.
+class SymbolTable {
+private:
+    static constexpr size_t kInitialSymbols = 16384;
+    static constexpr size_t kMaxSymbols = 1 << 24;
+
+    std::vector<SymbolHot> hotState;
+    std::vector<SymbolRef> refData;
+    std::vector<std::unique_ptr<OrderBook>> books;
+    OrderPool* pool;
+    OrderIndex* sharedIndex = nullptr;
+    size_t indexCapacity = OrderIndex::kDefaultCapacity;
+    bool allMarketByPrice = false;
+    std::vector<std::string> marketByPriceSymbols;
+
+    void grow(uint32_t symbolIndex) {
+        size_t size = hotState.size();
+        while (size <= symbolIndex) {
+            size *= 2;
+        }
+        hotState.resize(size);
+        refData.resize(size);
+        books.resize(size);
+    }
+
+public:
+    explicit SymbolTable(OrderPool* pool) : pool(pool) {
+        hotState.resize(kInitialSymbols);
+        refData.resize(kInitialSymbols);
+        books.resize(kInitialSymbols);
+    }
+
+    // Order index used by books created from now on: either one index shared
+    // by every symbol, or one per book sized for `capacity` orders
+    void configureOrderIndex(OrderIndex* shared, size_t capacity) {
+        sharedIndex = shared;
+        indexCapacity = capacity;
+    }
+    // Keep only per-price aggregates, for every symbol or just the listed ones
+    void configureMarketByPrice(bool all, std::vector<std::string> symbols) {
+        allMarketByPrice = all;
+        marketByPriceSymbols = std::move(symbols);
+    }
+    bool isMarketByPrice(const std::string& symbolName) const {
+        return allMarketByPrice ||
+               std::find(marketByPriceSymbols.begin(), marketByPriceSymbols.end(), symbolName) !=
+                   marketByPriceSymbols.end();
+    }
+
+    // Hot state for a symbol, creating its order book on first use
+    SymbolHot* symbolState(uint32_t symbolIndex) {
+        if (symbolIndex >= hotState.size()) {
+            if (symbolIndex >= kMaxSymbols) {
+                logSymbolEvent(LogLevel::Error, LogEvent::SymbolOutOfRange, symbolIndex, std::string());
+                return nullptr;
+            }
+            grow(symbolIndex);
+        }
+        SymbolHot& symbol = hotState[symbolIndex];
+        if (symbol.book == nullptr) {
+            books[symbolIndex] = std::make_unique<OrderBook>(pool, sharedIndex, indexCapacity);
+            symbol.book = books[symbolIndex].get();
+            if (allMarketByPrice) {
+                symbol.book->setMarketByPrice(true);
+            }
+        }
+        return &symbol;
+    }
+    // Hot state for a symbol that has already been seen, or nullptr
+    SymbolHot* find(uint32_t symbolIndex) {
+        if (symbolIndex >= hotState.size() || hotState[symbolIndex].book == nullptr) {
+            return nullptr;
+        }
+        return &hotState[symbolIndex];
+    }
+    SymbolRef& ref(uint32_t symbolIndex) {
+        if (symbolIndex >= refData.size()) {
+            grow(symbolIndex);
+        }
+        return refData[symbolIndex];
+    }
+    const std::string& name(uint32_t symbolIndex) const {
+        static const std::string unknown = "Unknown";
+        return (symbolIndex < refData.size()) ? refData[symbolIndex].name : unknown;
+    }
+    size_t size() const {
+        return hotState.size();
+    }
+    const SymbolHot& operator[](uint32_t symbolIndex) const {
+        return hotState[symbolIndex];
+    }
+
+    void printOrderIndexStats() const {
+        if (sharedIndex != nullptr && !allMarketByPrice) {
+            std::cout << "Order index (shared): capacity " << sharedIndex->capacity()
+                      << ", peak " << sharedIndex->peak()
+                      << ", rehashed " << sharedIndex->rehashes() << " time(s)\n";
+            return;
+        }
+        size_t bookCount = 0, capacity = 0, rehashes = 0;
+        for (const auto& book : books) {
+            if (book != nullptr) {
+                bookCount++;
+                capacity += book->index().capacity();
+                rehashes += book->index().rehashes();
+            }
+        }
+        std::cout << "Order index: " << bookCount << " book(s), total capacity " << capacity
+                  << ", rehashed " << rehashes << " time(s)\n";
+    }
+};
+
+// Conflation Policy Definition
+// When book changes are printed and published: after every message, or
+// coalesced per symbol until the end of each packet, every N messages a
+// shard handles, or each interval of source time
+struct ConflationPolicy {
+    enum class Mode : uint8_t { Off, Packet, Messages, Interval };
+    static constexpr uint32_t kMaxIntervalNS = 1000000000;
+
+    Mode mode = Mode::Off;
+    uint64_t messages = 0;
+    uint32_t intervalNS = 0;
+
+    // Parse `packet`, `messages=N` or `interval=NS`
+    static bool parse(const std::string& spec, ConflationPolicy& policy) {
+        size_t equals = spec.find('=');
+        std::string key = spec.substr(0, equals);
+        uint64_t value = (equals == std::string::npos) ? 0 : std::strtoull(spec.c_str() + equals + 1, nullptr, 10);
+        if (spec == "packet") {
+            policy.mode = Mode::Packet;
+        } else if (key == "messages" && value > 0) {
+            policy.mode = Mode::Messages;
+            policy.messages = value;
+        } else if (key == "interval" && value > 0 && value <= kMaxIntervalNS) {
+            policy.mode = Mode::Interval;
+            policy.intervalNS = static_cast<uint32_t>(value);
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Conflation State Definition
+// A shard's symbols with unpublished changes, each listed once; the changed
+// levels themselves accumulate in the symbols' hot state. Publishing the
+// union of the masks against the final book gives consumers the same end
+// state as publishing every update.
+struct ConflationState {
+    ConflationPolicy policy;
+    std::vector<uint32_t> dirtySymbols;
+    uint64_t messagesSinceFlush = 0;
+    uint32_t lastSourceTimeNS = 0;
+    uint64_t updates = 0;
+    uint64_t publications = 0;
+
+    bool enabled() const {
+        return policy.mode != ConflationPolicy::Mode::Off;
+    }
+    void markDirty(uint32_t symbolIndex, SymbolHot& symbol, uint32_t sourceTimeNS, uint32_t symbolSeqNum,
+                   const DepthUpdate& update) {
+        if ((symbol.pendingBidLevels | symbol.pendingAskLevels) == 0) {
+            dirtySymbols.push_back(symbolIndex);
+        }
+        symbol.pendingBidLevels |= update.bidLevels;
+        symbol.pendingAskLevels |= update.askLevels;
+        symbol.pendingSourceTimeNS = sourceTimeNS;
+        symbol.pendingSymbolSeqNum = symbolSeqNum;
+        updates++;
+    }
+    // True when the message about to be applied, stamped `sourceTimeNS`,
+    // starts a new interval. Source time is the nanosecond part of the
+    // feed's timestamps, so going backwards means a new second.
+    bool startsInterval(uint32_t sourceTimeNS) {
+        bool crossed = sourceTimeNS < lastSourceTimeNS ||
+                       sourceTimeNS / policy.intervalNS != lastSourceTimeNS / policy.intervalNS;
+        lastSourceTimeNS = sourceTimeNS;
+        return crossed;
+    }
+    // Count a handled message; true when the Nth since the last flush
+    bool countMessage() {
+        return ++messagesSinceFlush >= policy.messages;
+    }
+};
+
+// Source Clock Definition
+// Full source time, in nanoseconds since the epoch, of the messages a shard
+// sees. Most messages carry only the nanoseconds within the second; the
+// second comes from Source Time Reference and the other messages that carry
+// it, or, on feeds without them, from the nanoseconds wrapping around.
+struct SourceClock {
+    static constexpr uint32_t kWrapNS = 500000000;
+
+    uint64_t seconds = 0;
+    uint32_t lastNS = 0;
+
+    uint64_t update(const SourceTimeStamp& stamp) {
+        if (stamp.hasSeconds) {
+            seconds = stamp.seconds;
+        } else if (stamp.nanoseconds + kWrapNS < lastNS) {
+            seconds++;
+        }
+        lastNS = stamp.nanoseconds;
+        return seconds * 1000000000ull + stamp.nanoseconds;
+    }
+};
+
+// Bar Engine Definition
+// Open/high/low/close/volume/VWAP bars over printable trades, for several
+// intervals at once and aligned to multiples of each interval in source
+// time. A symbol's bar only exists once it trades in the interval; opening
+// it schedules its close on a hashed timer wheel whose tick is the shortest
+// interval, so advancing the clock visits only the slots it passes and
+// closes each due bar in O(1), however many symbols the shard holds.
+class BarEngine {
+public:
+    static constexpr size_t kMaxIntervals = 8;
+
+    struct Bar {
+        uint64_t startNS = 0;
+        uint64_t volume = 0;
+        double notional = 0;
+        uint32_t open = 0;
+        uint32_t high = 0;
+        uint32_t low = 0;
+        uint32_t close = 0;
+        uint32_t trades = 0;
+        bool active = false;
+    };
+
+    // Parse a list such as 1s,1m,5m: whole milliseconds (ms, s, m or h),
+    // each a multiple of the shortest
+    static bool parseIntervals(const std::string& list, std::vector<uint64_t>& intervals) {
+        static const std::pair<const char*, uint64_t> units[] = {
+            {"ms", 1000000ull}, {"s", 1000000000ull}, {"m", 60000000000ull}, {"h", 3600000000000ull}};
+        intervals.clear();
+        for (size_t pos = 0; pos < list.size();) {
+            size_t comma = list.find(',', pos);
+            std::string item = list.substr(pos, comma - pos);
+            pos = (comma == std::string::npos) ? list.size() : comma + 1;
+            char* end = nullptr;
+            uint64_t count = std::strtoull(item.c_str(), &end, 10);
+            uint64_t scale = 0;
+            for (const auto& unit : units) {
+                if (std::strcmp(end, unit.first) == 0) {
+                    scale = unit.second;
+                }
+            }
+            if (count == 0 || scale == 0 || intervals.size() == kMaxIntervals) {
+                return false;
+            }
+            intervals.push_back(count * scale);
+        }
+        if (intervals.empty()) {
+            return false;
+        }
+        uint64_t shortest = *std::min_element(intervals.begin(), intervals.end());
+        return std::all_of(intervals.begin(), intervals.end(), [&](uint64_t interval) {
+            return interval % shortest == 0;
+        });
+    }
+
+private:
+    static constexpr size_t kWheelSlots = 4096;
+
+    struct Timer {
+        uint64_t dueTick;
+        uint32_t symbolIndex;
+        uint32_t interval;
+    };
+
+    std::vector<uint64_t> intervals;
+    uint64_t tickNS = 0;
+    std::vector<Bar> bars;
+    std::vector<std::vector<Timer>> wheel;
+    uint64_t currentTick = 0;
+    bool started = false;
+    uint64_t nowNS = 0;
+    uint64_t closedBars = 0;
+
+    Bar& barOf(uint32_t symbolIndex, size_t interval) {
+        size_t index = symbolIndex * intervals.size() + interval;
+        if (index >= bars.size()) {
+            bars.resize(std::max(index + 1, bars.size() * 2));
+        }
+        return bars[index];
+    }
+
+public:
+    void configure(const std::vector<uint64_t>& intervalsNS) {
+        intervals = intervalsNS;
+        if (intervals.empty()) {
+            return;
+        }
+        tickNS = *std::min_element(intervals.begin(), intervals.end());
+        wheel.assign(kWheelSlots, {});
+    }
+    bool enabled() const {
+        return !intervals.empty();
+    }
+    uint64_t closed() const {
+        return closedBars;
+    }
+
+    // Move to source time `timeNS`, which never goes back, and pass every
+    // bar that ended at or before it to close(symbolIndex, intervalNS, bar, true)
+    template <typename Close>
+    void advance(uint64_t timeNS, Close&& close) {
+        nowNS = timeNS;
+        uint64_t tick = nowNS / tickNS;
+        if (!started) {
+            started = true;
+            currentTick = tick;
+            return;
+        }
+        if (tick <= currentTick) {
+            return;
+        }
+        // After a gap longer than the wheel, one pass over every slot
+        // finds everything due
+        uint64_t steps = std::min<uint64_t>(tick - currentTick, kWheelSlots);
+        for (uint64_t step = 1; step <= steps; ++step) {
+            auto& slot = wheel[(currentTick + step) & (kWheelSlots - 1)];
+            size_t kept = 0;
+            for (const Timer& timer : slot) {
+                if (timer.dueTick > tick) {
+                    slot[kept++] = timer;
+                    continue;
+                }
+                Bar& bar = barOf(timer.symbolIndex, timer.interval);
+                close(timer.symbolIndex, intervals[timer.interval], static_cast<const Bar&>(bar), true);
+                bar.active = false;
+                closedBars++;
+            }
+            slot.resize(kept);
+        }
+        currentTick = tick;
+    }
+    // Add a printable trade at the current source time
+    void trade(uint32_t symbolIndex, uint32_t price, uint32_t volume) {
+        for (size_t i = 0; i < intervals.size(); ++i) {
+            Bar& bar = barOf(symbolIndex, i);
+            if (!bar.active) {
+                bar = Bar();
+                bar.active = true;
+                bar.startNS = nowNS - nowNS % intervals[i];
+                bar.open = bar.high = bar.low = price;
+                uint64_t dueTick = (bar.startNS + intervals[i]) / tickNS;
+                wheel[dueTick & (kWheelSlots - 1)].push_back({dueTick, symbolIndex, static_cast<uint32_t>(i)});
+            }
+            bar.high = std::max(bar.high, price);
+            bar.low = std::min(bar.low, price);
+            bar.close = price;
+            bar.volume += volume;
+            bar.notional += static_cast<double>(price) * volume;
+            bar.trades++;
+        }
+    }
+    // Pass the bars still open to close(..., false), at exit
+    template <typename Close>
+    void closeAll(Close&& close) {
+        for (size_t index = 0; index < bars.size(); ++index) {
+            Bar& bar = bars[index];
+            if (bar.active) {
+                close(static_cast<uint32_t>(index / intervals.size()), intervals[index % intervals.size()],
+                      static_cast<const Bar&>(bar), false);
+                bar.active = false;
+                closedBars++;
+            }
+        }
+        for (auto& slot : wheel) {
+            slot.clear();
+        }
+    }
+};
+
+// Trade Tape Definition
+// Every trade of one symbol, append-only and stored column by column so a
+// scan reads only the fields it needs. Printable trades also feed running
+// totals of volume, notional and count, one entry per row, so the totals
+// over any time window come from two binary searches on the time column
+// and two subtractions. Cancels and corrections do not rewrite the totals:
+// they are kept as adjustments ordered by row, few enough to add up
+// directly over a window.
+class TradeTape {
+public:
+    static constexpr uint8_t kPrintable = 1;
+    static constexpr uint8_t kCancelled = 2;
+    static constexpr uint8_t kCorrected = 4;
+
+    struct Totals {
+        uint64_t trades = 0;
+        uint64_t volume = 0;
+        unsigned __int128 notional = 0;
+
+        double vwap() const {
+            return volume > 0 ? static_cast<double>(notional) / volume : 0;
+        }
+    };
+
+private:
+    struct Adjustment {
+        uint32_t row;
+        int64_t trades;
+        int64_t volume;
+        __int128 notional;
+    };
+
+    std::vector<uint64_t> timeNS;
+    std::vector<uint32_t> prices;
+    std::vector<uint32_t> volumes;
+    std::vector<uint32_t> tradeIDs;
+    std::vector<std::array<char, 4>> conditions;
+    std::vector<char> types;
+    std::vector<uint8_t> flags;
+    // Totals of the rows before row i, as appended
+    std::vector<uint64_t> tradesBefore{0};
+    std::vector<uint64_t> volumeBefore{0};
+    std::vector<unsigned __int128> notionalBefore{0};
+    std::vector<Adjustment> adjustments;
+    std::unordered_map<uint64_t, uint32_t> rowByID;
+
+    static uint64_t idKey(char type, uint32_t tradeID) {
+        return (static_cast<uint64_t>(type == 'X') << 32) | tradeID;
+    }
+    void adjust(uint32_t row, int64_t trades, int64_t volume) {
+        Adjustment adjustment{row, trades, volume, static_cast<__int128>(prices[row]) * volume};
+        auto at = std::upper_bound(adjustments.begin(), adjustments.end(), row,
+                                   [](uint32_t value, const Adjustment& entry) { return value < entry.row; });
+        adjustments.insert(at, adjustment);
+    }
+
+public:
+    size_t size() const {
+        return timeNS.size();
+    }
+
+    // Append a trade: 'E' execution, 'N' non-displayed or 'X' cross. Times
+    // must not go backwards.
+    void append(uint64_t time, uint32_t price, uint32_t volume, uint32_t tradeID, char type,
+                const std::array<char, 4>& tradeConditions, bool printable) {
+        uint32_t row = static_cast<uint32_t>(timeNS.size());
+        timeNS.push_back(time);
+        prices.push_back(price);
+        volumes.push_back(volume);
+        tradeIDs.push_back(tradeID);
+        conditions.push_back(tradeConditions);
+        types.push_back(type);
+        flags.push_back(printable ? kPrintable : 0);
+        tradesBefore.push_back(tradesBefore.back() + (printable ? 1 : 0));
+        volumeBefore.push_back(volumeBefore.back() + (printable ? volume : 0));
+        notionalBefore.push_back(notionalBefore.back() +
+                                 (printable ? static_cast<unsigned __int128>(price) * volume : 0));
+        rowByID[idKey(type, tradeID)] = row;
+    }
+    // Take back an execution or non-displayed trade; false if unknown
+    bool cancel(uint32_t tradeID) {
+        auto found = rowByID.find(idKey('E', tradeID));
+        if (found == rowByID.end() || (flags[found->second] & kCancelled) != 0) {
+            return false;
+        }
+        uint32_t row = found->second;
+        flags[row] |= kCancelled;
+        if ((flags[row] & kPrintable) != 0) {
+            adjust(row, -1, -static_cast<int64_t>(volumes[row]));
+        }
+        return true;
+    }
+    // Change the volume of a cross; false if unknown
+    bool correct(uint32_t crossID, uint32_t volume) {
+        auto found = rowByID.find(idKey('X', crossID));
+        if (found == rowByID.end() || (flags[found->second] & kCancelled) != 0) {
+            return false;
+        }
+        uint32_t row = found->second;
+        if ((flags[row] & kPrintable) != 0) {
+            adjust(row, 0, static_cast<int64_t>(volume) - volumes[row]);
+        }
+        volumes[row] = volume;
+        flags[row] |= kCorrected;
+        return true;
+    }
+
+    // Printable trades with fromNS <= time < toNS, after cancels and corrections
+    Totals query(uint64_t fromNS, uint64_t toNS) const {
+        size_t first = std::lower_bound(timeNS.begin(), timeNS.end(), fromNS) - timeNS.begin();
+        size_t last = std::lower_bound(timeNS.begin(), timeNS.end(), toNS) - timeNS.begin();
+        Totals totals;
+        if (first >= last) {
+            return totals;
+        }
+        totals.trades = tradesBefore[last] - tradesBefore[first];
+        totals.volume = volumeBefore[last] - volumeBefore[first];
+        totals.notional = notionalBefore[last] - notionalBefore[first];
+        auto from = std::lower_bound(adjustments.begin(), adjustments.end(), first,
+                                     [](const Adjustment& entry, size_t value) { return entry.row < value; });
+        for (auto at = from; at != adjustments.end() && at->row < last; ++at) {
+            totals.trades += at->trades;
+            totals.volume += at->volume;
+            totals.notional += at->notional;
+        }
+        return totals;
+    }
+
+    // Visit rows with fromNS <= time < toNS as
+    // fn(time, price, volume, tradeID, type, conditions, flags)
+    template <typename Fn>
+    void forEach(uint64_t fromNS, uint64_t toNS, Fn&& fn) const {
+        size_t row = std::lower_bound(timeNS.begin(), timeNS.end(), fromNS) - timeNS.begin();
+        for (; row < timeNS.size() && timeNS[row] < toNS; ++row) {
+            fn(timeNS[row], prices[row], volumes[row], tradeIDs[row], types[row], conditions[row], flags[row]);
+        }
+    }
+};
+
+// Trade Tape Set Definition
+// A shard's tapes, one per symbol that has traded
+class TradeTapeSet {
+private:
+    bool active = false;
+    std::vector<std::unique_ptr<TradeTape>> tapes;
+    uint64_t cancels = 0;
+    uint64_t corrections = 0;
+    uint64_t unmatched = 0;
+
+public:
+    void enable() {
+        active = true;
+    }
+    bool enabled() const {
+        return active;
+    }
+    TradeTape& of(uint32_t symbolIndex) {
+        if (symbolIndex >= tapes.size()) {
+            tapes.resize(std::max<size_t>(symbolIndex + 1, tapes.size() * 2));
+        }
+        if (tapes[symbolIndex] == nullptr) {
+            tapes[symbolIndex] = std::make_unique<TradeTape>();
+        }
+        return *tapes[symbolIndex];
+    }
+    const TradeTape* find(uint32_t symbolIndex) const {
+        return symbolIndex < tapes.size() ? tapes[symbolIndex].get() : nullptr;
+    }
+    void cancel(uint32_t symbolIndex, uint32_t tradeID) {
+        TradeTape* tape = symbolIndex < tapes.size() ? tapes[symbolIndex].get() : nullptr;
+        (tape != nullptr && tape->cancel(tradeID)) ? cancels++ : unmatched++;
+    }
+    void correct(uint32_t symbolIndex, uint32_t crossID, uint32_t volume) {
+        TradeTape* tape = symbolIndex < tapes.size() ? tapes[symbolIndex].get() : nullptr;
+        (tape != nullptr && tape->correct(crossID, volume)) ? corrections++ : unmatched++;
+    }
+
+    // Add this set's counts to the running totals
+    void addStats(uint64_t& symbols, uint64_t& trades, uint64_t& cancelled, uint64_t& corrected,
+                  uint64_t& missed) const {
+        for (const auto& tape : tapes) {
+            if (tape != nullptr) {
+                symbols++;
+                trades += tape->size();
+            }
+        }
+        cancelled += cancels;
+        corrected += corrections;
+        missed += unmatched;
+    }
+};
+
+// Tape Query Definition
+// A symbol and a source-time window [fromNS, toNS) to total its trades over
+struct TapeQuery {
+    std::string symbol;
+    uint64_t fromNS = 0;
+    uint64_t toNS = UINT64_MAX;
+
+    // Epoch seconds with up to nine decimals, e.g. 1704205817.25
+    static bool parseTime(const std::string& text, uint64_t& ns) {
+        size_t dot = text.find('.');
+        std::string whole = text.substr(0, dot);
+        std::string fraction = (dot == std::string::npos) ? std::string() : text.substr(dot + 1);
+        if (whole.empty() || fraction.size() > 9 || whole.find_first_not_of("0123456789") != std::string::npos ||
+            fraction.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        fraction.resize(9, '0');
+        ns = std::stoull(whole) * 1000000000 + std::stoull(fraction);
+        return true;
+    }
+    // Parse `SYMBOL` or `SYMBOL@FROM-TO`, either end of which may be left out
+    static bool parse(const std::string& spec, TapeQuery& query) {
+        size_t at = spec.find('@');
+        query.symbol = spec.substr(0, at);
+        if (query.symbol.empty()) {
+            return false;
+        }
+        if (at == std::string::npos) {
+            return true;
+        }
+        std::string window = spec.substr(at + 1);
+        size_t dash = window.find('-');
+        if (dash == std::string::npos) {
+            return false;
+        }
+        std::string from = window.substr(0, dash);
+        std::string to = window.substr(dash + 1);
+        return (from.empty() || parseTime(from, query.fromNS)) && (to.empty() || parseTime(to, query.toNS)) &&
+               query.fromNS < query.toNS;
+    }
+};
+
+// Auction State Definition
+// The latest Imbalance message of one symbol, one cache line each
+struct alignas(64) AuctionState {
+    uint32_t referencePrice;
+    uint32_t pairedQty;
+    uint32_t totalImbalanceQty;
+    uint32_t marketImbalanceQty;
+    uint32_t continuousBookClearingPrice;
+    uint32_t auctionInterestClearingPrice;
+    uint32_t ssrFilingPrice;
+    uint32_t indicativeMatchPrice;
+    uint32_t upperCollar;
+    uint32_t lowerCollar;
+    uint32_t unpairedQty;
+    uint32_t sourceTimeNS;
+    // Position in the significant list plus one, 0 when not in it
+    uint32_t significantSlot;
+    uint16_t auctionTime;
+    char auctionType;
+    char imbalanceSide;
+    uint8_t auctionStatus;
+    uint8_t freezeStatus;
+    uint8_t numExtensions;
+    char unpairedSide;
+    char significantImbalance;
+    bool active;
+
+    uint32_t value(AuctionField field) const {
+        switch (field) {
+            case AuctionField::ReferencePrice: return referencePrice;
+            case AuctionField::PairedQty: return pairedQty;
+            case AuctionField::TotalImbalanceQty: return totalImbalanceQty;
+            case AuctionField::MarketImbalanceQty: return marketImbalanceQty;
+            case AuctionField::AuctionTime: return auctionTime;
+            case AuctionField::AuctionType: return static_cast<uint8_t>(auctionType);
+            case AuctionField::ImbalanceSide: return static_cast<uint8_t>(imbalanceSide);
+            case AuctionField::ContinuousBookClearingPrice: return continuousBookClearingPrice;
+            case AuctionField::AuctionInterestClearingPrice: return auctionInterestClearingPrice;
+            case AuctionField::SsrFilingPrice: return ssrFilingPrice;
+            case AuctionField::IndicativeMatchPrice: return indicativeMatchPrice;
+            case AuctionField::UpperCollar: return upperCollar;
+            case AuctionField::LowerCollar: return lowerCollar;
+            case AuctionField::AuctionStatus: return auctionStatus;
+            case AuctionField::FreezeStatus: return freezeStatus;
+            case AuctionField::NumExtensions: return numExtensions;
+            case AuctionField::UnpairedQty: return unpairedQty;
+            case AuctionField::UnpairedSide: return static_cast<uint8_t>(unpairedSide);
+            case AuctionField::SignificantImbalance: return static_cast<uint8_t>(significantImbalance);
+            default: return 0;
+        }
+    }
+};
+static_assert(sizeof(AuctionState) == 64, "AuctionState should fill one cache line");
+
+// Auction Book Definition
+// A shard's auction states, indexed directly by symbolIndex and sized up
+// front with the symbol table, so an Imbalance message is copied in place
+// field by field without allocating. Each update returns a mask of the
+// fields that changed. Symbols with a significant imbalance, flagged by
+// the feed or at least the configured quantity, are also kept in a dense
+// list, so listing them costs nothing for the symbols that are not.
+class AuctionBook {
+private:
+    static constexpr uint32_t kMaxSymbols = 1 << 24;
+
+    bool active = false;
+    uint32_t threshold = 0;
+    std::vector<AuctionState> states;
+    std::vector<uint32_t> significantSymbols;
+    uint64_t updates = 0;
+    uint64_t unchanged = 0;
+
+    template <typename T>
+    static uint32_t track(AuctionField field, T& stored, T value) {
+        uint32_t changed = static_cast<uint32_t>(stored != value) << static_cast<unsigned>(field);
+        stored = value;
+        return changed;
+    }
+    void setSignificant(uint32_t symbolIndex, AuctionState& state, bool significant) {
+        if (significant && state.significantSlot == 0) {
+            significantSymbols.push_back(symbolIndex);
+            state.significantSlot = static_cast<uint32_t>(significantSymbols.size());
+        } else if (!significant && state.significantSlot != 0) {
+            uint32_t moved = significantSymbols.back();
+            significantSymbols[state.significantSlot - 1] = moved;
+            states[moved].significantSlot = state.significantSlot;
+            significantSymbols.pop_back();
+            state.significantSlot = 0;
+        }
+    }
+
+public:
+    // Track auctions for symbol indexes below `symbols` without growing,
+    // counting an imbalance of at least `minimumQty` (0: the feed's flag
+    // only) as significant
+    void configure(size_t symbols, uint32_t minimumQty) {
+        active = true;
+        threshold = minimumQty;
+        states.assign(symbols, AuctionState{});
+        significantSymbols.reserve(symbols);
+    }
+    bool enabled() const {
+        return active;
+    }
+
+    // Apply an Imbalance message; the mask of fields that changed
+    uint32_t update(const ImbalanceMessage& msg) {
+        if (msg.symbolIndex >= kMaxSymbols) {
+            return 0;
+        }
+        if (msg.symbolIndex >= states.size()) {
+            states.resize(std::max<size_t>(msg.symbolIndex + 1, states.size() * 2), AuctionState{});
+        }
+        AuctionState& state = states[msg.symbolIndex];
+        uint32_t changed = state.active ? 0 : ~0u >> (32 - static_cast<unsigned>(AuctionField::Count));
+        changed |= track(AuctionField::ReferencePrice, state.referencePrice, msg.referencePrice);
+        changed |= track(AuctionField::PairedQty, state.pairedQty, msg.pairedQty);
+        changed |= track(AuctionField::TotalImbalanceQty, state.totalImbalanceQty, msg.totalImbalanceQty);
+        changed |= track(AuctionField::MarketImbalanceQty, state.marketImbalanceQty, msg.marketImbalanceQty);
+        changed |= track(AuctionField::AuctionTime, state.auctionTime, msg.auctionTime);
+        changed |= track(AuctionField::AuctionType, state.auctionType, msg.auctionType);
+        changed |= track(AuctionField::ImbalanceSide, state.imbalanceSide, msg.imbalanceSide);
+        changed |= track(AuctionField::ContinuousBookClearingPrice, state.continuousBookClearingPrice,
+                         msg.continuousBookClearingPrice);
+        changed |= track(AuctionField::AuctionInterestClearingPrice, state.auctionInterestClearingPrice,
+                         msg.auctionInterestClearingPrice);
+        changed |= track(AuctionField::SsrFilingPrice, state.ssrFilingPrice, msg.ssrFilingPrice);
+        changed |= track(AuctionField::IndicativeMatchPrice, state.indicativeMatchPrice, msg.indicativeMatchPrice);
+        changed |= track(AuctionField::UpperCollar, state.upperCollar, msg.upperCollar);
+        changed |= track(AuctionField::LowerCollar, state.lowerCollar, msg.lowerCollar);
+        changed |= track(AuctionField::AuctionStatus, state.auctionStatus, msg.auctionStatus);
+        changed |= track(AuctionField::FreezeStatus, state.freezeStatus, msg.freezeStatus);
+        changed |= track(AuctionField::NumExtensions, state.numExtensions, msg.numExtensions);
+        changed |= track(AuctionField::UnpairedQty, state.unpairedQty, msg.unpairedQty);
+        changed |= track(AuctionField::UnpairedSide, state.unpairedSide, msg.unpairedSide);
+        changed |= track(AuctionField::SignificantImbalance, state.significantImbalance, msg.significantImbalance);
+        state.sourceTimeNS = msg.sourceTimeNS;
+        state.active = true;
+        setSignificant(msg.symbolIndex, state,
+                       state.significantImbalance == 'Y' || (threshold > 0 && state.totalImbalanceQty >= threshold));
+        updates++;
+        unchanged += (changed == 0);
+        return changed;
+    }
+    // Forget a symbol's auction, as on a Symbol Clear
+    void clear(uint32_t symbolIndex) {
+        if (symbolIndex < states.size() && states[symbolIndex].active) {
+            setSignificant(symbolIndex, states[symbolIndex], false);
+            states[symbolIndex] = AuctionState{};
+        }
+    }
+
+    const AuctionState& operator[](uint32_t symbolIndex) const {
+        return states[symbolIndex];
+    }
+    // Symbol indexes with a significant imbalance, in no particular order
+    const std::vector<uint32_t>& significant() const {
+        return significantSymbols;
+    }
+    void addStats(uint64_t& updated, uint64_t& repeated) const {
+        updated += updates;
+        repeated += unchanged;
+    }
+};
+
+// Book Shard Definition
+// Everything one book thread owns: the books of its symbols, the pool their
+// orders come from and, with --shared-order-index, the index they share.
+// Members are destroyed bottom-up, so books go before the pool and index.
+struct BookShard {
+    OrderPool orderPool;
+    std::unique_ptr<OrderIndex> sharedIndex;
+    SymbolTable symbolTable{&orderPool};
+    uint32_t currentSymbolIndex = 0;
+    ConflationState conflation;
+    SourceClock clock;
+    uint64_t sourceTimeNS = 0;
+    BarEngine bars;
+    TradeTapeSet tapes;
+    AuctionBook auctions;
+};
+
+void handleMessage(BookShard& shard, uint16_t messageType, const uint8_t* buffer, size_t size);
+void flushConflated(BookShard& shard);
+void publishOhlcvBar(const SymbolTable& symbols, uint32_t symbolIndex, uint64_t intervalNS,
+                     const BarEngine::Bar& bar, bool complete);
+void printAllBars(const SymbolTable& symbols);
+
+// Message Queue Definition
+// Single-producer single-consumer byte ring carrying raw XDP messages from
+// the parsing thread to one book worker. Messages are copied as they appear
+// on the wire, header included, and padded to 8 bytes. A message that would
+// run past the end of the buffer is preceded by a filler header with a size
+// of zero, which sends the reader back to the start.
+class MessageQueue {
+public:
+    static constexpr size_t kBytes = 1 << 22;
+
+private:
+    static constexpr size_t kMask = kBytes - 1;
+    static constexpr size_t kReleaseEvery = 64;
+
+    std::unique_ptr<uint8_t[]> buffer{new uint8_t[kBytes]};
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cachedTail = 0;
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t cachedHead = 0;
+
+    static uint64_t padded(uint64_t size) {
+        return (size + 7) & ~uint64_t(7);
+    }
+
+public:
+    // Producer side; false when there is not enough room yet
+    bool push(const uint8_t* message, uint16_t size) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t needed = padded(size);
+        uint64_t toEnd = kBytes - (h & kMask);
+        uint64_t total = (needed <= toEnd) ? needed : toEnd + needed;
+        if (kBytes - (h - cachedTail) < total) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (kBytes - (h - cachedTail) < total) {
+                return false;
+            }
+        }
+        if (needed > toEnd) {
+            std::memset(buffer.get() + (h & kMask), 0, sizeof(XDPMessageHeader));
+            h += toEnd;
+        }
+        std::memcpy(buffer.get() + (h & kMask), message, size);
+        head.store(h + needed, std::memory_order_release);
+        return true;
+    }
+    // Producer side: true once the consumer has handled everything pushed
+    bool empty() const {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_relaxed);
+    }
+    // Consumer side: pass every queued message to fn(type, body, bodySize)
+    // and return how many there were
+    template <typename Fn>
+    size_t drain(Fn&& fn) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t == cachedHead) {
+                return 0;
+            }
+        }
+        size_t count = 0;
+        while (t != cachedHead) {
+            const auto& header = messageView<XDPMessageHeader>(buffer.get() + (t & kMask));
+            if (header.msg_size == 0) {
+                t += kBytes - (t & kMask);
+                continue;
+            }
+            fn(header.msg_type, buffer.get() + (t & kMask) + sizeof(XDPMessageHeader),
+               header.msg_size - sizeof(XDPMessageHeader));
+            t += padded(header.msg_size);
+            if (++count % kReleaseEvery == 0) {
+                tail.store(t, std::memory_order_release);
+            }
+        }
+        tail.store(t, std::memory_order_release);
+        return count;
+    }
+};
+
+// Pin a thread to one CPU core; false if the core cannot be used
+bool pinThread(pthread_t thread, int core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+}
+
+// Book Engine Definition
+// Owns the book shards and routes messages to them. With one shard messages
+// are handled inline on the parsing thread. With more, each shard runs on a
+// worker thread fed by its own MessageQueue, and a symbol always goes to
+// shard symbolIndex % shards, so per-symbol order is kept. Messages without
+// a symbol go to shard 0.
+class BookEngine {
+public:
+    static constexpr size_t kMaxShards = 32;
+    // Queued after a packet's messages to tell a worker the packet ended;
+    // no XDP message has type 0
+    static constexpr uint16_t kEndOfPacket = 0;
+
+private:
+    struct Worker {
+        std::unique_ptr<MessageQueue> queue = std::make_unique<MessageQueue>();
+        std::thread thread;
+        uint64_t stalls = 0;
+        bool inPacket = false;
+    };
+
+    std::vector<std::unique_ptr<BookShard>> shards;
+    std::vector<Worker> workers;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> barRequests{0};
+
+    size_t shardFor(uint16_t messageType, const uint8_t* message, uint16_t size) const {
+        size_t offset = messageSymbolOffset(messageType);
+        if (offset == SIZE_MAX || size < sizeof(XDPMessageHeader) + offset + sizeof(uint32_t)) {
+            return 0;
+        }
+        uint32_t symbolIndex;
+        std::memcpy(&symbolIndex, message + sizeof(XDPMessageHeader) + offset, sizeof(symbolIndex));
+        return symbolIndex % shards.size();
+    }
+    // Handle one message, flushing conflated books around it when the
+    // shard's policy calls for it
+    static void apply(BookShard& shard, uint16_t messageType, const uint8_t* body, size_t size) {
+        SourceTimeStamp stamp;
+        if ((shard.bars.enabled() || shard.tapes.enabled()) && messageSourceTime(messageType, body, size, stamp)) {
+            shard.sourceTimeNS = std::max(shard.sourceTimeNS, shard.clock.update(stamp));
+            if (shard.bars.enabled()) {
+                shard.bars.advance(shard.sourceTimeNS, [&](uint32_t symbolIndex, uint64_t intervalNS,
+                                                           const BarEngine::Bar& bar, bool complete) {
+                    publishOhlcvBar(shard.symbolTable, symbolIndex, intervalNS, bar, complete);
+                });
+            }
+        }
+        ConflationState& conflation = shard.conflation;
+        if (conflation.policy.mode == ConflationPolicy::Mode::Interval &&
+            messageType >= MSG_TYPE_ADD_ORDER && messageType <= MSG_TYPE_REPLACE_ORDER && size >= sizeof(uint32_t)) {
+            uint32_t sourceTimeNS;
+            std::memcpy(&sourceTimeNS, body, sizeof(sourceTimeNS));
+            if (conflation.startsInterval(sourceTimeNS)) {
+                flushConflated(shard);
+            }
+        }
+        handleMessage(shard, messageType, body, size);
+        if (conflation.policy.mode == ConflationPolicy::Mode::Messages && conflation.countMessage()) {
+            flushConflated(shard);
+        }
+    }
+    // Publish what a shard still holds back at exit: conflated books and
+    // bars that have not closed
+    static void finish(BookShard& shard) {
+        flushConflated(shard);
+        shard.bars.closeAll([&](uint32_t symbolIndex, uint64_t intervalNS, const BarEngine::Bar& bar, bool complete) {
+            publishOhlcvBar(shard.symbolTable, symbolIndex, intervalNS, bar, complete);
+        });
+    }
+    void run(size_t index) {
+        BookShard& shard = *shards[index];
+        MessageQueue& queue = *workers[index].queue;
+        uint64_t barsPrinted = 0;
+        while (true) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            size_t handled = queue.drain([&](uint16_t messageType, const uint8_t* body, size_t size) {
+                if (messageType == kEndOfPacket) {
+                    flushConflated(shard);
+                } else {
+                    apply(shard, messageType, body, size);
+                }
+            });
+            uint64_t requested = barRequests.load(std::memory_order_relaxed);
+            if (requested != barsPrinted) {
+                barsPrinted = requested;
+                printAllBars(shard.symbolTable);
+            }
+            if (handled == 0) {
+                if (stopping) {
+                    finish(shard);
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+    ~BookEngine() {
+        stop();
+    }
+
+    // Create the shards. `orderCapacity` is per book, or split across the
+    // shards when each shard shares one index between its symbols.
+    void configure(size_t shardCount, bool sharedIndex, size_t orderCapacity,
+                   bool allMarketByPrice, const std::vector<std::string>& marketByPriceSymbols,
+                   const ConflationPolicy& conflation = ConflationPolicy(),
+                   const std::vector<uint64_t>& barIntervals = {}, bool tradeTape = false, bool auctions = false,
+                   uint32_t imbalanceThreshold = 0) {
+        shards.clear();
+        for (size_t i = 0; i < shardCount; ++i) {
+            auto shard = std::make_unique<BookShard>();
+            if (sharedIndex) {
+                size_t total = orderCapacity > 0 ? orderCapacity : (1 << 22);
+                shard->sharedIndex = std::make_unique<OrderIndex>(std::max<size_t>(total / shardCount, 1));
+            }
+            shard->symbolTable.configureOrderIndex(shard->sharedIndex.get(),
+                                                   orderCapacity > 0 ? orderCapacity : OrderIndex::kDefaultCapacity);
+            shard->symbolTable.configureMarketByPrice(allMarketByPrice, marketByPriceSymbols);
+            shard->conflation.policy = conflation;
+            shard->bars.configure(barIntervals);
+            if (tradeTape) {
+                shard->tapes.enable();
+            }
+            if (auctions) {
+                shard->auctions.configure(shard->symbolTable.size(), imbalanceThreshold);
+            }
+            shards.push_back(std::move(shard));
+        }
+    }
+    // Start one worker per shard when there is more than one. Worker i is
+    // pinned to cores[i] if given.
+    bool start(const std::vector<int>& cores) {
+        if (shards.size() < 2) {
+            return true;
+        }
+        workers = std::vector<Worker>(shards.size());
+        running.store(true, std::memory_order_release);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].thread = std::thread(&BookEngine::run, this, i);
+            if (i < cores.size() && !pinThread(workers[i].thread.native_handle(), cores[i])) {
+                std::cerr << "Could not pin book worker " << i << " to core " << cores[i] << "\n";
+            }
+        }
+        return true;
+    }
+    // Hand one wire message (header included) to the shard that owns it
+    void dispatch(uint16_t messageType, const uint8_t* message, uint16_t size) {
+        if (workers.empty()) {
+            apply(*shards[0], messageType, message + sizeof(XDPMessageHeader), size - sizeof(XDPMessageHeader));
+            return;
+        }
+        // Every shard keeps its own source clock, so each sees the seconds
+        if (messageType == MSG_TYPE_SOURCE_TIME_REFERENCE &&
+            (shards[0]->bars.enabled() || shards[0]->tapes.enabled())) {
+            for (Worker& worker : workers) {
+                while (!worker.queue->push(message, size)) {
+                    worker.stalls++;
+                    std::this_thread::yield();
+                }
+            }
+            return;
+        }
+        Worker& worker = workers[shardFor(messageType, message, size)];
+        worker.inPacket = true;
+        while (!worker.queue->push(message, size)) {
+            worker.stalls++;
+            std::this_thread::yield();
+        }
+    }
+    // With per-packet conflation, flush the books a packet changed. Workers
+    // that were sent any of its messages get an end-of-packet marker.
+    void endPacket() {
+        if (shards[0]->conflation.policy.mode != ConflationPolicy::Mode::Packet) {
+            return;
+        }
+        if (workers.empty()) {
+            flushConflated(*shards[0]);
+            return;
+        }
+        const XDPMessageHeader marker = {sizeof(XDPMessageHeader), kEndOfPacket};
+        for (Worker& worker : workers) {
+            if (!worker.inPacket) {
+                continue;
+            }
+            worker.inPacket = false;
+            while (!worker.queue->push(reinterpret_cast<const uint8_t*>(&marker), sizeof(marker))) {
+                worker.stalls++;
+                std::this_thread::yield();
+            }
+        }
+    }
+    // Print every shard's bars; workers print theirs after their current batch
+    void printBars() {
+        if (workers.empty()) {
+            printAllBars(shards[0]->symbolTable);
+        } else {
+            barRequests.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // Wait until the workers have applied everything dispatched so far, so
+    // the calling thread can read the books until it dispatches again
+    void quiesce() {
+        for (Worker& worker : workers) {
+            while (!worker.queue->empty()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    BookShard& shardOf(uint32_t symbolIndex) {
+        return *shards[symbolIndex % shards.size()];
+    }
+    // One past the highest symbol index any shard has room for
+    uint32_t symbolCapacity() const {
+        size_t capacity = 0;
+        for (const auto& shard : shards) {
+            capacity = std::max(capacity, shard->symbolTable.size());
+        }
+        return static_cast<uint32_t>(capacity);
+    }
+    // Let the workers finish what is queued, then join them. Books still
+    // waiting on conflation are published either way.
+    void stop() {
+        if (workers.empty()) {
+            if (!shards.empty()) {
+                finish(*shards[0]);
+            }
+            return;
+        }
+        running.store(false, std::memory_order_release);
+        for (Worker& worker : workers) {
+            if (worker.thread.joinable()) {
+                worker.thread.join();
+            }
+        }
+    }
+
+    // Symbols with a significant imbalance, largest first
+    void printImbalances() const {
+        struct Row {
+            const BookShard* shard;
+            uint32_t symbolIndex;
+        };
+        std::vector<Row> rows;
+        for (const auto& shard : shards) {
+            for (uint32_t symbolIndex : shard->auctions.significant()) {
+                rows.push_back({shard.get(), symbolIndex});
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            return a.shard->auctions[a.symbolIndex].totalImbalanceQty > b.shard->auctions[b.symbolIndex].totalImbalanceQty;
+        });
+        std::cout << std::fixed << std::setprecision(4);
+        for (const Row& row : rows) {
+            const AuctionState& state = row.shard->auctions[row.symbolIndex];
+            const SymbolTable& symbols = row.shard->symbolTable;
+            double priceDivisor = std::pow(10, row.symbolIndex < symbols.size() ? symbols[row.symbolIndex].priceScaleCode : 0);
+            std::cout << "Imbalance " << symbols.name(row.symbolIndex) << ": " << state.totalImbalanceQty << " "
+                      << state.imbalanceSide << ", paired " << state.pairedQty << ", match "
+                      << state.indicativeMatchPrice / priceDivisor << ", collars " << state.lowerCollar / priceDivisor
+                      << "-" << state.upperCollar / priceDivisor << ", auction " << state.auctionType << "\n";
+        }
+        std::cout << std::defaultfloat;
+    }
+    void printStats() const {
+        if (!shards.empty() && shards[0]->conflation.enabled()) {
+            uint64_t updates = 0, publications = 0;
+            for (const auto& shard : shards) {
+                updates += shard->conflation.updates;
+                publications += shard->conflation.publications;
+            }
+            std::cout << "Conflation: " << updates << " book update(s) published as " << publications << "\n";
+        }
+        if (!shards.empty() && shards[0]->bars.enabled()) {
+            uint64_t closed = 0;
+            for (const auto& shard : shards) {
+                closed += shard->bars.closed();
+            }
+            std::cout << "Bars: " << closed << " closed\n";
+        }
+        if (!shards.empty() && shards[0]->tapes.enabled()) {
+            uint64_t symbols = 0, trades = 0, cancels = 0, corrections = 0, unmatched = 0;
+            for (const auto& shard : shards) {
+                shard->tapes.addStats(symbols, trades, cancels, corrections, unmatched);
+            }
+            std::cout << "Trade tape: " << trades << " trade(s) for " << symbols << " symbol(s), " << cancels
+                      << " cancel(s), " << corrections << " correction(s), " << unmatched << " unmatched\n";
+        }
+        if (!shards.empty() && shards[0]->auctions.enabled()) {
+            uint64_t updates = 0, unchanged = 0, significant = 0;
+            for (const auto& shard : shards) {
+                shard->auctions.addStats(updates, unchanged);
+                significant += shard->auctions.significant().size();
+            }
+            std::cout << "Auctions: " << updates << " imbalance update(s), " << unchanged << " unchanged, "
+                      << significant << " symbol(s) with a significant imbalance\n";
+        }
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (shards.size() > 1) {
+                std::cout << "Shard " << i << ": queue stalls "
+                          << (workers.empty() ? 0 : workers[i].stalls) << "\n";
+            }
+            shards[i]->orderPool.printStats();
+            shards[i]->symbolTable.printOrderIndexStats();
+        }
+    }
+};
+
+// Packet Source Definition
+// Where a packet came from: the UDP destination port identifies the XDP
+// channel, the multicast group (destination IP) which line carried it
+struct PacketSource {
+    uint32_t line = 0;
+    uint16_t channel = 0;
+};
+
+// Sequence Tracker Definition
+// Per-channel A/B line arbitration on the Pillar packet sequence number. The
+// first copy of each sequence number wins on whichever line it arrives;
+// packets that only repeat numbers already seen are dropped before any
+// message is decoded. A packet that jumps past the expected number is held
+// back while the other line gets the chance to fill the gap, so the books
+// still see every message in order. Only when the gap outlives its window
+// are the missing messages declared lost and the held packets released.
+class SequenceTracker {
+private:
+    // A gap is lost once the channel has moved on past it by both this much
+    // feed time and this many packets, so a quiet channel still gives the
+    // other line a few packets to catch up. A channel holds at most
+    // kMaxHeldPackets before giving up on its oldest gap.
+    static constexpr uint64_t kGapWindowNS = 100000000;
+    static constexpr uint64_t kGapWindowPackets = 64;
+    static constexpr size_t kMaxHeldPackets = 1024;
+
+    struct Line {
+        uint32_t address;
+        uint64_t packets;
+        uint64_t wins;
+    };
+    // A packet that arrived ahead of a gap, copied until the gap closes
+    struct HeldPacket {
+        uint64_t end;
+        uint64_t arrivedNS;
+        uint64_t arrivedPacket;
+        std::vector<uint8_t> bytes;
+    };
+    struct Channel {
+        uint16_t port;
+        bool started;
+        uint64_t expected;   // next sequence number to apply
+        uint64_t frontier;   // one past the highest sequence number seen
+        uint64_t latestNS;
+        uint64_t resetFirst;
+        uint64_t resetSendTimeNS;
+        uint64_t packets;
+        uint64_t duplicatePackets;
+        uint64_t gaps;
+        uint64_t gapMessages;
+        uint64_t lostGaps;
+        uint64_t lostMessages;
+        std::map<uint64_t, HeldPacket> held;  // by first sequence number
+        std::vector<Line> lines;
+    };
+
+    // Channel slot per UDP port, 1-based so zero means not seen yet
+    std::vector<uint16_t> channelSlot = std::vector<uint16_t>(65536, 0);
+    std::vector<Channel> channels;
+
+    Channel& channelFor(uint16_t port) {
+        uint16_t& slot = channelSlot[port];
+        if (slot == 0) {
+            Channel channel{};
+            channel.port = port;
+            channels.push_back(std::move(channel));
+            slot = static_cast<uint16_t>(channels.size());
+        }
+        return channels[slot - 1];
+    }
+    static Line& lineFor(Channel& channel, uint32_t address) {
+        for (Line& line : channel.lines) {
+            if (line.address == address) {
+                return line;
+            }
+        }
+        channel.lines.push_back(Line{address, 0, 0});
+        return channel.lines.back();
+    }
+    // Release held packets that are next in sequence. The gap in front of
+    // the oldest one is given up as lost when it has outlived its window,
+    // the channel holds too many packets, or `all` is set.
+    template <typename Apply>
+    static void release(Channel& channel, Apply& apply, bool all) {
+        while (!channel.held.empty()) {
+            auto next = channel.held.begin();
+            HeldPacket& packet = next->second;
+            if (next->first > channel.expected) {
+                bool expired = packet.arrivedNS + kGapWindowNS < channel.latestNS &&
+                               packet.arrivedPacket + kGapWindowPackets < channel.packets;
+                if (!all && !expired && channel.held.size() <= kMaxHeldPackets) {
+                    return;
+                }
+                channel.lostGaps++;
+                channel.lostMessages += next->first - channel.expected;
+                logEvent(LogLevel::Warning, LogEvent::SequenceGapLost, channel.port, channel.expected,
+                         next->first - channel.expected);
+                channel.expected = next->first;
+            }
+            if (packet.end > channel.expected) {
+                apply(packet.bytes.data(), static_cast<uint16_t>(packet.bytes.size()),
+                      static_cast<uint8_t>(channel.expected - next->first));
+                channel.expected = packet.end;
+            }
+            channel.held.erase(next);
+        }
+    }
+
+public:
+    // Pillar DeliveryFlag of a packet that restarts the sequence numbers
+    static constexpr uint8_t kDeliverySequenceReset = 12;
+
+    // Arbitrate one packet, calling apply(data, length, skip) for it and for
+    // any held packets it lets through, where skip counts the leading
+    // messages already applied. sendTimeNS is the packet's feed time, which
+    // times how long gaps stay open; `reset` marks a packet that restarts the
+    // channel's numbering (delivery flag 12 or a Sequence Number Reset
+    // message). The other line's copy of a reset packet carries the same
+    // number and sendTime and is arbitrated like any other packet.
+    template <typename Apply>
+    void accept(const PacketSource& source, uint32_t sequenceNumber, uint8_t numberOfMessages,
+                uint64_t sendTimeNS, bool reset, const uint8_t* data, uint16_t length, Apply&& apply) {
+        if (numberOfMessages == 0) {
+            return;
+        }
+        Channel& channel = channelFor(source.channel);
+        Line& line = lineFor(channel, source.line);
+        channel.packets++;
+        line.packets++;
+
+        uint64_t first = sequenceNumber;
+        uint64_t end = first + numberOfMessages;
+        channel.latestNS = std::max(channel.latestNS, sendTimeNS);
+        if (reset) {
+            reset = !channel.started || first != channel.resetFirst || sendTimeNS != channel.resetSendTimeNS;
+            channel.resetFirst = first;
+            channel.resetSendTimeNS = sendTimeNS;
+        }
+        if (!channel.started || reset) {
+            // Whatever is held belongs to the old numbering
+            release(channel, apply, true);
+            channel.started = true;
+            channel.expected = end;
+            channel.frontier = end;
+            line.wins++;
+            apply(data, length, 0);
+            return;
+        }
+
+        auto held = channel.held.find(first);
+        if (end <= channel.expected || (held != channel.held.end() && held->second.end >= end)) {
+            channel.duplicatePackets++;
+        } else if (first <= channel.expected) {
+            // Overlaps what was already delivered; keep only the new tail
+            line.wins++;
+            apply(data, length, static_cast<uint8_t>(channel.expected - first));
+            channel.expected = end;
+            channel.frontier = std::max(channel.frontier, end);
+        } else {
+            if (first > channel.frontier) {
+                channel.gaps++;
+                channel.gapMessages += first - channel.frontier;
+                logEvent(LogLevel::Warning, LogEvent::SequenceGap, source.channel, channel.frontier, first);
+            }
+            line.wins++;
+            channel.held[first] = HeldPacket{end, channel.latestNS, channel.packets,
+                                             std::vector<uint8_t>(data, data + length)};
+            channel.frontier = std::max(channel.frontier, end);
+        }
+        release(channel, apply, false);
+    }
+    // Give up on every open gap and apply what is held, at the end of the
+    // input or before a checkpoint records the expected sequence numbers
+    template <typename Apply>
+    void flush(Apply&& apply) {
+        for (Channel& channel : channels) {
+            release(channel, apply, true);
+        }
+    }
+
+    // Visit every channel as fn(port, next expected sequence number)
+    template <typename Fn>
+    void forEachChannel(Fn&& fn) const {
+        for (const Channel& channel : channels) {
+            if (channel.started) {
+                fn(channel.port, channel.expected);
+            }
+        }
+    }
+    // Resume a channel from a checkpoint; earlier sequence numbers are duplicates
+    void restoreChannel(uint16_t port, uint64_t expected) {
+        Channel& channel = channelFor(port);
+        channel.started = true;
+        channel.expected = expected;
+        channel.frontier = expected;
+    }
+
+    // Every gap message was either filled by another line or lost
+    void printStats() const {
+        for (const Channel& channel : channels) {
+            double duplicateRate = channel.packets ? 100.0 * channel.duplicatePackets / channel.packets : 0.0;
+            std::cout << "Channel " << channel.port << ": " << channel.packets << " packet(s), "
+                      << channel.duplicatePackets << " duplicate(s) (" << std::fixed << std::setprecision(2)
+                      << duplicateRate << "%), " << channel.gaps << " gap(s) of " << channel.gapMessages
+                      << " message(s): " << channel.gapMessages - channel.lostMessages
+                      << " filled by another line, " << channel.lostMessages << " lost in " << channel.lostGaps
+                      << " gap(s)\n" << std::defaultfloat;
+            for (const Line& line : channel.lines) {
+                std::cout << "  Line " << ((line.address >> 24) & 0xFF) << "." << ((line.address >> 16) & 0xFF)
+                          << "." << ((line.address >> 8) & 0xFF) << "." << (line.address & 0xFF) << ": "
+                          << line.packets << " packet(s), first for " << line.wins << "\n";
+            }
+        }
+    }
+};
+
+// Checkpoint Definition
+// Binary snapshot of everything replay builds up: every symbol's mapping,
+// scale, bar and book mode, every resting order in queue priority order,
+// and the next expected sequence number of every channel. The file is laid
+// out for mapping: a fixed header, then flat arrays of fixed-size records
+// at the offsets it gives. Restoring rebuilds the books from the order array
+// without logging anything, and the channel state makes the sequence tracker
+// drop any packet the checkpoint already covers.
+class Checkpoint {
+public:
+    static constexpr char kMagic[8] = {'O', 'B', 'C', 'K', 'P', 'T', '0', '1'};
+
+    struct Header {
+        char magic[8];
+        uint32_t headerSize;
+        uint32_t symbolSize;
+        uint32_t orderSize;
+        uint32_t channelSize;
+        uint64_t captureOffset;  // next unread record of the capture, 0 if unknown
+        uint64_t packets;        // packets consumed when the checkpoint was taken
+        uint64_t symbolCount;
+        uint64_t symbolsOffset;
+        uint64_t orderCount;
+        uint64_t ordersOffset;
+        uint64_t channelCount;
+        uint64_t channelsOffset;
+    };
+    struct Symbol {
+        uint32_t symbolIndex;
+        uint8_t mapped;
+        uint8_t hasBar;
+        uint8_t marketByPrice;
+        uint8_t reserved1;
+        uint64_t firstOrder;
+        uint64_t orderCount;
+        uint32_t barHigh;
+        uint32_t barLow;
+        uint32_t barPrevClose;
+        uint32_t reserved2;
+        uint64_t barVolume;
+        uint64_t barUpdates;
+        SymbolIndexMappingMessage mapping;
+    };
+    struct RestingOrder {
+        uint64_t orderID;
+        uint32_t price;
+        uint32_t volume;
+        char side;
+        char firmID[4];
+        uint8_t reserved[3];
+    };
+    struct Channel {
+        uint16_t port;
+        uint8_t reserved[6];
+        uint64_t expected;
+    };
+
+    struct Summary {
+        uint64_t symbols = 0;
+        uint64_t orders = 0;
+        uint64_t captureOffset = 0;
+        uint64_t packets = 0;
+    };
+
+    // Write to `path` by way of a temporary file, so a crash mid-write
+    // leaves the previous checkpoint in place
+    static bool write(const char* path, BookEngine& engine, const SequenceTracker& tracker,
+                      uint64_t captureOffset, uint64_t packets, Summary& summary) {
+        std::string temporary = std::string(path) + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            std::cerr << "Error opening checkpoint file: " << temporary << "\n";
+            return false;
+        }
+        std::vector<char> buffer(1 << 20);
+        std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.headerSize = sizeof(Header);
+        header.symbolSize = sizeof(Symbol);
+        header.orderSize = sizeof(RestingOrder);
+        header.channelSize = sizeof(Channel);
+        header.captureOffset = captureOffset;
+        header.packets = packets;
+        header.ordersOffset = sizeof(Header);
+        std::fwrite(&header, sizeof(header), 1, file);
+
+        // Orders go out as each book is walked; symbols and channels are
+        // small and follow them
+        std::vector<Symbol> symbols;
+        for (uint32_t symbolIndex = 0; symbolIndex < engine.symbolCapacity(); ++symbolIndex) {
+            SymbolTable& table = engine.shardOf(symbolIndex).symbolTable;
+            const SymbolHot* hot = table.find(symbolIndex);
+            if (hot == nullptr) {
+                continue;
+            }
+            const SymbolRef& ref = table.ref(symbolIndex);
+            Symbol symbol{};
+            symbol.symbolIndex = symbolIndex;
+            symbol.mapped = ref.mapped;
+            symbol.hasBar = hot->hasBar;
+            symbol.marketByPrice = hot->book->isMarketByPrice();
+            symbol.firstOrder = header.orderCount;
+            symbol.barHigh = hot->bar.high;
+            symbol.barLow = hot->bar.low;
+            symbol.barPrevClose = hot->bar.prev_close;
+            symbol.barVolume = hot->bar.volume;
+            symbol.barUpdates = hot->bar.update_count;
+            symbol.mapping = ref.mapping;
+            hot->book->forEachOrder([&](uint64_t orderID, char side, uint32_t price, uint32_t volume,
+                                        const char* firmID) {
+                RestingOrder order{};
+                order.orderID = orderID;
+                order.price = price;
+                order.volume = volume;
+                order.side = side;
+                std::memcpy(order.firmID, firmID, sizeof(order.firmID));
+                std::fwrite(&order, sizeof(order), 1, file);
+                symbol.orderCount++;
+            });
+            header.orderCount += symbol.orderCount;
+            symbols.push_back(symbol);
+        }
+        header.symbolCount = symbols.size();
+        header.symbolsOffset = header.ordersOffset + header.orderCount * sizeof(RestingOrder);
+        std::fwrite(symbols.data(), sizeof(Symbol), symbols.size(), file);
+
+        std::vector<Channel> channels;
+        tracker.forEachChannel([&](uint16_t port, uint64_t expected) {
+            Channel channel{};
+            channel.port = port;
+            channel.expected = expected;
+            channels.push_back(channel);
+        });
+        header.channelCount = channels.size();
+        header.channelsOffset = header.symbolsOffset + header.symbolCount * sizeof(Symbol);
+        std::fwrite(channels.data(), sizeof(Channel), channels.size(), file);
+
+        std::fseek(file, 0, SEEK_SET);
+        std::fwrite(&header, sizeof(header), 1, file);
+        bool ok = !std::ferror(file);
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path) != 0) {
+            std::cerr << "Error writing checkpoint file: " << path << "\n";
+            std::remove(temporary.c_str());
+            return false;
+        }
+        summary = Summary{header.symbolCount, header.orderCount, captureOffset, packets};
+        return true;
+    }
+
+    // Rebuild the books and channel state from `path`. Call before the book
+    // workers start.
+    static bool restore(const char* path, BookEngine& engine, SequenceTracker& tracker, Summary& summary) {
+        int fd = ::open(path, O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            std::cerr << "Error opening checkpoint file: " << path << "\n";
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Error mapping checkpoint file: " << path << "\n";
+            return false;
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        const uint8_t* base = static_cast<const uint8_t*>(mapping);
+
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        auto fits = [&](uint64_t offset, uint64_t count, uint64_t recordSize) {
+            return offset <= size && count <= (size - offset) / recordSize;
+        };
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.headerSize != sizeof(Header) ||
+            header.symbolSize != sizeof(Symbol) || header.orderSize != sizeof(RestingOrder) ||
+            header.channelSize != sizeof(Channel) || !fits(header.ordersOffset, header.orderCount, sizeof(RestingOrder)) ||
+            !fits(header.symbolsOffset, header.symbolCount, sizeof(Symbol)) ||
+            !fits(header.channelsOffset, header.channelCount, sizeof(Channel))) {
+            std::cerr << "Not a usable order book checkpoint: " << path << "\n";
+            munmap(mapping, size);
+            return false;
+        }
+
+        for (uint64_t i = 0; i < header.symbolCount; ++i) {
+            Symbol symbol;
+            std::memcpy(&symbol, base + header.symbolsOffset + i * sizeof(Symbol), sizeof(symbol));
+            if (symbol.firstOrder > header.orderCount || symbol.orderCount > header.orderCount - symbol.firstOrder) {
+                std::cerr << "Checkpoint symbol " << symbol.symbolIndex << " points past the order array\n";
+                munmap(mapping, size);
+                return false;
+            }
+            BookShard& shard = engine.shardOf(symbol.symbolIndex);
+            SymbolHot* hot = shard.symbolTable.symbolState(symbol.symbolIndex);
+            if (hot == nullptr) {
+                continue;
+            }
+            SymbolRef& ref = shard.symbolTable.ref(symbol.symbolIndex);
+            ref.mapped = symbol.mapped;
+            ref.mapping = symbol.mapping;
+            if (symbol.mapped) {
+                ref.name.assign(symbol.mapping.symbol, strnlen(symbol.mapping.symbol, sizeof(symbol.mapping.symbol) - 1));
+                hot->priceScaleCode = symbol.mapping.priceScaleCode;
+                hot->priceDivisor = std::pow(10, symbol.mapping.priceScaleCode);
+                hot->book->setTickSize(tickFromMPV(symbol.mapping.mpv, symbol.mapping.priceScaleCode));
+            }
+            hot->hasBar = symbol.hasBar;
+            hot->bar = {symbol.barHigh, symbol.barLow, symbol.barPrevClose, symbol.barVolume, symbol.barUpdates};
+            hot->book->setMarketByPrice(symbol.marketByPrice);
+
+            const uint8_t* orders = base + header.ordersOffset + symbol.firstOrder * sizeof(RestingOrder);
+            for (uint64_t j = 0; j < symbol.orderCount; ++j) {
+                RestingOrder order;
+                std::memcpy(&order, orders + j * sizeof(RestingOrder), sizeof(order));
+                char firmID[sizeof(order.firmID) + 1] = {};
+                std::memcpy(firmID, order.firmID, sizeof(order.firmID));
+                hot->book->restoreOrder(order.orderID, order.side, order.price, order.volume, firmID);
+            }
+            hot->book->rebuildDepth();
+        }
+        for (uint64_t i = 0; i < header.channelCount; ++i) {
+            Channel channel;
+            std::memcpy(&channel, base + header.channelsOffset + i * sizeof(Channel), sizeof(channel));
+            tracker.restoreChannel(channel.port, channel.expected);
+        }
+
+        summary = Summary{header.symbolCount, header.orderCount, header.captureOffset, header.packets};
+        munmap(mapping, size);
+        return true;
+    }
+};
+static_assert(sizeof(Checkpoint::Header) == 88, "Checkpoint header layout changed");
+static_assert(sizeof(Checkpoint::Symbol) == 96, "Checkpoint symbol layout changed");
+static_assert(sizeof(Checkpoint::RestingOrder) == 24, "Checkpoint order layout changed");
+static_assert(sizeof(Checkpoint::Channel) == 16, "Checkpoint channel layout changed");
+
+// Global variables
+Logger logger;
+MarketDataPublisher marketData;
+TopOfBookPublisher topOfBook;
+BookEngine bookEngine;
+SequenceTracker sequenceTracker;
+#ifdef ORDER_BOOK_LATENCY
+LatencyStats latencyStats;
+#endif
+
+// Publish Symbol Definition Function
+void publishSymbolDefinition(uint32_t symbolIndex, const SymbolRef& ref, const SymbolHot& symbol) {
+    MdSymbolDefinition definition{};
+    definition.symbolIndex = symbolIndex;
+    definition.prevClosePrice = ref.mapping.prevClosePrice;
+    std::memcpy(definition.symbol, ref.name.data(), std::min(ref.name.size(), sizeof(definition.symbol)));
+    definition.priceScaleCode = symbol.priceScaleCode;
+    definition.marketByPrice = symbol.book->isMarketByPrice();
+    marketData.publish(definition);
+}
+
+// Publish Top Of Book Function
+// Copy a symbol's visible levels into its shared-memory slot
+void publishTopOfBook(BookShard& shard, uint32_t symbolIndex, const SymbolHot& symbol, uint32_t sourceTimeNS,
+                      uint32_t symbolSeqNum) {
+    TobBook book{};
+    book.symbolSeqNum = symbolSeqNum;
+    book.sourceTimeNS = sourceTimeNS;
+    book.priceScaleCode = symbol.priceScaleCode;
+    const std::string& name = shard.symbolTable.name(symbolIndex);
+    std::memcpy(book.symbol, name.data(), std::min(name.size(), sizeof(book.symbol) - 1));
+    symbol.book->fillTopOfBook(book);
+    topOfBook.write(symbolIndex, book);
+}
+
+// Publish Snapshot Function
+// Definitions and every visible level of every book, and every shared-memory
+// top of book, so a consumer that starts from a restored process sees the
+// same state as the books
+void publishSnapshot(BookEngine& engine) {
+    for (uint32_t symbolIndex = 0; symbolIndex < engine.symbolCapacity(); ++symbolIndex) {
+        BookShard& shard = engine.shardOf(symbolIndex);
+        SymbolTable& table = shard.symbolTable;
+        const SymbolHot* symbol = table.find(symbolIndex);
+        if (symbol == nullptr) {
+            continue;
+        }
+        if (topOfBook.enabled()) {
+            publishTopOfBook(shard, symbolIndex, *symbol, 0, 0);
+        }
+        if (!marketData.enabled()) {
+            continue;
+        }
+        if (table.ref(symbolIndex).mapped) {
+            publishSymbolDefinition(symbolIndex, table.ref(symbolIndex), *symbol);
+        }
+        DepthUpdate levels = symbol->book->visibleLevels();
+        if (levels.changed()) {
+            symbol->book->publishUpdate(symbolIndex, 0, 0, levels);
+        }
+    }
+}
+
+// Print Tape Query Function
+void printTapeQuery(BookEngine& engine, const TapeQuery& query) {
+    for (uint32_t symbolIndex = 0; symbolIndex < engine.symbolCapacity(); ++symbolIndex) {
+        BookShard& shard = engine.shardOf(symbolIndex);
+        const SymbolHot* symbol = shard.symbolTable.find(symbolIndex);
+        if (symbol == nullptr || shard.symbolTable.name(symbolIndex) != query.symbol) {
+            continue;
+        }
+        const TradeTape* tape = shard.tapes.find(symbolIndex);
+        TradeTape::Totals totals = tape != nullptr ? tape->query(query.fromNS, query.toNS) : TradeTape::Totals();
+        std::cout << "Tape " << query.symbol << ": " << totals.trades << " trade(s), volume " << totals.volume
+                  << ", VWAP " << std::fixed << std::setprecision(4) << totals.vwap() / symbol->priceDivisor << "\n"
+                  << std::defaultfloat;
+        return;
+    }
+    std::cout << "Tape " << query.symbol << ": unknown symbol\n";
+}
+
+// Publish Bars Function
+void publishBars(const SymbolTable& symbols) {
+    for (uint32_t symbolIndex = 0; symbolIndex < symbols.size(); ++symbolIndex) {
+        const auto& symbol = symbols[symbolIndex];
+        const bar_t& bar = symbol.bar;
+        if (symbol.hasBar && bar.update_count > 0) {
+            MdBarClose close{};
+            close.volume = bar.volume;
+            close.updateCount = bar.update_count;
+            close.symbolIndex = symbolIndex;
+            close.high = bar.high;
+            close.low = bar.low;
+            close.prevClose = bar.prev_close;
+            marketData.publish(close);
+        }
+    }
+}
+
+// Publish Ohlcv Bar Function
+// Log a closed source-time bar and publish it as market data
+void publishOhlcvBar(const SymbolTable& symbols, uint32_t symbolIndex, uint64_t intervalNS,
+                     const BarEngine::Bar& bar, bool complete) {
+    uint8_t priceScaleCode = symbolIndex < symbols.size() ? symbols[symbolIndex].priceScaleCode : 0;
+    double vwap = bar.volume > 0 ? bar.notional / bar.volume : 0;
+    if (logger.enabled(LogLevel::Info)) {
+        logger.beginGroup();
+        logSymbolEvent(LogLevel::Info, LogEvent::OhlcvBar, symbolIndex, symbols.name(symbolIndex), bar.startNS,
+                       intervalNS, (static_cast<uint64_t>(bar.open) << 32) | bar.high,
+                       doubleBits(std::pow(10, priceScaleCode)));
+        logEvent(LogLevel::Info, LogEvent::OhlcvBarEnd, (static_cast<uint64_t>(bar.low) << 32) | bar.close,
+                 bar.volume, doubleBits(vwap),
+                 (static_cast<uint64_t>(bar.trades) << 9) | (complete ? 0x100u : 0u) | priceScaleCode);
+        logger.endGroup();
+    }
+    if (marketData.enabled()) {
+        MdOhlcvBar ohlcv{};
+        ohlcv.startNS = bar.startNS;
+        ohlcv.volume = bar.volume;
+        ohlcv.symbolIndex = symbolIndex;
+        ohlcv.intervalMS = static_cast<uint32_t>(intervalNS / 1000000);
+        ohlcv.open = bar.open;
+        ohlcv.high = bar.high;
+        ohlcv.low = bar.low;
+        ohlcv.close = bar.close;
+        ohlcv.vwap = static_cast<uint32_t>(std::lround(vwap));
+        ohlcv.trades = bar.trades;
+        marketData.publish(ohlcv);
+    }
+}
+
+// Publish Auction Update Function
+// Log an Imbalance message that changed anything and publish each field
+// that moved
+void publishAuctionUpdate(const SymbolTable& symbols, uint32_t symbolIndex, uint32_t symbolSeqNum,
+                          const AuctionState& state, uint32_t changed) {
+    if (logger.enabled(LogLevel::Info)) {
+        uint8_t priceScaleCode = symbolIndex < symbols.size() ? symbols[symbolIndex].priceScaleCode : 0;
+        logSymbolEvent(LogLevel::Info, LogEvent::AuctionUpdate, symbolIndex, symbols.name(symbolIndex),
+                       (static_cast<uint64_t>(state.pairedQty) << 32) | state.totalImbalanceQty,
+                       (static_cast<uint64_t>(state.indicativeMatchPrice) << 32) | state.referencePrice,
+                       (static_cast<uint64_t>(changed) << 16) | (static_cast<uint8_t>(state.imbalanceSide) << 8) |
+                           static_cast<uint8_t>(state.auctionType),
+                       doubleBits(std::pow(10, priceScaleCode)));
+    }
+    if (marketData.enabled()) {
+        MdAuctionUpdate update{};
+        update.symbolIndex = symbolIndex;
+        update.sourceTimeNS = state.sourceTimeNS;
+        update.symbolSeqNum = symbolSeqNum;
+        for (uint32_t fields = changed; fields != 0; fields &= fields - 1) {
+            update.field = static_cast<uint8_t>(__builtin_ctz(fields));
+            update.value = state.value(static_cast<AuctionField>(update.field));
+            marketData.publish(update);
+        }
+    }
+}
+
+// Print All Bars Function
+void printAllBars(const SymbolTable& symbols) {
+    if (marketData.enabled()) {
+        publishBars(symbols);
+    }
+    if (!logger.enabled(LogLevel::Info)) {
+        return;
+    }
+    bool printed = false;
+    logger.beginGroup();
+    logEvent(LogLevel::Info, LogEvent::BarsBegin);
+    for (uint32_t symbolIndex = 0; symbolIndex < symbols.size(); ++symbolIndex) {
+        const auto& symbol = symbols[symbolIndex];
+        const bar_t& bar = symbol.bar;
+        if (symbol.hasBar && bar.update_count > 0) {
+            logSymbolEvent(LogLevel::Info, LogEvent::Bar, symbolIndex, symbols.name(symbolIndex),
+                           (static_cast<uint64_t>(bar.high) << 32) | bar.low, bar.prev_close, bar.volume,
+                           doubleBits(symbol.priceDivisor));
+            printed = true;
+        }
+    }
+    if (!printed) {
+        logEvent(LogLevel::Info, LogEvent::BarsEmpty);
+    }
+    logEvent(LogLevel::Info, LogEvent::BarsEnd);
+    logger.endGroup();
+}
+
+// Publish Book Function
+// Print and publish a book after an update, or with conflation hold the
+// changed levels until the shard's next flush. The whole book is printed
+// again on a change of symbol only when not conflating.
+void publishBook(BookShard& shard, uint32_t symbolIndex, SymbolHot& symbol, uint32_t sourceTimeNS,
+                 uint32_t symbolSeqNum, bool symbolChanged, const DepthUpdate& update) {
+    if (shard.conflation.enabled()) {
+        if (update.changed()) {
+            shard.conflation.markDirty(symbolIndex, symbol, sourceTimeNS, symbolSeqNum, update);
+        }
+        return;
+    }
+    if (symbolChanged || update.changed()) {
+        symbol.book->printOrderBook(symbolIndex, shard.symbolTable.name(symbolIndex), symbol.priceDivisor, update);
+    }
+    if (update.changed() && marketData.enabled()) {
+        symbol.book->publishUpdate(symbolIndex, sourceTimeNS, symbolSeqNum, update);
+    }
+    if (update.changed() && topOfBook.enabled()) {
+        publishTopOfBook(shard, symbolIndex, symbol, sourceTimeNS, symbolSeqNum);
+    }
+}
+
+// Flush Conflated Function
+// Print and publish every book with held changes, once each
+void flushConflated(BookShard& shard) {
+    ConflationState& conflation = shard.conflation;
+    conflation.messagesSinceFlush = 0;
+    for (uint32_t symbolIndex : conflation.dirtySymbols) {
+        SymbolHot& symbol = *shard.symbolTable.find(symbolIndex);
+        DepthUpdate update;
+        update.bidLevels = symbol.pendingBidLevels;
+        update.askLevels = symbol.pendingAskLevels;
+        symbol.pendingBidLevels = 0;
+        symbol.pendingAskLevels = 0;
+        symbol.book->printOrderBook(symbolIndex, shard.symbolTable.name(symbolIndex), symbol.priceDivisor, update);
+        if (marketData.enabled()) {
+            symbol.book->publishUpdate(symbolIndex, symbol.pendingSourceTimeNS, symbol.pendingSymbolSeqNum, update);
+        }
+        if (topOfBook.enabled()) {
+            publishTopOfBook(shard, symbolIndex, symbol, symbol.pendingSourceTimeNS, symbol.pendingSymbolSeqNum);
+        }
+        conflation.publications++;
+    }
+    conflation.dirtySymbols.clear();
+}
+
+// Symbol Clear Order Function
+void symbolClear(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex) {
+    if (shard.auctions.enabled()) {
+        shard.auctions.clear(symbolIndex);
+    }
+    SymbolHot* symbol = shard.symbolTable.find(symbolIndex);
+    if (symbol != nullptr) {
+        DepthUpdate cleared = symbol->book->clearOrders();
+        if (shard.conflation.enabled() && cleared.changed()) {
+            shard.conflation.markDirty(symbolIndex, *symbol, sourceTimeNS, 0, cleared);
+        } else if (cleared.changed()) {
+            if (marketData.enabled()) {
+                symbol->book->publishUpdate(symbolIndex, sourceTimeNS, 0, cleared);
+            }
+            if (topOfBook.enabled()) {
+                publishTopOfBook(shard, symbolIndex, *symbol, sourceTimeNS, 0);
+            }
+        }
+
+        logSymbolEvent(LogLevel::Info, LogEvent::SymbolCleared, symbolIndex, shard.symbolTable.name(symbolIndex));
+    } else {
+        logSymbolEvent(LogLevel::Warning, LogEvent::NoBookForSymbol, symbolIndex, std::string());
+    }
+}
+
+// Add Order Function
+void addOrder(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
+              uint64_t orderID, uint32_t price, uint32_t volume, char side, 
+              const char* firmID) {
+    bool symbolChanged = (symbolIndex != shard.currentSymbolIndex);
+    if (symbolChanged) {
+        shard.currentSymbolIndex = symbolIndex;
+    }
+
+    SymbolHot* symbol = shard.symbolTable.symbolState(symbolIndex);
+    if (symbol == nullptr) {
+        return;
+    }
+    auto& orderBook = *symbol->book;
+
+    DepthUpdate update;
+    {
+        LATENCY_SCOPE(latencyStats.bookUpdate(orderBook.priceLevels()));
+        orderBook.addOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, price, volume, side, firmID, update, *symbol);
+    }
+
+    publishBook(shard, symbolIndex, *symbol, sourceTimeNS, symbolSeqNum, symbolChanged, update);
+}
+
+// Modify Order Function
+void modifyOrder(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
+                 uint64_t orderID, uint32_t price, uint32_t volume,
+                 uint8_t positionChange, char side) {
+    bool symbolChanged = (symbolIndex != shard.currentSymbolIndex);
+    if (symbolChanged) {
+        shard.currentSymbolIndex = symbolIndex;
+    }
+
+    SymbolHot* symbol = shard.symbolTable.symbolState(symbolIndex);
+    if (symbol == nullptr) {
+        return;
+    }
+    auto& orderBook = *symbol->book;
+
+    DepthUpdate update;
+    {
+        LATENCY_SCOPE(latencyStats.bookUpdate(orderBook.priceLevels()));
+        orderBook.modifyOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, price, volume, positionChange, side, update, *symbol);
+    }
+
+    publishBook(shard, symbolIndex, *symbol, sourceTimeNS, symbolSeqNum, symbolChanged, update);
+}
+
+// Order Execution Function
+void orderExecution(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum,
+                    uint64_t orderID, uint64_t tradeID, uint32_t price, uint32_t volume,
+                    uint8_t printableFlag, char tradeCond1, char tradeCond2, 
+                    char tradeCond3, char tradeCond4) {
+    bool symbolChanged = (symbolIndex != shard.currentSymbolIndex);
     if (symbolChanged) {
-        currentSymbolIndex = symbolIndex;
+        shard.currentSymbolIndex = symbolIndex;
+    }
+
+    SymbolHot* symbol = shard.symbolTable.symbolState(symbolIndex);
+    if (symbol == nullptr) {
+        return;
     }
+    auto& orderBook = *symbol->book;
+
+    DepthUpdate update;
+    {
+        LATENCY_SCOPE(latencyStats.bookUpdate(orderBook.priceLevels()));
+        orderBook.orderExecution(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, tradeID, 
+                                 price, volume, printableFlag, tradeCond1, tradeCond2, 
+                                 tradeCond3, tradeCond4, update);
+    }
+
+    publishBook(shard, symbolIndex, *symbol, sourceTimeNS, symbolSeqNum, symbolChanged, update);
+}
 
-    auto& orderBook = symbolOrderBooks[symbolIndex];
+// Replace Order Function
+void replaceOrder(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, 
+                  uint64_t oldOrderID, uint64_t newOrderID, uint32_t price, 
+                  uint32_t volume, char side) {
+    bool symbolChanged = (symbolIndex != shard.currentSymbolIndex);
+    if (symbolChanged) {
+        shard.currentSymbolIndex = symbolIndex;
+    }
 
-    bool top10Changed = false;
-    orderBook.replaceOrder(sourceTimeNS, symbolIndex, symbolSeqNum, oldOrderID, newOrderID, price, volume, side, top10Changed, symbolPriceScaleCodes, symbolBars);
+    SymbolHot* symbol = shard.symbolTable.symbolState(symbolIndex);
+    if (symbol == nullptr) {
+        return;
+    }
+    auto& orderBook = *symbol->book;
 
-    if (symbolChanged || top10Changed) {
-        orderBook.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
+    DepthUpdate update;
+    {
+        LATENCY_SCOPE(latencyStats.bookUpdate(orderBook.priceLevels()));
+        orderBook.replaceOrder(sourceTimeNS, symbolIndex, symbolSeqNum, oldOrderID, newOrderID, price, volume, side, update, *symbol);
     }
+
+    publishBook(shard, symbolIndex, *symbol, sourceTimeNS, symbolSeqNum, symbolChanged, update);
 }
 
 // Delete Order Function
-void deleteOrder(uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, uint64_t orderID) {
-    bool symbolChanged = (symbolIndex != currentSymbolIndex);
+void deleteOrder(BookShard& shard, uint32_t sourceTimeNS, uint32_t symbolIndex, uint32_t symbolSeqNum, uint64_t orderID) {
+    bool symbolChanged = (symbolIndex != shard.currentSymbolIndex);
     if (symbolChanged) {
-        currentSymbolIndex = symbolIndex;
+        shard.currentSymbolIndex = symbolIndex;
     }
     
-    auto& orderBook = symbolOrderBooks[symbolIndex];
-
-    bool top10Changed = false;
-    orderBook.deleteOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, top10Changed, symbolPriceScaleCodes, symbolBars);
+    SymbolHot* symbol = shard.symbolTable.symbolState(symbolIndex);
+    if (symbol == nullptr) {
+        return;
+    }
+    auto& orderBook = *symbol->book;
 
-    if (symbolChanged || top10Changed) {
-        orderBook.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
+    DepthUpdate update;
+    {
+        LATENCY_SCOPE(latencyStats.bookUpdate(orderBook.priceLevels()));
+        orderBook.deleteOrder(sourceTimeNS, symbolIndex, symbolSeqNum, orderID, update, *symbol);
     }
+
+    publishBook(shard, symbolIndex, *symbol, sourceTimeNS, symbolSeqNum, symbolChanged, update);
 }
 
 // Print Order Book Function
-void printOrderBook(uint32_t symbolIndex, const std::unordered_map<uint32_t, std::string>& symbolMappings) {
-    auto it = symbolOrderBooks.find(symbolIndex);
-    if (it != symbolOrderBooks.end()) {
-        auto symbolIt = symbolMappings.find(symbolIndex);
-        if (symbolIt != symbolMappings.end()) {
-            const std::string& symbol = symbolIt->second;
-            std::cout << "Order Book for Symbol: " << symbol << " (SymbolIndex: " << symbolIndex << ")\n";
-        } else {
-            std::cout << "Order Book for SymbolIndex: " << symbolIndex << " (Symbol not found in mappings)\n";
-        }
-        it->second.printOrderBook(symbolIndex, symbolMappings, symbolPriceScaleCodes);
+void printOrderBook(BookShard& shard, uint32_t symbolIndex) {
+    SymbolHot* symbol = shard.symbolTable.find(symbolIndex);
+    if (symbol != nullptr) {
+        const SymbolRef& ref = shard.symbolTable.ref(symbolIndex);
+        logSymbolEvent(LogLevel::Info, LogEvent::BookTitle, symbolIndex, ref.name, ref.mapped);
+        symbol->book->printOrderBook(symbolIndex, ref.name, symbol->priceDivisor);
     } else {
-        std::cerr << "Order book for SymbolIndex " << symbolIndex << " not found.\n";
+        logSymbolEvent(LogLevel::Warning, LogEvent::NoBookForSymbol, symbolIndex, std::string());
     }
 }
 
@@ -867,641 +5186,2499 @@ bool parseUDPHeader(const u_char* data, udp_hdr_t& udp_header) {
 }
 
 // Dispatcher function
-void handleMessage(uint16_t messageType, const uint8_t* buffer, size_t size) {
+// `size` is the message body length, i.e. MsgSize less the message header
+void handleMessage(BookShard& shard, uint16_t messageType, const uint8_t* buffer, size_t size) {
+    size_t wireSize = messageWireSize(messageType);
+    if (wireSize == 0) {
+        logEvent(LogLevel::Warning, LogEvent::UnknownMessage, messageType);
+        return;
+    }
+    if (size + sizeof(XDPMessageHeader) < wireSize) {
+        logEvent(LogLevel::Error, LogEvent::InvalidMessageSize, messageType,
+                 size + sizeof(XDPMessageHeader), wireSize);
+        return;
+    }
+    LATENCY_SCOPE(latencyStats.messages[messageType]);
+
     switch (messageType) {
         case MSG_TYPE_SEQUENCE_NUMBER_RESET: {
-            if (size < sizeof(SequenceNumberResetMessage)) {
-                std::cerr << "Invalid Sequence Number Reset Message size.\n";
-                return;
-            }
-            SequenceNumberResetMessage msg;
-            
-            std::memcpy(&msg.sourceTime, buffer, sizeof(msg.sourceTime));
-
-            std::memcpy(&msg.sourceTimeNS, buffer + 4, sizeof(msg.sourceTimeNS));
-
-            msg.productID = buffer[8];
-
-            msg.channelID = buffer[9];
-
-            std::cout << "Sequence Number Reset Message Processed.\n";
+            // The channel's sequence tracker was reset when parsePillarStream
+            // accepted the packet; the books themselves carry on unchanged
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_SEQUENCE_NUMBER_RESET);
             break;
         }
         case MSG_TYPE_SOURCE_TIME_REFERENCE: {
-            if (size < sizeof(SourceTimeReferenceMessage)) {
-                std::cerr << "Invalid Source Time Reference Message size.\n";
-                return;
-            }
-            SourceTimeReferenceMessage msg;
-            
-            std::memcpy(&msg.id, buffer, sizeof(msg.id));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 4, sizeof(msg.symbolSeqNum));
-
-            std::memcpy(&msg.sourceTime, buffer + 8, sizeof(msg.sourceTime));
-
-            std::cout << "Source Time Reference Message Processed.\n";
-
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_SOURCE_TIME_REFERENCE);
             break;
         }
         case MSG_TYPE_SYMBOL_INDEX_MAPPING: {
-            if (size < sizeof(SymbolIndexMappingMessage)) {
-                std::cerr << "Invalid Symbol Index Mapping Message size.\n";
+            const auto& msg = messageView<SymbolIndexMappingMessage>(buffer);
+
+            SymbolHot* symbol = shard.symbolTable.symbolState(msg.symbolIndex);
+            if (symbol == nullptr) {
                 return;
             }
-            SymbolIndexMappingMessage msg;
-            
-            std::memcpy(&msg.symbolIndex, buffer, sizeof(msg.symbolIndex));
-
-            std::memcpy(msg.symbol, buffer + 4, sizeof(msg.symbol));
-            msg.symbol[10] = '\0';
-
-            msg.reserved1 = buffer[15];
-
-            std::memcpy(&msg.marketID, buffer + 16, sizeof(msg.marketID));
-
-            msg.systemID = buffer[18];
 
-            msg.exchangeCode = static_cast<char>(buffer[19]);
-
-            msg.priceScaleCode = buffer[20];
-
-            msg.securityType = static_cast<char>(buffer[21]);
-
-            std::memcpy(&msg.lotSize, buffer + 22, sizeof(msg.lotSize));
-
-            std::memcpy(&msg.prevClosePrice, buffer + 24, sizeof(msg.prevClosePrice));
+            // Start the symbol's bar the first time it is mapped
+            if (!symbol->hasBar) {
+                symbol->bar = {0, UINT32_MAX, msg.prevClosePrice, 0, 0};
+                symbol->hasBar = true;
+            }
 
-            std::memcpy(&msg.prevCloseVolume, buffer + 28, sizeof(msg.prevCloseVolume));
+            // Update reference data and the precomputed price scale
+            SymbolRef& ref = shard.symbolTable.ref(msg.symbolIndex);
+            if (!ref.mapped) {
+                ref.name.assign(msg.symbol, strnlen(msg.symbol, sizeof(msg.symbol) - 1));
+                ref.mapped = true;
+                if (shard.symbolTable.isMarketByPrice(ref.name)) {
+                    symbol->book->setMarketByPrice(true);
+                }
+            }
+            ref.mapping = msg;
+            symbol->priceScaleCode = msg.priceScaleCode;
+            symbol->priceDivisor = std::pow(10, msg.priceScaleCode);
+            symbol->book->setTickSize(tickFromMPV(msg.mpv, msg.priceScaleCode));
+            if (marketData.enabled()) {
+                publishSymbolDefinition(msg.symbolIndex, ref, *symbol);
+            }
+            if (topOfBook.enabled()) {
+                publishTopOfBook(shard, msg.symbolIndex, *symbol, 0, 0);
+            }
 
-            msg.priceResolution = buffer[32];
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_SYMBOL_INDEX_MAPPING);
+            break;
+        }
+        case MSG_TYPE_SYMBOL_CLEAR: {
+            const auto& msg = messageView<SymbolClearMessage>(buffer);
 
-            msg.roundLot = static_cast<char>(buffer[33]);
+            symbolClear(shard, msg.sourceTimeNS, msg.symbolIndex);
+            break;
+        }
+        case MSG_TYPE_SECURITY_STATUS: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_SECURITY_STATUS);
+            break;
+        }
+        case MSG_TYPE_ADD_ORDER: {
+            const auto& msg = messageView<AddOrderMessage>(buffer);
 
-            std::memcpy(&msg.mpv, buffer + 34, sizeof(msg.mpv));
+            addOrder(shard, msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.price, msg.volume, msg.side, msg.firmID);
+            break;
+        }
+        case MSG_TYPE_MODIFY_ORDER: {
+            const auto& msg = messageView<ModifyOrderMessage>(buffer);
 
-            std::memcpy(&msg.unitOfTrade, buffer + 36, sizeof(msg.unitOfTrade));
+            modifyOrder(shard, msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.price, msg.volume, msg.positionChange, msg.side);
+            break;
+        }
+        case MSG_TYPE_DELETE_ORDER: {
+            const auto& msg = messageView<DeleteOrderMessage>(buffer);
 
-            std::memcpy(&msg.reserved2, buffer + 38, sizeof(msg.reserved2));
+            deleteOrder(shard, msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID);
+            break;
+        }
+        case MSG_TYPE_ORDER_EXECUTION: {
+            const auto& msg = messageView<OrderExecutionMessage>(buffer);
 
-            // Check if the symbolIndex exists in the bar map, and add it if it doesn't
-            if (symbolBars.find(msg.symbolIndex) == symbolBars.end()) {
-                bar_t newBar = {0.0, std::numeric_limits<double>::max(), 0.0, 0, 0};
-                newBar.prev_close = static_cast<double>(msg.prevClosePrice) / std::pow(10, msg.priceScaleCode);
-                symbolBars[msg.symbolIndex] = newBar;
+            orderExecution(shard, msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.tradeID, msg.price, msg.volume, msg.printableFlag, msg.tradeCond1, msg.tradeCond2, msg.tradeCond3, msg.tradeCond4);
+            if (shard.bars.enabled() && msg.printableFlag == 1) {
+                shard.bars.trade(msg.symbolIndex, msg.price, msg.volume);
             }
-
-            // Update symbol mappings and price scale codes
-            if (symbolMappings.find(msg.symbolIndex) == symbolMappings.end()) {
-                symbolMappings[msg.symbolIndex] = msg.symbol;
+            if (shard.tapes.enabled()) {
+                shard.tapes.of(msg.symbolIndex).append(shard.sourceTimeNS, msg.price, msg.volume, msg.tradeID, 'E',
+                                                       {msg.tradeCond1, msg.tradeCond2, msg.tradeCond3, msg.tradeCond4},
+                                                       msg.printableFlag == 1);
             }
-            symbolPriceScaleCodes[msg.symbolIndex] = msg.priceScaleCode;
+            break;
+        }
+        case MSG_TYPE_REPLACE_ORDER: {
+            const auto& msg = messageView<ReplaceOrderMessage>(buffer);
 
-            std::cout << "Symbol Index Mapping Message Processed.\n";
+            replaceOrder(shard, msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, 
+                         msg.orderID, msg.newOrderID, msg.price, msg.volume, 
+                         msg.side);
             break;
         }
-        case MSG_TYPE_SYMBOL_CLEAR: {
-            if (size < sizeof(SymbolClearMessage)) {
-                std::cerr << "Invalid Symbol Clear Message size.\n";
-                return;
+        case MSG_TYPE_IMBALANCE: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_IMBALANCE);
+            if (shard.auctions.enabled()) {
+                const auto& msg = messageView<ImbalanceMessage>(buffer);
+                uint32_t changed = shard.auctions.update(msg);
+                if (changed != 0) {
+                    publishAuctionUpdate(shard.symbolTable, msg.symbolIndex, msg.symbolSeqNum,
+                                         shard.auctions[msg.symbolIndex], changed);
+                }
             }
-            SymbolClearMessage msg;
-            
-            std::memcpy(&msg.sourceTime, buffer, sizeof(msg.sourceTime));
-
-            std::memcpy(&msg.sourceTimeNS, buffer + 4, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 8, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.nextSourceSeqNum, buffer + 12, sizeof(msg.nextSourceSeqNum));
-
-            symbolClear(msg.symbolIndex, symbolMappings);
             break;
         }
-        case MSG_TYPE_SECURITY_STATUS: {
-            if (size < sizeof(SecurityStatusMessage)) {
-                std::cerr << "Invalid Security Status Message size.\n";
-                return;
+        case MSG_TYPE_ADD_ORDER_REFRESH: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_ADD_ORDER_REFRESH);
+            break;
+        }
+        case MSG_TYPE_NON_DISPLAYED_TRADE: {
+            const auto& msg = messageView<NonDisplayedTradeMessage>(buffer);
+            bool known = shard.symbolTable.find(msg.symbolIndex) != nullptr;
+            if (shard.bars.enabled() && msg.printableFlag == 1 && known) {
+                shard.bars.trade(msg.symbolIndex, msg.price, msg.volume);
             }
-            SecurityStatusMessage msg;
-            
-            std::memcpy(&msg.sourceTime, buffer, sizeof(msg.sourceTime));
-
-            std::memcpy(&msg.sourceTimeNS, buffer + 4, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 8, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 12, sizeof(msg.symbolSeqNum));
-
-            msg.securityStatus = static_cast<char>(buffer[16]);
-
-            msg.haltCondition = static_cast<char>(buffer[17]);
-
-            std::memcpy(&msg.reserved, buffer + 18, sizeof(msg.reserved));
-
-            std::memcpy(&msg.price1, buffer + 22, sizeof(msg.price1));
-
-            std::memcpy(&msg.price2, buffer + 26, sizeof(msg.price2));
-
-            msg.ssrTriggeringExchangeID = static_cast<char>(buffer[30]);
-
-            std::memcpy(&msg.ssrTriggeringVolume, buffer + 31, sizeof(msg.ssrTriggeringVolume));
-
-            std::memcpy(&msg.time, buffer + 35, sizeof(msg.time));
-
-            msg.ssrState = static_cast<char>(buffer[39]);
-
-            msg.marketState = static_cast<char>(buffer[40]);
-
-            msg.sessionState = static_cast<char>(buffer[41]);
-
-            std::cout << "Security Status Message Processed.\n";
+            if (shard.tapes.enabled() && known) {
+                shard.tapes.of(msg.symbolIndex).append(shard.sourceTimeNS, msg.price, msg.volume, msg.tradeID, 'N',
+                                                       {msg.tradeCond1, msg.tradeCond2, msg.tradeCond3, msg.tradeCond4},
+                                                       msg.printableFlag == 1);
+            }
+            if (marketData.enabled()) {
+                MdTrade trade{};
+                trade.tradeID = msg.tradeID;
+                trade.symbolIndex = msg.symbolIndex;
+                trade.sourceTimeNS = msg.sourceTimeNS;
+                trade.symbolSeqNum = msg.symbolSeqNum;
+                trade.price = msg.price;
+                trade.volume = msg.volume;
+                trade.tradeType = 'N';
+                trade.side = ' ';
+                trade.printableFlag = msg.printableFlag;
+                trade.tradeConditions[0] = msg.tradeCond1;
+                trade.tradeConditions[1] = msg.tradeCond2;
+                trade.tradeConditions[2] = msg.tradeCond3;
+                trade.tradeConditions[3] = msg.tradeCond4;
+                marketData.publish(trade);
+            }
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_NON_DISPLAYED_TRADE);
             break;
         }
-        case MSG_TYPE_ADD_ORDER: {
-            if (size < sizeof(AddOrderMessage)) {
-                std::cerr << "Invalid Add Order Message size.\n";
-                return;
+        case MSG_TYPE_CROSS_TRADE: {
+            const auto& msg = messageView<CrossTradeMessage>(buffer);
+            bool known = shard.symbolTable.find(msg.symbolIndex) != nullptr;
+            if (shard.bars.enabled() && known) {
+                shard.bars.trade(msg.symbolIndex, msg.price, msg.volume);
             }
-            AddOrderMessage msg;
-
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
-
-            std::memcpy(&msg.orderID, buffer + 12, sizeof(msg.orderID));
-
-            std::memcpy(&msg.price, buffer + 20, sizeof(msg.price));
-
-            std::memcpy(&msg.volume, buffer + 24, sizeof(msg.volume));
-
-            msg.side = static_cast<char>(buffer[28]);
-
-            std::memcpy(msg.firmID, buffer + 29, sizeof(msg.firmID));
-            msg.firmID[4] = '\0';
-
-            msg.reserved1 = buffer[34];
-
-            addOrder(msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.price, msg.volume, msg.side, msg.firmID);
+            if (shard.tapes.enabled() && known) {
+                shard.tapes.of(msg.symbolIndex).append(shard.sourceTimeNS, msg.price, msg.volume, msg.crossID, 'X',
+                                                       {msg.crossType, ' ', ' ', ' '}, true);
+            }
+            if (marketData.enabled()) {
+                MdTrade trade{};
+                trade.tradeID = msg.crossID;
+                trade.symbolIndex = msg.symbolIndex;
+                trade.sourceTimeNS = msg.sourceTimeNS;
+                trade.symbolSeqNum = msg.symbolSeqNum;
+                trade.price = msg.price;
+                trade.volume = msg.volume;
+                trade.tradeType = 'X';
+                trade.side = ' ';
+                trade.printableFlag = 1;
+                trade.tradeConditions[0] = msg.crossType;
+                marketData.publish(trade);
+            }
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_CROSS_TRADE);
             break;
         }
-        case MSG_TYPE_MODIFY_ORDER: {
-            if (size < sizeof(ModifyOrderMessage)) {
-                std::cerr << "Invalid Modify Order Message size.\n";
-                return;
+        case MSG_TYPE_TRADE_CANCEL: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_TRADE_CANCEL);
+            if (shard.tapes.enabled()) {
+                const auto& msg = messageView<TradeCancelMessage>(buffer);
+                shard.tapes.cancel(msg.symbolIndex, msg.tradeID);
             }
-            ModifyOrderMessage msg;
-
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
-
-            std::memcpy(&msg.orderID, buffer + 12, sizeof(msg.orderID));
-
-            std::memcpy(&msg.price, buffer + 20, sizeof(msg.price));
-
-            std::memcpy(&msg.volume, buffer + 24, sizeof(msg.volume));
-
-            msg.positionChange = buffer[28];
-
-            msg.side = static_cast<char>(buffer[29]);
-
-            msg.reserved2 = buffer[30];
-
-            modifyOrder(msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.price, msg.volume, msg.positionChange, msg.side);
             break;
         }
-        case MSG_TYPE_DELETE_ORDER: {
-            if (size < sizeof(DeleteOrderMessage)) {
-                std::cerr << "Invalid Delete Order Message size.\n";
-                return;
+        case MSG_TYPE_CROSS_CORRECTION: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_CROSS_CORRECTION);
+            if (shard.tapes.enabled()) {
+                const auto& msg = messageView<CrossCorrectionMessage>(buffer);
+                shard.tapes.correct(msg.symbolIndex, msg.crossID, msg.volume);
             }
-            DeleteOrderMessage msg;
-            
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+            break;
+        }
+        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT: {
+            logEvent(LogLevel::Debug, LogEvent::MessageProcessed, MSG_TYPE_RETAIL_PRICE_IMPROVEMENT);
+            break;
+        }
+    }
+}
 
-            std::memcpy(&msg.orderID, buffer + 12, sizeof(msg.orderID));
+// Pillar Messages Function
+// Dispatch the messages of one validated Pillar packet to the books, leaving
+// out the first `skip`, which another packet already delivered
+void dispatchPillarMessages(const uint8_t* data, uint16_t length, uint8_t skip) {
+    // Start parsing messages
+    uint8_t numberOfMessages = *(data + 3);
+    const uint8_t* messagePtr = data + 16;
+    uint16_t bytesProcessed = 16;
 
-            msg.reserved1 = buffer[20];
+    for (uint8_t i = 0; i < numberOfMessages; ++i) {
+        if ((bytesProcessed + 4) > length) {
+            logEvent(LogLevel::Error, LogEvent::MessageHeaderTooShort);
+            break;
+        }
 
-            deleteOrder(msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID);
+        // Parse Message Header
+        const auto& header = messageView<XDPMessageHeader>(messagePtr);
+        uint16_t msgSize = header.msg_size;
+        if (msgSize < sizeof(XDPMessageHeader) || bytesProcessed + msgSize > length) {
+            logEvent(LogLevel::Error, LogEvent::InvalidMessageHeader, msgSize);
             break;
         }
-        case MSG_TYPE_ORDER_EXECUTION: {
-            if (size < sizeof(OrderExecutionMessage)) {
-                std::cerr << "Invalid Order Execution Message size.\n";
-                return;
-            }
-            OrderExecutionMessage msg;
 
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
+        // Pass message data for further processing
+        if (i >= skip) {
+            bookEngine.dispatch(header.msg_type, messagePtr, msgSize);
+        }
+
+        // Advance to the next message
+        bytesProcessed += msgSize;
+        messagePtr += msgSize;
+    }
+}
+
+// Pillar Send Time Function
+// A packet header's SendTime (seconds) and SendTimeNS as one nanosecond count
+uint64_t pillarSendTimeNS(const uint8_t* data) {
+    uint32_t seconds;
+    uint32_t nanoseconds;
+    std::memcpy(&seconds, data + 8, sizeof(seconds));
+    std::memcpy(&nanoseconds, data + 12, sizeof(nanoseconds));
+    return seconds * 1000000000ull + nanoseconds;
+}
 
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+void parsePillarStream(const uint8_t* data, uint16_t length, const PacketSource& source) {
+    LATENCY_SCOPE(latencyStats.pillarStream);
+    if (length < 16) {
+        logEvent(LogLevel::Error, LogEvent::PacketTooShort);
+        return;
+    }
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+    // Parse Packet Header
+    uint16_t pktSize;
+    uint8_t deliveryFlag;
+    uint8_t numberOfMessages;
+    uint32_t sequenceNumber;
 
-            std::memcpy(&msg.orderID, buffer + 12, sizeof(msg.orderID));
+    std::memcpy(&pktSize, data, sizeof(pktSize));
+    deliveryFlag = *(data + 2);
+    numberOfMessages = *(data + 3);
+    std::memcpy(&sequenceNumber, data + 4, sizeof(sequenceNumber));
 
-            std::memcpy(&msg.tradeID, buffer + 20, sizeof(msg.tradeID));
+    // Validate packet size
+    if (pktSize != length) {
+        logEvent(LogLevel::Error, LogEvent::PacketSizeMismatch, pktSize, length);
+        return;
+    }
 
-            std::memcpy(&msg.price, buffer + 28, sizeof(msg.price));
+    // Drop whatever the other line already delivered; packets past a gap
+    // reach the books once it is filled or given up. A Sequence Number Reset
+    // message leads the packet that restarts a channel's numbering, and the
+    // tracker has to see it before the lower numbers read as duplicates.
+    uint64_t sendTimeNS = pillarSendTimeNS(data);
+    bool reset = deliveryFlag == SequenceTracker::kDeliverySequenceReset;
+    if (numberOfMessages > 0 && length >= 16 + sizeof(XDPMessageHeader)) {
+        reset = reset || messageView<XDPMessageHeader>(data + 16).msg_type == MSG_TYPE_SEQUENCE_NUMBER_RESET;
+    }
+    sequenceTracker.accept(source, sequenceNumber, numberOfMessages, sendTimeNS, reset, data, length,
+                           dispatchPillarMessages);
+}
 
-            std::memcpy(&msg.volume, buffer + 32, sizeof(msg.volume));
+// Pillar Payload Function
+// Parse one captured Ethernet frame down to its Pillar payload. Frames that
+// are not IPv4/UDP or are cut short are logged and rejected.
+bool pillarPayload(const uint8_t* data, uint32_t capturedLength,
+                   const uint8_t*& payload, uint16_t& payloadLength, PacketSource& source) {
+    // Parse Ethernet Header
+    mac_hdr_t eth_header;
+    if (capturedLength < sizeof(mac_hdr_t) || !parseEthernetHeader(data, eth_header)) {
+        logEvent(LogLevel::Error, LogEvent::EthernetError);
+        return false;
+    }
 
-            msg.printableFlag = buffer[36];
+    // Handle only IPv4 packets
+    if (eth_header.ethertype != static_cast<uint16_t>(ethertype_e::ipv4)) {
+        logEvent(LogLevel::Warning, LogEvent::NonIPv4Packet);
+        return false;
+    }
 
-            msg.tradeCond1 = buffer[37];
-            
-            msg.tradeCond2 = buffer[38];
-            
-            msg.tradeCond3 = buffer[39];
-            
-            msg.tradeCond4 = buffer[40];
+    // Parse IPv4 Header
+    if (capturedLength < sizeof(mac_hdr_t) + sizeof(ipv4_hdr_t)) {
+        logEvent(LogLevel::Error, LogEvent::IPv4Error);
+        return false;
+    }
+    ipv4_hdr_t ipv4_header;
+    if (!parseIPv4Header(data + sizeof(mac_hdr_t), ipv4_header)) {
+        logEvent(LogLevel::Error, LogEvent::IPv4Error);
+        return false;
+    }
 
-            orderExecution(msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, msg.orderID, msg.tradeID, msg.price, msg.volume, msg.printableFlag, msg.tradeCond1, msg.tradeCond2, msg.tradeCond3, msg.tradeCond4);
-            break;
-        }
-        case MSG_TYPE_REPLACE_ORDER: {
-            if (size < sizeof(ReplaceOrderMessage)) {
-                std::cerr << "Invalid Replace Order Message size.\n";
-                return;
-            }
-            ReplaceOrderMessage msg;
-            
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
+    // Handle only UDP packets
+    if (ipv4_header.protocol != 17) { // Protocol 17 = UDP
+        logEvent(LogLevel::Warning, LogEvent::NonUDPPacket);
+        return false;
+    }
 
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+    // Calculate IPv4 Header Length (IHL * 4)
+    uint8_t ipv4_header_length = (ipv4_header.version_ihl & 0x0F) * 4;
+    if (ipv4_header_length < sizeof(ipv4_hdr_t) ||
+        capturedLength < sizeof(mac_hdr_t) + ipv4_header_length + sizeof(udp_hdr_t)) {
+        logEvent(LogLevel::Error, LogEvent::UDPError);
+        return false;
+    }
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+    // Parse UDP Header
+    udp_hdr_t udp_header;
+    if (!parseUDPHeader(data + sizeof(mac_hdr_t) + ipv4_header_length, udp_header)) {
+        logEvent(LogLevel::Error, LogEvent::UDPError);
+        return false;
+    }
+    
+    // Extract UDP Payload
+    uint32_t udpPayloadOffset = sizeof(mac_hdr_t) + ipv4_header_length + sizeof(udp_hdr_t);
+    if (udp_header.length < sizeof(udp_hdr_t)) {
+        logEvent(LogLevel::Error, LogEvent::UDPError);
+        return false;
+    }
+    uint16_t udpPayloadLength = udp_header.length - sizeof(udp_hdr_t);
 
-            std::memcpy(&msg.orderID, buffer + 12, sizeof(msg.orderID));
+    if (udpPayloadOffset + udpPayloadLength > capturedLength) {
+        logEvent(LogLevel::Error, LogEvent::PayloadTooLong);
+        return false;
+    }
 
-            std::memcpy(&msg.newOrderID, buffer + 20, sizeof(msg.newOrderID));
+    payload = data + udpPayloadOffset;
+    payloadLength = udpPayloadLength;
+    source.line = ipv4_header.dest_ip;
+    source.channel = udp_header.dest_port;
+    return true;
+}
 
-            std::memcpy(&msg.price, buffer + 28, sizeof(msg.price));
+// Process Packet Function
+void processPacket(const uint8_t* data, uint32_t capturedLength) {
+    const uint8_t* pillarData;
+    uint16_t pillarLength;
+    PacketSource source;
+    if (pillarPayload(data, capturedLength, pillarData, pillarLength, source)) {
+        parsePillarStream(pillarData, pillarLength, source);
+    }
+}
 
-            std::memcpy(&msg.volume, buffer + 32, sizeof(msg.volume));
+// Capture File Definition
+// Reads classic pcap (microsecond or nanosecond timestamps, either byte
+// order) and pcapng straight out of a read-only mapping of the file.
+// Packets are handed out as pointers into the mapping, so nothing is
+// copied and there is no call into a library per packet.
+class CaptureFile {
+public:
+    struct Packet {
+        const uint8_t* data;
+        uint32_t capturedLength;
+        uint32_t length;
+        uint64_t timestampNS;
+    };
 
-            msg.side = static_cast<char>(buffer[36]);
+private:
+    static constexpr uint32_t kPcapMagicMicros = 0xA1B2C3D4;
+    static constexpr uint32_t kPcapMagicNanos = 0xA1B23C4D;
+    static constexpr uint32_t kPcapNgSectionHeader = 0x0A0D0D0A;
+    static constexpr uint32_t kPcapNgByteOrderMagic = 0x1A2B3C4D;
+    static constexpr uint32_t kPcapNgInterface = 1;
+    static constexpr uint32_t kPcapNgSimplePacket = 3;
+    static constexpr uint32_t kPcapNgEnhancedPacket = 6;
+
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    bool pcapNg = false;
+    bool swapped = false;
+    bool truncatedFile = false;
+    uint64_t pcapTickNS = 1000;
+    // Timestamp units per second of each interface in the current pcapng section
+    std::vector<uint64_t> interfaceUnits;
+
+    uint16_t read16(const uint8_t* p) const {
+        uint16_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return swapped ? __builtin_bswap16(value) : value;
+    }
+    uint32_t read32(const uint8_t* p) const {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return swapped ? __builtin_bswap32(value) : value;
+    }
 
-            msg.reserved2 = buffer[37];
+    bool nextPcap(Packet& packet) {
+        if (offset + 16 > size) {
+            truncatedFile = offset != size;
+            return false;
+        }
+        const uint8_t* record = base + offset;
+        uint32_t capturedLength = read32(record + 8);
+        if (offset + 16 + capturedLength > size) {
+            truncatedFile = true;
+            return false;
+        }
+        packet.data = record + 16;
+        packet.capturedLength = capturedLength;
+        packet.length = read32(record + 12);
+        packet.timestampNS = read32(record) * 1000000000ull + read32(record + 4) * pcapTickNS;
+        offset += 16 + capturedLength;
+        return true;
+    }
 
-            replaceOrder(msg.sourceTimeNS, msg.symbolIndex, msg.symbolSeqNum, 
-                         msg.orderID, msg.newOrderID, msg.price, msg.volume, 
-                         msg.side, symbolMappings);
-            break;
+    // Record the timestamp resolution of an Interface Description Block
+    void addInterface(const uint8_t* body, size_t length) {
+        uint64_t units = 1000000;
+        for (size_t pos = 8; pos + 4 <= length;) {
+            uint16_t code = read16(body + pos);
+            uint16_t optionLength = read16(body + pos + 2);
+            if (code == 0 || pos + 4 + optionLength > length) {
+                break;
+            }
+            if (code == 9 && optionLength >= 1) {  // if_tsresol
+                uint8_t resolution = body[pos + 4];
+                uint8_t exponent = resolution & 0x7F;
+                if (resolution & 0x80) {
+                    units = exponent < 64 ? (1ull << exponent) : units;
+                } else if (exponent <= 18) {
+                    units = 1;
+                    for (uint8_t i = 0; i < exponent; ++i) {
+                        units *= 10;
+                    }
+                }
+            }
+            pos += 4 + ((optionLength + 3u) & ~3u);
         }
-        case MSG_TYPE_IMBALANCE: {
-            if (size < sizeof(ImbalanceMessage)) {
-                std::cerr << "Invalid Imbalance Message size.\n";
-                return;
+        interfaceUnits.push_back(units);
+    }
+
+    bool nextPcapNg(Packet& packet) {
+        while (offset + 12 <= size) {
+            const uint8_t* block = base + offset;
+            uint32_t type = read32(block);
+            if (type == kPcapNgSectionHeader) {
+                uint32_t magic;
+                std::memcpy(&magic, block + 8, sizeof(magic));
+                swapped = (magic != kPcapNgByteOrderMagic);
+                interfaceUnits.clear();
             }
-            ImbalanceMessage msg;
-            
-            std::memcpy(&msg.sourceTime, buffer, sizeof(msg.sourceTime));
+            uint32_t blockLength = read32(block + 4);
+            if (blockLength < 12 || (blockLength & 3) != 0 || offset + blockLength > size) {
+                truncatedFile = true;
+                return false;
+            }
+            const uint8_t* body = block + 8;
+            size_t bodyLength = blockLength - 12;
+            offset += blockLength;
+
+            if (type == kPcapNgInterface) {
+                addInterface(body, bodyLength);
+            } else if (type == kPcapNgEnhancedPacket && bodyLength >= 20) {
+                uint32_t interfaceID = read32(body);
+                uint32_t capturedLength = read32(body + 12);
+                if (20 + capturedLength > bodyLength) {
+                    truncatedFile = true;
+                    return false;
+                }
+                uint64_t stamp = (static_cast<uint64_t>(read32(body + 4)) << 32) | read32(body + 8);
+                uint64_t units = interfaceID < interfaceUnits.size() ? interfaceUnits[interfaceID] : 1000000;
+                packet.data = body + 20;
+                packet.capturedLength = capturedLength;
+                packet.length = read32(body + 16);
+                packet.timestampNS = stamp / units * 1000000000ull + stamp % units * 1000000000ull / units;
+                return true;
+            } else if (type == kPcapNgSimplePacket && bodyLength >= 4) {
+                uint32_t length = read32(body);
+                packet.data = body + 4;
+                packet.capturedLength = std::min<uint32_t>(length, bodyLength - 4);
+                packet.length = length;
+                packet.timestampNS = 0;
+                return true;
+            }
+        }
+        truncatedFile = offset != size;
+        return false;
+    }
 
-            std::memcpy(&msg.sourceTimeNS, buffer + 4, sizeof(msg.sourceTimeNS));
+public:
+    CaptureFile() = default;
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+    ~CaptureFile() {
+        if (base != nullptr) {
+            munmap(const_cast<uint8_t*>(base), size);
+        }
+    }
 
-            std::memcpy(&msg.symbolIndex, buffer + 8, sizeof(msg.symbolIndex));
+    // Map `path` and check its header. Returns false for anything this reader
+    // cannot walk in place (pipes, unknown formats), so the caller can fall
+    // back to libpcap.
+    bool open(const char* path, bool hugePages) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < 24) {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const uint8_t*>(mapping);
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 12, sizeof(msg.symbolSeqNum));
+        // Hints only: read ahead aggressively and drop pages behind us
+        madvise(mapping, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        if (hugePages) {
+            madvise(mapping, size, MADV_HUGEPAGE);
+        }
+#endif
+
+        uint32_t magic;
+        std::memcpy(&magic, base, sizeof(magic));
+        if (magic == kPcapMagicMicros || magic == kPcapMagicNanos) {
+            swapped = false;
+        } else if (__builtin_bswap32(magic) == kPcapMagicMicros || __builtin_bswap32(magic) == kPcapMagicNanos) {
+            swapped = true;
+            magic = __builtin_bswap32(magic);
+        } else if (magic == kPcapNgSectionHeader) {
+            pcapNg = true;
+            return true;
+        } else {
+            return false;
+        }
+        pcapTickNS = (magic == kPcapMagicNanos) ? 1 : 1000;
+        offset = 24;
+        return true;
+    }
 
-            std::memcpy(&msg.referencePrice, buffer + 16, sizeof(msg.referencePrice));
+    bool next(Packet& packet) {
+        LATENCY_SCOPE(latencyStats.packetRead);
+        return pcapNg ? nextPcapNg(packet) : nextPcap(packet);
+    }
+    // Offset of the next record, for resuming with skipTo
+    size_t position() const {
+        return offset;
+    }
+    // Pass over records without handing them out until `target`; false if
+    // no record starts there
+    bool skipTo(size_t target) {
+        Packet packet;
+        while (offset < target && (pcapNg ? nextPcapNg(packet) : nextPcap(packet))) {
+        }
+        return offset == target;
+    }
+    // True if the walk stopped on a record running past the end of the file
+    bool truncated() const {
+        return truncatedFile;
+    }
+};
 
-            std::memcpy(&msg.pairedQty, buffer + 20, sizeof(msg.pairedQty));
+// Capture Reader Definition
+// Walks one mapped capture on its own thread for a multi-file replay. The
+// thread pages the file in, strips each frame down to its Pillar payload and
+// queues a pointer to it, tagged with the packet's sendTime, for the merge.
+// Payloads stay in the mapping, so the reader must outlive the merge.
+class CaptureReader {
+public:
+    struct Payload {
+        const uint8_t* data;
+        uint16_t length;
+        uint64_t sendTimeNS;
+        PacketSource source;
+    };
 
-            std::memcpy(&msg.totalImbalanceQty, buffer + 24, sizeof(msg.totalImbalanceQty));
+private:
+    CaptureFile capture;
+    SpscRing<Payload, 1 << 14> ring;
+    std::thread thread;
+    std::atomic<bool> done{false};
+    uint64_t stalls = 0;
+
+    void run() {
+        CaptureFile::Packet packet;
+        uint64_t sendTimeNS = 0;
+        while (capture.next(packet)) {
+            Payload payload;
+            if (!pillarPayload(packet.data, packet.capturedLength, payload.data, payload.length, payload.source)) {
+                continue;
+            }
+            // Packets too short to carry a sendTime keep their place in the file
+            if (payload.length >= 16) {
+                sendTimeNS = pillarSendTimeNS(payload.data);
+            }
+            payload.sendTimeNS = sendTimeNS;
+            while (!ring.push(payload)) {
+                stalls++;
+                std::this_thread::yield();
+            }
+        }
+        if (capture.truncated()) {
+            logEvent(LogLevel::Error, LogEvent::CaptureTruncated);
+        }
+        done.store(true, std::memory_order_release);
+    }
 
-            std::memcpy(&msg.marketImbalanceQty, buffer + 28, sizeof(msg.marketImbalanceQty));
+public:
+    CaptureReader() = default;
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+    ~CaptureReader() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
 
-            msg.auctionTime = ntohs(*(reinterpret_cast<const uint16_t*>(buffer + 32)));
-            
-            msg.auctionType = buffer[34];
-            
-            msg.imbalanceSide = buffer[35];
+    bool open(const char* path, bool hugePages) {
+        return capture.open(path, hugePages);
+    }
+    void start() {
+        thread = std::thread(&CaptureReader::run, this);
+    }
+    // Wait for the next payload; nullptr once the file is exhausted
+    const Payload* next() {
+        while (true) {
+            if (const Payload* payload = ring.front()) {
+                return payload;
+            }
+            if (done.load(std::memory_order_acquire)) {
+                return ring.front();
+            }
+            std::this_thread::yield();
+        }
+    }
+    void pop() {
+        ring.pop();
+    }
+};
 
-            std::memcpy(&msg.continuousBookClearingPrice, buffer + 36, sizeof(msg.continuousBookClearingPrice));
+// Merge Captures Function
+// Replay several captures as one stream ordered by Pillar sendTime, one
+// reader thread per file feeding a k-way merge on the calling thread. Equal
+// sendTimes keep the order the files were given in. `afterPacket` runs after
+// each packet is parsed.
+template <typename AfterPacket>
+bool mergeCaptures(const std::vector<const char*>& paths, bool hugePages, AfterPacket&& afterPacket) {
+    std::vector<std::unique_ptr<CaptureReader>> readers;
+    for (const char* path : paths) {
+        readers.push_back(std::make_unique<CaptureReader>());
+        if (!readers.back()->open(path, hugePages)) {
+            std::cerr << "Error opening file: " << path << " is not a readable pcap or pcapng file\n";
+            return false;
+        }
+    }
+    for (auto& reader : readers) {
+        reader->start();
+    }
 
-            std::memcpy(&msg.auctionInterestClearingPrice, buffer + 40, sizeof(msg.auctionInterestClearingPrice));
+    // Min-heap of (sendTime, reader) over the next payload of every reader
+    using HeapEntry = std::pair<uint64_t, size_t>;
+    std::vector<HeapEntry> heap;
+    auto later = [](const HeapEntry& a, const HeapEntry& b) { return a > b; };
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (const CaptureReader::Payload* payload = readers[i]->next()) {
+            heap.emplace_back(payload->sendTimeNS, i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        size_t i = heap.back().second;
+        heap.pop_back();
+
+        CaptureReader& reader = *readers[i];
+        const CaptureReader::Payload* payload = reader.next();
+        parsePillarStream(payload->data, payload->length, payload->source);
+        reader.pop();
+        afterPacket();
+
+        if ((payload = reader.next()) != nullptr) {
+            heap.emplace_back(payload->sendTimeNS, i);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    return true;
+}
 
-            std::memcpy(&msg.ssrFilingPrice, buffer + 44, sizeof(msg.ssrFilingPrice));
+// Replay Pacer Definition
+// Releases capture packets on the schedule their timestamps describe,
+// sped up by a factor, instead of as fast as they can be read. The first
+// packet ties capture time to steady_clock time. Each wait sleeps until a
+// millisecond before the packet is due and spins the rest of the way. A
+// packet that falls due while the one before it is still being handled
+// starts late; that delay is the time it would have queued in a socket
+// buffer, and the largest one is how far the engine fell behind.
+class ReplayPacer {
+private:
+    static constexpr int64_t kSpinNS = 1000000;
+    static constexpr uint64_t kLateNS = 10000;
+
+    double speed = 0;
+    bool started = false;
+    uint64_t firstTimestampNS = 0;
+    uint64_t lastTimestampNS = 0;
+    int64_t startNS = 0;
+    int64_t dueNS = 0;
+    uint64_t packets = 0;
+    uint64_t latePackets = 0;
+    uint64_t reordered = 0;
+    LatencyHistogram queueing;
+    LatencyHistogram dueToHandled;
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static void printRow(const char* name, const LatencyHistogram& histogram) {
+        uint64_t total = histogram.count();
+        std::cout << "  " << std::left << std::setw(28) << name << std::right << std::setw(12) << total;
+        for (double q : {0.5, 0.99, 0.999}) {
+            std::cout << std::setw(10) << histogram.quantile(q, total);
+        }
+        std::cout << std::setw(10) << histogram.max() << "\n";
+    }
 
-            std::memcpy(&msg.indicativeMatchPrice, buffer + 48, sizeof(msg.indicativeMatchPrice));
+public:
+    // Replay at `multiplier` times the captured rate; 0 leaves pacing off
+    void configure(double multiplier) {
+        speed = multiplier;
+    }
+    bool enabled() const {
+        return speed > 0;
+    }
 
-            std::memcpy(&msg.upperCollar, buffer + 52, sizeof(msg.upperCollar));
+    // Wait until the packet stamped `timestampNS` is due. A timestamp
+    // before the previous one is due at once.
+    void release(uint64_t timestampNS) {
+        if (!started) {
+            started = true;
+            firstTimestampNS = timestampNS;
+            lastTimestampNS = timestampNS;
+            startNS = now();
+        }
+        if (timestampNS < lastTimestampNS) {
+            reordered++;
+            timestampNS = lastTimestampNS;
+        }
+        lastTimestampNS = timestampNS;
+        dueNS = startNS + static_cast<int64_t>((timestampNS - firstTimestampNS) / speed);
 
-            std::memcpy(&msg.lowerCollar, buffer + 56, sizeof(msg.lowerCollar));
+        int64_t current = now();
+        if (dueNS - current > kSpinNS) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(dueNS - current - kSpinNS));
+        }
+        while ((current = now()) < dueNS) {
+        }
+        uint64_t delay = static_cast<uint64_t>(current - dueNS);
+        queueing.record(delay);
+        latePackets += (delay > kLateNS);
+        packets++;
+    }
+    // The packet released last has been handled
+    void handled() {
+        dueToHandled.record(static_cast<uint64_t>(now() - dueNS));
+    }
 
-            msg.auctionStatus = buffer[60];
-    
-            msg.freezeStatus = buffer[61];
-            
-            msg.numExtensions = buffer[62];
+    void printStats() const {
+        if (!enabled() || packets == 0) {
+            return;
+        }
+        double captureSeconds = (lastTimestampNS - firstTimestampNS) / 1e9;
+        std::streamsize precision = std::cout.precision();
+        std::cout << "Paced replay: " << packets << " packet(s), " << std::fixed << std::setprecision(3)
+                  << captureSeconds << " s of capture at " << std::defaultfloat << speed << "x in " << std::fixed
+                  << (now() - startNS) / 1e9 << " s" << std::defaultfloat << ", " << latePackets
+                  << " started over " << kLateNS / 1000 << " us late, at most " << queueing.max()
+                  << " ns behind schedule";
+        if (reordered > 0) {
+            std::cout << ", " << reordered << " timestamp(s) out of order";
+        }
+        std::cout << "\n";
+        std::cout << "Replay delay (ns)" << std::string(13, ' ') << std::setw(12) << "count" << std::setw(10) << "p50"
+                  << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << "\n";
+        printRow("due to start (queueing)", queueing);
+        printRow("due to handled", dueToHandled);
+        std::cout.precision(precision);
+    }
+};
 
-            std::memcpy(&msg.unpairedQty, buffer + 64, sizeof(msg.unpairedQty));
+// Live Receiver Definition
+// Joins multicast groups and feeds received datagrams, which are already
+// Pillar payloads, to parsePillarStream. Each socket is drained with
+// recvmmsg, up to kBatch datagrams per call into buffers allocated once up
+// front. With kernel timestamps on, the time from the socket receiving a
+// packet to the book having been handed its messages is measured per packet.
+class LiveReceiver {
+public:
+    struct Endpoint {
+        uint32_t group;  // host byte order
+        uint16_t port;
+    };
+
+    struct Options {
+        uint32_t interfaceAddress = 0;  // host byte order, 0 for any
+        int receiveBufferBytes = 0;
+        bool kernelTimestamps = false;
+        int busyPollMicros = 0;
+    };
+
+    // Parse GROUP:PORT, e.g. 239.1.1.1:20000
+    static bool parseEndpoint(const std::string& text, Endpoint& endpoint) {
+        size_t colon = text.rfind(':');
+        in_addr address;
+        if (colon == std::string::npos || inet_pton(AF_INET, text.substr(0, colon).c_str(), &address) != 1) {
+            return false;
+        }
+        char* end = nullptr;
+        unsigned long port = std::strtoul(text.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || port == 0 || port > 65535) {
+            return false;
+        }
+        endpoint.group = ntohl(address.s_addr);
+        endpoint.port = static_cast<uint16_t>(port);
+        return true;
+    }
 
-            msg.unpairedSide = buffer[68];
-    
-            msg.significantImbalance = buffer[69];
+private:
+    static constexpr size_t kBatch = 64;
+    static constexpr size_t kDatagramSize = 9216;
+
+    struct Socket {
+        int fd;
+        PacketSource source;
+    };
+
+    Options options;
+    std::vector<Socket> sockets;
+    std::vector<uint8_t> buffers = std::vector<uint8_t>(kBatch * kDatagramSize);
+    std::array<mmsghdr, kBatch> messages{};
+    std::array<iovec, kBatch> vectors{};
+    std::array<std::array<char, CMSG_SPACE(sizeof(timespec))>, kBatch> controls{};
+
+    uint64_t calls = 0;
+    uint64_t datagrams = 0;
+    uint64_t truncatedDatagrams = 0;
+    uint64_t timedPackets = 0;
+    uint64_t latencyTotalNS = 0;
+    uint64_t latencyMinNS = UINT64_MAX;
+    uint64_t latencyMaxNS = 0;
+
+    static std::atomic<bool> stopRequested;
+
+    static void requestStop(int) {
+        stopRequested.store(true, std::memory_order_relaxed);
+    }
 
-            std::cout << "Imbalance Message Processed.\n";
-            break;
+    bool openSocket(const Endpoint& endpoint) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            std::cerr << "socket: " << std::strerror(errno) << "\n";
+            return false;
         }
-        case MSG_TYPE_ADD_ORDER_REFRESH: {
-            if (size < sizeof(AddOrderRefreshMessage)) {
-                std::cerr << "Invalid Add Order Refresh Message size.\n";
-                return;
+        sockets.push_back(Socket{fd, PacketSource{endpoint.group, endpoint.port}});
+
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (options.receiveBufferBytes > 0) {
+            // SO_RCVBUFFORCE may exceed rmem_max but needs CAP_NET_ADMIN
+            int bytes = options.receiveBufferBytes;
+            if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) != 0) {
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
             }
-            AddOrderRefreshMessage msg;
-            
-            std::memcpy(&msg.sourceTime, buffer, sizeof(msg.sourceTime));
-
-            std::memcpy(&msg.sourceTimeNS, buffer + 4, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 8, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 12, sizeof(msg.symbolSeqNum));
+            socklen_t length = sizeof(bytes);
+            getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, &length);
+            // The kernel reports double the usable size it granted
+            if (bytes / 2 < options.receiveBufferBytes) {
+                std::cerr << "Receive buffer limited to " << bytes / 2 << " bytes (raise net.core.rmem_max)\n";
+            }
+        }
+        if (options.kernelTimestamps && setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+            std::cerr << "SO_TIMESTAMPNS: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        if (options.busyPollMicros > 0) {
+            int micros = options.busyPollMicros;
+            if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &micros, sizeof(micros)) != 0) {
+                std::cerr << "SO_BUSY_POLL: " << std::strerror(errno) << "\n";
+            }
+        }
 
-            std::memcpy(&msg.orderID, buffer + 16, sizeof(msg.orderID));
+        // Binding to the group rather than INADDR_ANY keeps other groups on the same port out
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(endpoint.port);
+        address.sin_addr.s_addr = htonl(endpoint.group);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::cerr << "bind: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        ip_mreq membership{};
+        membership.imr_multiaddr.s_addr = htonl(endpoint.group);
+        membership.imr_interface.s_addr = htonl(options.interfaceAddress);
+        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+            std::cerr << "IP_ADD_MEMBERSHIP: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
 
-            std::memcpy(&msg.price, buffer + 24, sizeof(msg.price));
+    static uint64_t kernelTimestampNS(const msghdr& header) {
+        for (const cmsghdr* control = CMSG_FIRSTHDR(&header); control != nullptr;
+             control = CMSG_NXTHDR(const_cast<msghdr*>(&header), const_cast<cmsghdr*>(control))) {
+            if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec stamp;
+                std::memcpy(&stamp, CMSG_DATA(control), sizeof(stamp));
+                return stamp.tv_sec * 1000000000ull + stamp.tv_nsec;
+            }
+        }
+        return 0;
+    }
 
-            std::memcpy(&msg.volume, buffer + 28, sizeof(msg.volume));
+    // Receive and parse everything queued on one socket; false on a socket error
+    template <typename AfterPacket>
+    bool drain(const Socket& socket, AfterPacket& afterPacket) {
+        while (true) {
+            for (size_t i = 0; i < kBatch; ++i) {
+                messages[i].msg_hdr.msg_controllen = options.kernelTimestamps ? controls[i].size() : 0;
+            }
+            int received;
+            {
+                LATENCY_SCOPE(latencyStats.packetRead);
+                received = recvmmsg(socket.fd, messages.data(), kBatch, MSG_DONTWAIT, nullptr);
+            }
+            if (received < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            calls++;
+            datagrams += received;
+            for (int i = 0; i < received; ++i) {
+                const mmsghdr& message = messages[i];
+                if (message.msg_hdr.msg_flags & MSG_TRUNC) {
+                    truncatedDatagrams++;
+                    logEvent(LogLevel::Error, LogEvent::DatagramTruncated, message.msg_len);
+                    continue;
+                }
+                const uint8_t* data = buffers.data() + i * kDatagramSize;
+                parsePillarStream(data, static_cast<uint16_t>(message.msg_len), socket.source);
+                if (options.kernelTimestamps) {
+                    recordLatency(kernelTimestampNS(message.msg_hdr));
+                }
+                afterPacket();
+            }
+            if (static_cast<size_t>(received) < kBatch) {
+                return true;
+            }
+        }
+    }
 
-            msg.side = static_cast<char>(buffer[32]);
+    void recordLatency(uint64_t receivedNS) {
+        if (receivedNS == 0) {
+            return;
+        }
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t nowNS = now.tv_sec * 1000000000ull + now.tv_nsec;
+        uint64_t latencyNS = nowNS > receivedNS ? nowNS - receivedNS : 0;
+        timedPackets++;
+        latencyTotalNS += latencyNS;
+        latencyMinNS = std::min(latencyMinNS, latencyNS);
+        latencyMaxNS = std::max(latencyMaxNS, latencyNS);
+    }
 
-            std::memcpy(msg.firmID, buffer + 33, sizeof(msg.firmID));
-            msg.firmID[4] = '\0';
+public:
+    explicit LiveReceiver(const Options& options) : options(options) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            vectors[i].iov_base = buffers.data() + i * kDatagramSize;
+            vectors[i].iov_len = kDatagramSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i].data();
+        }
+    }
+    LiveReceiver(const LiveReceiver&) = delete;
+    LiveReceiver& operator=(const LiveReceiver&) = delete;
+    ~LiveReceiver() {
+        for (const Socket& socket : sockets) {
+            close(socket.fd);
+        }
+    }
 
-            msg.reserved1 = buffer[38];
+    bool open(const std::vector<Endpoint>& endpoints) {
+        for (const Endpoint& endpoint : endpoints) {
+            if (!openSocket(endpoint)) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-            std::cout << "Add Order Refresh Message Processed.\n";
-            break;
+    // Receive until SIGINT or SIGTERM. Without busy polling the thread sleeps
+    // in poll() between batches; with it, the sockets are spun on directly.
+    template <typename AfterPacket>
+    bool run(AfterPacket&& afterPacket) {
+        struct sigaction action{};
+        action.sa_handler = requestStop;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        std::vector<pollfd> pollSet;
+        for (const Socket& socket : sockets) {
+            pollSet.push_back(pollfd{socket.fd, POLLIN, 0});
         }
-        case MSG_TYPE_NON_DISPLAYED_TRADE: {
-            if (size < sizeof(NonDisplayedTradeMessage)) {
-                std::cerr << "Invalid Non-Displayed Trade Message size.\n";
-                return;
+        while (!stopRequested.load(std::memory_order_relaxed)) {
+            if (options.busyPollMicros == 0) {
+                int ready = poll(pollSet.data(), pollSet.size(), 200);
+                if (ready < 0 && errno != EINTR) {
+                    std::cerr << "poll: " << std::strerror(errno) << "\n";
+                    return false;
+                }
+                if (ready <= 0) {
+                    continue;
+                }
+            }
+            for (size_t i = 0; i < sockets.size(); ++i) {
+                if (options.busyPollMicros == 0 && !(pollSet[i].revents & POLLIN)) {
+                    continue;
+                }
+                if (!drain(sockets[i], afterPacket)) {
+                    std::cerr << "recvmmsg: " << std::strerror(errno) << "\n";
+                    return false;
+                }
             }
-            NonDisplayedTradeMessage msg;
-            
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
+        }
+        return true;
+    }
+
+    void printStats() const {
+        std::cout << "Live: " << datagrams << " datagram(s) in " << calls << " recvmmsg call(s) ("
+                  << std::fixed << std::setprecision(1) << (calls ? double(datagrams) / calls : 0.0)
+                  << " per call), " << truncatedDatagrams << " truncated\n" << std::defaultfloat;
+        if (timedPackets > 0) {
+            std::cout << "Socket to book latency: min " << latencyMinNS << " ns, mean "
+                      << latencyTotalNS / timedPackets << " ns, max " << latencyMaxNS << " ns over "
+                      << timedPackets << " packet(s)\n";
+        }
+    }
+};
 
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+std::atomic<bool> LiveReceiver::stopRequested{false};
+
+// For Each Setting Function
+// Walk a comma separated KEY=VALUE list, e.g. depth=200,cancel=0.9, handing
+// each pair to `apply`, which returns false for a key it does not know
+template <typename Apply>
+bool forEachSetting(const std::string& spec, Apply&& apply) {
+    for (size_t pos = 0; pos < spec.size();) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma - pos);
+        pos = (comma == std::string::npos) ? spec.size() : comma + 1;
+        size_t equals = item.find('=');
+        if (equals == std::string::npos || !apply(item.substr(0, equals), item.c_str() + equals + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+// Capture Generator Definition
+// Writes a synthetic single-channel XDP feed as a nanosecond pcap of
+// Ethernet/IPv4/UDP frames, built from the same message structs the parser
+// reads. Every symbol is mapped first, the book is then built up to
+// `liveOrders` resting orders, and `messages` more of mixed order traffic
+// follow. Output depends only on the settings and the seed.
+class CaptureGenerator {
+public:
+    struct Settings {
+        size_t symbols = 1000;
+        size_t liveOrders = 1000000;
+        size_t messages = 10000000;
+        size_t depth = 100;            // price levels a side
+        double distanceDecay = 0.05;   // geometric p for ticks behind the top
+        double modifyShare = 0.15;
+        double executeShare = 0.05;
+        double replaceShare = 0.05;
+        double symbolSkew = 1.0;       // Zipf exponent of symbol activity, 0 for uniform
+        size_t messagesPerPacket = 8;
+        size_t burstPackets = 1;       // packets sent 50 ns apart
+        uint64_t burstGapNS = 10000;   // between bursts
+        uint64_t seed = 1;
+    };
+
+    static bool parseSettings(const std::string& spec, Settings& settings) {
+        bool known = forEachSetting(spec, [&](const std::string& key, const char* value) {
+            if (key == "symbols") {
+                settings.symbols = std::strtoull(value, nullptr, 10);
+            } else if (key == "live") {
+                settings.liveOrders = std::strtoull(value, nullptr, 10);
+            } else if (key == "messages") {
+                settings.messages = std::strtoull(value, nullptr, 10);
+            } else if (key == "depth") {
+                settings.depth = std::strtoull(value, nullptr, 10);
+            } else if (key == "decay") {
+                settings.distanceDecay = std::strtod(value, nullptr);
+            } else if (key == "modify") {
+                settings.modifyShare = std::strtod(value, nullptr);
+            } else if (key == "execute") {
+                settings.executeShare = std::strtod(value, nullptr);
+            } else if (key == "replace") {
+                settings.replaceShare = std::strtod(value, nullptr);
+            } else if (key == "skew") {
+                settings.symbolSkew = std::strtod(value, nullptr);
+            } else if (key == "per-packet") {
+                settings.messagesPerPacket = std::strtoull(value, nullptr, 10);
+            } else if (key == "burst") {
+                settings.burstPackets = std::strtoull(value, nullptr, 10);
+            } else if (key == "gap") {
+                settings.burstGapNS = std::strtoull(value, nullptr, 10);
+            } else if (key == "seed") {
+                settings.seed = std::strtoull(value, nullptr, 10);
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return known && settings.symbols > 0 && settings.depth > 0 && settings.burstPackets > 0 &&
+               settings.messagesPerPacket > 0 && settings.messagesPerPacket <= 255 &&
+               settings.distanceDecay > 0.0 && settings.distanceDecay <= 1.0 &&
+               settings.modifyShare + settings.executeShare + settings.replaceShare <= 1.0;
+    }
 
-            std::memcpy(&msg.tradeID, buffer + 12, sizeof(msg.tradeID));
+private:
+    static constexpr size_t kMaxPillarPayload = 1400;
+    static constexpr uint32_t kTick = 100;               // 0.01 at price scale 4
+    static constexpr uint64_t kStartTimeNS = 1704205800ull * 1000000000ull;  // 2024-01-02 14:30 UTC
+    static constexpr uint32_t kSourceIP = 0x0A000001;    // 10.0.0.1
+    static constexpr uint32_t kGroupIP = 0xEF010101;     // 239.1.1.1
+    static constexpr uint16_t kPort = 20000;
+
+    struct LiveOrder {
+        uint64_t orderID;
+        uint32_t price;
+        uint32_t volume;
+    };
+    struct Symbol {
+        uint32_t midPrice;
+        uint32_t sequenceNumber;
+        std::vector<LiveOrder> orders;
+    };
+
+    Settings settings;
+    uint64_t state;
+    std::vector<Symbol> symbols;
+    std::vector<double> activity;  // cumulative symbol weights
+    size_t liveCount = 0;
+    uint64_t nextOrderID = 1;
+    uint32_t nextTradeID = 1;
+
+    FILE* file = nullptr;
+    std::vector<uint8_t> frame;
+    size_t payloadLength = 0;
+    uint8_t packetMessages = 0;
+    uint8_t packetLimit = 0;
+    uint32_t sequenceNumber = 1;
+    uint64_t timeNS = kStartTimeNS;
+    uint64_t referencedSecond = UINT64_MAX;
+    size_t burstPosition = 0;
+    uint64_t packetCount = 0;
+    uint64_t messageCount = 0;
+    uint64_t bytesWritten = 0;
+
+    // splitmix64, so streams do not depend on the standard library's distributions
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    double unit() {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+    size_t below(size_t bound) {
+        return static_cast<size_t>(next() % bound);
+    }
+    uint32_t volume() {
+        return static_cast<uint32_t>(100 * (1 + below(10)));
+    }
+    uint32_t symbolIndex() {
+        if (settings.symbolSkew == 0.0) {
+            return static_cast<uint32_t>(below(symbols.size()));
+        }
+        double draw = unit() * activity.back();
+        return static_cast<uint32_t>(std::upper_bound(activity.begin(), activity.end(), draw) - activity.begin());
+    }
+    uint32_t priceFor(const Symbol& symbol, bool bid) {
+        double ticks = std::floor(std::log1p(-unit()) / std::log1p(-std::min(settings.distanceDecay, 0.999999)));
+        uint32_t distance = 1 + static_cast<uint32_t>(std::min<double>(ticks, settings.depth - 1));
+        return bid ? symbol.midPrice - kTick * distance : symbol.midPrice + kTick * distance;
+    }
+    // Prices are drawn a whole number of ticks either side of the mid, so the
+    // order nearest it is at or near the top of its side. Executions take
+    // the nearest of four drawn at random instead of searching the book.
+    size_t executionTarget(const Symbol& symbol) {
+        auto distance = [&](size_t position) {
+            uint32_t price = symbol.orders[position].price;
+            return price > symbol.midPrice ? price - symbol.midPrice : symbol.midPrice - price;
+        };
+        size_t nearest = below(symbol.orders.size());
+        for (int i = 0; i < 3; ++i) {
+            size_t other = below(symbol.orders.size());
+            nearest = distance(other) < distance(nearest) ? other : nearest;
+        }
+        return nearest;
+    }
 
-            std::memcpy(&msg.price, buffer + 20, sizeof(msg.price));
+    void writeFileHeader() {
+        uint32_t header[6] = {0xA1B23C4D, 0x00040002, 0, 0, 65535, 1};
+        std::fwrite(header, sizeof(header), 1, file);
+        bytesWritten += sizeof(header);
+    }
 
-            std::memcpy(&msg.volume, buffer + 24, sizeof(msg.volume));
+    // Finish the Pillar, UDP, IPv4 and Ethernet headers in front of the
+    // payload and write the frame as a pcap record
+    void flushPacket() {
+        if (packetMessages == 0) {
+            return;
+        }
+        uint8_t* pillar = frame.data() + sizeof(mac_hdr_t) + sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t);
+        uint16_t pillarLength = static_cast<uint16_t>(payloadLength);
+        uint32_t seconds = static_cast<uint32_t>(timeNS / 1000000000ull);
+        uint32_t nanoseconds = static_cast<uint32_t>(timeNS % 1000000000ull);
+        std::memcpy(pillar, &pillarLength, sizeof(pillarLength));
+        pillar[2] = 0;
+        pillar[3] = packetMessages;
+        std::memcpy(pillar + 4, &sequenceNumber, sizeof(sequenceNumber));
+        std::memcpy(pillar + 8, &seconds, sizeof(seconds));
+        std::memcpy(pillar + 12, &nanoseconds, sizeof(nanoseconds));
+
+        udp_hdr_t udp{};
+        udp.src_port = htons(kPort);
+        udp.dest_port = htons(kPort);
+        udp.length = htons(static_cast<uint16_t>(sizeof(udp_hdr_t) + pillarLength));
+        std::memcpy(pillar - sizeof(udp_hdr_t), &udp, sizeof(udp));
+
+        ipv4_hdr_t ip{};
+        ip.version_ihl = 0x45;
+        ip.total_length = htons(static_cast<uint16_t>(sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t) + pillarLength));
+        ip.identification = htons(static_cast<uint16_t>(packetCount));
+        ip.flags_fragment_offset = htons(0x4000);
+        ip.ttl = 64;
+        ip.protocol = 17;
+        ip.src_ip = htonl(kSourceIP);
+        ip.dest_ip = htonl(kGroupIP);
+        uint32_t sum = 0;
+        const uint8_t* words = reinterpret_cast<const uint8_t*>(&ip);
+        for (size_t i = 0; i < sizeof(ip); i += 2) {
+            sum += (words[i] << 8) | words[i + 1];
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        ip.header_checksum = htons(static_cast<uint16_t>(~sum));
+        std::memcpy(frame.data() + sizeof(mac_hdr_t), &ip, sizeof(ip));
+
+        mac_hdr_t mac{};
+        const uint8_t destination[6] = {0x01, 0x00, 0x5E, (kGroupIP >> 16) & 0x7F, (kGroupIP >> 8) & 0xFF, kGroupIP & 0xFF};
+        const uint8_t source[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+        std::memcpy(mac.dest_mac, destination, sizeof(destination));
+        std::memcpy(mac.src_mac, source, sizeof(source));
+        mac.ethertype = htons(static_cast<uint16_t>(ethertype_e::ipv4));
+        std::memcpy(frame.data(), &mac, sizeof(mac));
+
+        uint32_t frameLength = static_cast<uint32_t>(pillar - frame.data() + pillarLength);
+        uint32_t record[4] = {seconds, nanoseconds, frameLength, frameLength};
+        std::fwrite(record, sizeof(record), 1, file);
+        std::fwrite(frame.data(), frameLength, 1, file);
+        bytesWritten += sizeof(record) + frameLength;
+
+        packetCount++;
+        sequenceNumber += packetMessages;
+        payloadLength = 16;
+        packetMessages = 0;
+        packetLimit = static_cast<uint8_t>(1 + below(settings.messagesPerPacket));
+        if (++burstPosition < settings.burstPackets) {
+            timeNS += 50;
+        } else {
+            burstPosition = 0;
+            timeNS += settings.burstGapNS;
+        }
+    }
 
-            msg.printableFlag = buffer[28];
+    template <typename Message, typename = void>
+    struct HasSourceTimeNS : std::false_type {};
+    template <typename Message>
+    struct HasSourceTimeNS<Message, std::void_t<decltype(Message::sourceTimeNS)>> : std::true_type {};
+
+    // Add a message to the packet being built, stamped with the packet's
+    // time if it carries one
+    template <typename Message>
+    void append(uint16_t type, Message message) {
+        constexpr size_t size = sizeof(XDPMessageHeader) + sizeof(Message);
+        if (packetMessages == packetLimit || payloadLength + size > kMaxPillarPayload) {
+            flushPacket();
+        }
+        // As on the real feed, the first message of each second is preceded
+        // by a Source Time Reference carrying the second
+        if (type != MSG_TYPE_SOURCE_TIME_REFERENCE && timeNS / 1000000000ull != referencedSecond) {
+            referencedSecond = timeNS / 1000000000ull;
+            SourceTimeReferenceMessage reference{};
+            reference.sourceTime = static_cast<uint32_t>(referencedSecond);
+            append(MSG_TYPE_SOURCE_TIME_REFERENCE, reference);
+            append(type, message);
+            return;
+        }
+        if constexpr (HasSourceTimeNS<Message>::value) {
+            message.sourceTimeNS = sourceTimeNS();
+        }
+        uint8_t* at = frame.data() + sizeof(mac_hdr_t) + sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t) + payloadLength;
+        XDPMessageHeader header{static_cast<uint16_t>(size), type};
+        std::memcpy(at, &header, sizeof(header));
+        std::memcpy(at + sizeof(header), &message, sizeof(message));
+        payloadLength += size;
+        packetMessages++;
+        messageCount++;
+    }
 
-            msg.tradeCond1 = static_cast<char>(buffer[29]);
+    uint32_t sourceTimeNS() const {
+        return static_cast<uint32_t>(timeNS % 1000000000ull);
+    }
 
-            msg.tradeCond1 = static_cast<char>(buffer[30]);
+    void mapSymbols() {
+        for (uint32_t index = 0; index < symbols.size(); ++index) {
+            SymbolIndexMappingMessage message{};
+            message.symbolIndex = index;
+            std::snprintf(message.symbol, sizeof(message.symbol), "SYM%u", index);
+            message.marketID = 1;
+            message.systemID = 1;
+            message.exchangeCode = 'N';
+            message.priceScaleCode = 4;
+            message.securityType = 'A';
+            message.lotSize = 100;
+            message.prevClosePrice = symbols[index].midPrice;
+            message.priceResolution = 1;
+            message.roundLot = 'Y';
+            message.mpv = 100;
+            message.unitOfTrade = 1;
+            append(MSG_TYPE_SYMBOL_INDEX_MAPPING, message);
+        }
+    }
 
-            msg.tradeCond1 = static_cast<char>(buffer[31]);
-            
-            msg.tradeCond1 = static_cast<char>(buffer[32]);
+    void addOrder(uint32_t index) {
+        Symbol& symbol = symbols[index];
+        bool bid = next() & 1;
+        AddOrderMessage message{};
+        message.symbolIndex = index;
+        message.symbolSeqNum = symbol.sequenceNumber++;
+        message.orderID = nextOrderID++;
+        message.price = priceFor(symbol, bid);
+        message.volume = volume();
+        message.side = bid ? 'B' : 'S';
+        std::memcpy(message.firmID, "GEN", 3);
+        append(MSG_TYPE_ADD_ORDER, message);
+        symbol.orders.push_back(LiveOrder{message.orderID, message.price, message.volume});
+        liveCount++;
+    }
+    LiveOrder removeAt(Symbol& symbol, size_t position) {
+        LiveOrder order = symbol.orders[position];
+        symbol.orders[position] = symbol.orders.back();
+        symbol.orders.pop_back();
+        liveCount--;
+        return order;
+    }
 
-            std::cout << "Non Displayed Trade Message Processed.\n";
-            break;
+    // One message of steady-state traffic. Adds and deletes share what the
+    // other types leave, leaning towards whichever brings the live count
+    // back to the target.
+    void trafficMessage() {
+        uint32_t index = symbolIndex();
+        Symbol& symbol = symbols[index];
+        double draw = unit();
+        if (symbol.orders.empty()) {
+            addOrder(index);
+            return;
         }
-        case MSG_TYPE_CROSS_TRADE: {
-            if (size < sizeof(CrossTradeMessage)) {
-                std::cerr << "Invalid Cross Trade Message size.\n";
+        if (draw < settings.modifyShare) {
+            LiveOrder& order = symbol.orders[below(symbol.orders.size())];
+            bool bid = order.price < symbol.midPrice;
+            ModifyOrderMessage message{};
+            message.symbolIndex = index;
+            message.symbolSeqNum = symbol.sequenceNumber++;
+            message.orderID = order.orderID;
+            message.price = (next() & 1) ? priceFor(symbol, bid) : order.price;
+            message.volume = volume();
+            message.side = bid ? 'B' : 'S';
+            append(MSG_TYPE_MODIFY_ORDER, message);
+            order.price = message.price;
+            order.volume = message.volume;
+        } else if ((draw -= settings.modifyShare) < settings.executeShare) {
+            size_t best = executionTarget(symbol);
+            LiveOrder& order = symbol.orders[best];
+            OrderExecutionMessage message{};
+            message.symbolIndex = index;
+            message.symbolSeqNum = symbol.sequenceNumber++;
+            message.orderID = order.orderID;
+            message.tradeID = nextTradeID++;
+            message.price = order.price;
+            message.volume = (next() & 1) ? order.volume : std::max<uint32_t>(order.volume / 2, 1);
+            message.printableFlag = 1;
+            message.tradeCond1 = message.tradeCond2 = message.tradeCond3 = message.tradeCond4 = ' ';
+            append(MSG_TYPE_ORDER_EXECUTION, message);
+            if (message.volume == order.volume) {
+                removeAt(symbol, best);
+            } else {
+                order.volume -= message.volume;
+            }
+        } else if ((draw -= settings.executeShare) < settings.replaceShare) {
+            LiveOrder order = removeAt(symbol, below(symbol.orders.size()));
+            bool bid = order.price < symbol.midPrice;
+            ReplaceOrderMessage message{};
+            message.symbolIndex = index;
+            message.symbolSeqNum = symbol.sequenceNumber++;
+            message.orderID = order.orderID;
+            message.newOrderID = nextOrderID++;
+            message.price = priceFor(symbol, bid);
+            message.volume = volume();
+            message.side = bid ? 'B' : 'S';
+            append(MSG_TYPE_REPLACE_ORDER, message);
+            symbol.orders.push_back(LiveOrder{message.newOrderID, message.price, message.volume});
+            liveCount++;
+        } else {
+            double target = static_cast<double>(std::max<size_t>(settings.liveOrders, 1));
+            double addChance = std::min(1.0, std::max(0.0, 0.5 + (target - liveCount) / (2 * target)));
+            if (unit() < addChance) {
+                addOrder(index);
                 return;
             }
-            CrossTradeMessage msg;
-            
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+            LiveOrder order = removeAt(symbol, below(symbol.orders.size()));
+            DeleteOrderMessage message{};
+            message.symbolIndex = index;
+            message.symbolSeqNum = symbol.sequenceNumber++;
+            message.orderID = order.orderID;
+            append(MSG_TYPE_DELETE_ORDER, message);
+        }
+    }
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+public:
+    explicit CaptureGenerator(const Settings& settings)
+        : settings(settings), state(settings.seed), frame(sizeof(mac_hdr_t) + sizeof(ipv4_hdr_t) +
+                                                          sizeof(udp_hdr_t) + kMaxPillarPayload) {
+        symbols.resize(settings.symbols);
+        double weight = 0.0;
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            // Mid prices from 10.00 to 500.00, far enough from zero for the deepest book
+            uint32_t mid = static_cast<uint32_t>(100000 + below(4900000 / kTick) * kTick);
+            symbols[i].midPrice = std::max<uint32_t>(mid, kTick * static_cast<uint32_t>(settings.depth + 1));
+            symbols[i].sequenceNumber = 1;
+            weight += 1.0 / std::pow(static_cast<double>(i + 1), settings.symbolSkew);
+            activity.push_back(weight);
+        }
+        payloadLength = 16;
+        packetLimit = static_cast<uint8_t>(1 + below(settings.messagesPerPacket));
+    }
 
-            std::memcpy(&msg.crossID, buffer + 12, sizeof(msg.crossID));
+    bool write(const char* path) {
+        file = std::fopen(path, "wb");
+        if (file == nullptr) {
+            std::cerr << "Error opening output file: " << path << "\n";
+            return false;
+        }
+        std::vector<char> buffer(1 << 20);
+        std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+        writeFileHeader();
+        mapSymbols();
+        flushPacket();
+        while (liveCount < settings.liveOrders) {
+            addOrder(symbolIndex());
+        }
+        for (size_t n = 0; n < settings.messages; ++n) {
+            trafficMessage();
+        }
+        flushPacket();
+
+        bool ok = std::fflush(file) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+        if (!ok) {
+            std::cerr << "Error writing output file: " << path << "\n";
+            return false;
+        }
+        std::cout << "Wrote " << packetCount << " packet(s), " << messageCount << " message(s), "
+                  << bytesWritten << " bytes to " << path << "; " << liveCount << " order(s) left resting\n";
+        return true;
+    }
+};
 
-            std::memcpy(&msg.price, buffer + 16, sizeof(msg.price));
+#ifdef ORDER_BOOK_BENCH
+// Benchmark Allocation Counter
+// Every operator new in a benchmark build is counted so a run can report
+// allocations per book operation. Blocks come from malloc and aligned_alloc,
+// which the library's operator delete already releases with free(); kept out
+// of line so the compiler does not pair the inlined malloc with a delete.
+std::atomic<uint64_t> benchAllocations{0};
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    benchAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t alignment) {
+    benchAllocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void* block = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+// Perf Counters Definition
+// User-space hardware counters opened with perf_event_open. Counters the
+// kernel or the machine refuses are left out; none at all means the report
+// says so rather than failing the run.
+class PerfCounters {
+public:
+    struct Counter {
+        const char* name;
+        int fd;
+        uint64_t value;
+    };
 
-            std::memcpy(&msg.volume, buffer + 20, sizeof(msg.volume));
+private:
+    std::vector<Counter> counters;
+
+    void add(const char* name, uint32_t type, uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd >= 0) {
+            counters.push_back(Counter{name, fd, 0});
+        }
+    }
 
-            msg.crossType = static_cast<char>(buffer[24]);
+public:
+    PerfCounters() {
+        add("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        add("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        add("L1D misses", PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        add("LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() {
+        for (const Counter& counter : counters) {
+            close(counter.fd);
+        }
+    }
 
-            std::cout << "Cross Trade Message Processed.\n";
-            break;
+    void start() {
+        for (const Counter& counter : counters) {
+            ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
         }
-        case MSG_TYPE_TRADE_CANCEL: {
-            if (size < sizeof(TradeCancelMessage)) {
-                std::cerr << "Invalid Trade Cancel Message size.\n";
-                return;
+    }
+    void stop() {
+        for (Counter& counter : counters) {
+            ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter.fd, &counter.value, sizeof(counter.value)) != sizeof(counter.value)) {
+                counter.value = 0;
             }
-            TradeCancelMessage msg;
-            
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+        }
+    }
+    const std::vector<Counter>& results() const {
+        return counters;
+    }
+};
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+// Benchmark Definition
+// Drives OrderBook operations directly with a synthetic order flow. Every
+// book is filled to `depth` levels a side, then a pre-generated stream of
+// adds, cancels, modifies, executions and replaces is timed. Prices sit a
+// geometrically distributed number of ticks behind the top of book, so most
+// activity is near the inside as on a real feed.
+class Benchmark {
+public:
+    struct Workload {
+        size_t symbols = 100;
+        size_t depth = 50;
+        size_t ordersPerLevel = 4;
+        size_t operations = 1000000;
+        double cancelRatio = 1.0;   // cancels per add
+        double distanceDecay = 0.3; // geometric p for ticks behind the top
+        double modifyShare = 0.1;
+        double executeShare = 0.05;
+        double replaceShare = 0.05;
+        bool marketByPrice = false;
+        bool sharedIndex = false;
+        uint64_t seed = 1;
+    };
+
+    static bool parseWorkload(const std::string& spec, Workload& workload) {
+        bool known = forEachSetting(spec, [&](const std::string& key, const char* value) {
+            if (key == "symbols") {
+                workload.symbols = std::strtoull(value, nullptr, 10);
+            } else if (key == "depth") {
+                workload.depth = std::strtoull(value, nullptr, 10);
+            } else if (key == "orders") {
+                workload.ordersPerLevel = std::strtoull(value, nullptr, 10);
+            } else if (key == "ops") {
+                workload.operations = std::strtoull(value, nullptr, 10);
+            } else if (key == "cancel") {
+                workload.cancelRatio = std::strtod(value, nullptr);
+            } else if (key == "decay") {
+                workload.distanceDecay = std::strtod(value, nullptr);
+            } else if (key == "modify") {
+                workload.modifyShare = std::strtod(value, nullptr);
+            } else if (key == "execute") {
+                workload.executeShare = std::strtod(value, nullptr);
+            } else if (key == "replace") {
+                workload.replaceShare = std::strtod(value, nullptr);
+            } else if (key == "mbp") {
+                workload.marketByPrice = std::atoi(value) != 0;
+            } else if (key == "shared") {
+                workload.sharedIndex = std::atoi(value) != 0;
+            } else if (key == "seed") {
+                workload.seed = std::strtoull(value, nullptr, 10);
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return known && workload.symbols > 0 && workload.depth > 0 && workload.ordersPerLevel > 0 &&
+               workload.distanceDecay > 0.0 && workload.distanceDecay <= 1.0 &&
+               workload.modifyShare + workload.executeShare + workload.replaceShare <= 1.0;
+    }
 
-            std::memcpy(&msg.tradeID, buffer + 12, sizeof(msg.tradeID));
+private:
+    enum class Operation : uint8_t { Add, Cancel, Modify, Execute, Replace };
+    static constexpr const char* kOperationNames[] = {"add", "cancel", "modify", "execute", "replace"};
+
+    static constexpr uint32_t kMidPrice = 1000000;  // 100.0000
+    static constexpr uint32_t kTick = 100;          // 0.01
+
+    struct Step {
+        Operation operation;
+        char side;
+        uint32_t symbol;
+        uint64_t orderID;
+        uint64_t newOrderID;
+        uint32_t price;
+        uint32_t volume;
+    };
+    struct LiveOrder {
+        uint64_t orderID;
+        uint32_t price;
+        uint32_t volume;
+        char side;
+    };
+
+    Workload workload;
+    std::mt19937_64 random;
+    std::vector<Step> prefill;
+    std::vector<Step> steps;
+    std::array<uint64_t, 5> operationCounts{};
+
+    uint32_t priceBehindTop(char side, size_t ticks) const {
+        size_t distance = std::min(ticks, workload.depth - 1) + 1;
+        return side == 'B' ? kMidPrice - kTick * distance : kMidPrice + kTick * distance;
+    }
+    size_t drawDistance(std::geometric_distribution<size_t>& distance) {
+        return std::min(distance(random), workload.depth - 1);
+    }
+    uint32_t drawVolume() {
+        return static_cast<uint32_t>(100 * (1 + random() % 10));
+    }
+    static LiveOrder takeAt(std::vector<LiveOrder>& live, size_t index) {
+        LiveOrder order = live[index];
+        live[index] = live.back();
+        live.pop_back();
+        return order;
+    }
 
-            std::cout << "Trade Cancel Message Processed.\n";
-            break;
+    // Build the prefill and the timed stream up front so the random number
+    // generation and bookkeeping stay out of the measurement
+    void generate() {
+        std::vector<std::vector<LiveOrder>> live(workload.symbols);
+        std::geometric_distribution<size_t> distance(workload.distanceDecay);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        uint64_t nextOrderID = 1;
+
+        for (uint32_t symbol = 0; symbol < workload.symbols; ++symbol) {
+            for (char side : {'B', 'S'}) {
+                for (size_t level = 0; level < workload.depth; ++level) {
+                    for (size_t i = 0; i < workload.ordersPerLevel; ++i) {
+                        LiveOrder order{nextOrderID++, priceBehindTop(side, level), drawVolume(), side};
+                        prefill.push_back(Step{Operation::Add, side, symbol, order.orderID, 0, order.price, order.volume});
+                        live[symbol].push_back(order);
+                    }
+                }
+            }
         }
-        case MSG_TYPE_CROSS_CORRECTION: {
-            if (size < sizeof(CrossCorrectionMessage)) {
-                std::cerr << "Invalid Cross Correction Message size.\n";
-                return;
+
+        double cancelShare = (1.0 - workload.modifyShare - workload.executeShare - workload.replaceShare) *
+                             workload.cancelRatio / (1.0 + workload.cancelRatio);
+        steps.reserve(workload.operations);
+        for (size_t n = 0; n < workload.operations; ++n) {
+            uint32_t symbol = static_cast<uint32_t>(random() % workload.symbols);
+            auto& orders = live[symbol];
+            double draw = unit(random);
+            Step step{Operation::Add, 'B', symbol, 0, 0, 0, 0};
+
+            if (!orders.empty() && draw < workload.modifyShare) {
+                LiveOrder& order = orders[random() % orders.size()];
+                step.operation = Operation::Modify;
+                step.side = order.side;
+                step.orderID = order.orderID;
+                step.price = (random() & 1) ? priceBehindTop(order.side, drawDistance(distance)) : order.price;
+                step.volume = drawVolume();
+                order.price = step.price;
+                order.volume = step.volume;
+            } else if (!orders.empty() && (draw -= workload.modifyShare) < workload.executeShare) {
+                // Executions hit the best of a few sampled orders, a cheap stand-in for the top of book
+                size_t best = random() % orders.size();
+                for (int i = 0; i < 3; ++i) {
+                    size_t other = random() % orders.size();
+                    bool better = orders[other].side == 'B' ? orders[other].price > orders[best].price
+                                                            : orders[other].price < orders[best].price;
+                    if (orders[other].side == orders[best].side && better) {
+                        best = other;
+                    }
+                }
+                LiveOrder& order = orders[best];
+                step.operation = Operation::Execute;
+                step.side = order.side;
+                step.orderID = order.orderID;
+                step.price = order.price;
+                step.volume = (random() & 1) ? order.volume : order.volume / 2;
+                if (step.volume == order.volume) {
+                    takeAt(orders, best);
+                } else {
+                    order.volume -= step.volume;
+                }
+            } else if (!orders.empty() && (draw -= workload.executeShare) < workload.replaceShare) {
+                size_t index = random() % orders.size();
+                LiveOrder order = takeAt(orders, index);
+                step.operation = Operation::Replace;
+                step.side = order.side;
+                step.orderID = order.orderID;
+                step.newOrderID = nextOrderID++;
+                step.price = priceBehindTop(order.side, drawDistance(distance));
+                step.volume = drawVolume();
+                orders.push_back(LiveOrder{step.newOrderID, step.price, step.volume, step.side});
+            } else if (!orders.empty() && (draw -= workload.replaceShare) < cancelShare) {
+                LiveOrder order = takeAt(orders, random() % orders.size());
+                step.operation = Operation::Cancel;
+                step.side = order.side;
+                step.orderID = order.orderID;
+            } else {
+                step.side = (random() & 1) ? 'B' : 'S';
+                step.orderID = nextOrderID++;
+                step.price = priceBehindTop(step.side, drawDistance(distance));
+                step.volume = drawVolume();
+                orders.push_back(LiveOrder{step.orderID, step.price, step.volume, step.side});
             }
-            CrossCorrectionMessage msg;
+            operationCounts[static_cast<size_t>(step.operation)]++;
+            steps.push_back(step);
+        }
+    }
 
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
+    template <typename Books>
+    static void apply(const Step& step, Books& books, std::vector<SymbolHot>& hot) {
+        OrderBook& book = *books[step.symbol];
+        SymbolHot& symbol = hot[step.symbol];
+        DepthUpdate update;
+        switch (step.operation) {
+            case Operation::Add:
+                book.addOrder(0, step.symbol, 0, step.orderID, step.price, step.volume, step.side, "", update, symbol);
+                break;
+            case Operation::Cancel:
+                book.deleteOrder(0, step.symbol, 0, step.orderID, update, symbol);
+                break;
+            case Operation::Modify:
+                book.modifyOrder(0, step.symbol, 0, step.orderID, step.price, step.volume, 0, step.side, update, symbol);
+                break;
+            case Operation::Execute:
+                book.orderExecution(0, step.symbol, 0, step.orderID, 0, step.price, step.volume, 1, ' ', ' ', ' ', ' ',
+                                    update);
+                break;
+            case Operation::Replace:
+                book.replaceOrder(0, step.symbol, 0, step.orderID, step.newOrderID, step.price, step.volume, step.side,
+                                  update, symbol);
+                break;
+        }
+    }
 
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
+public:
+    explicit Benchmark(const Workload& workload) : workload(workload), random(workload.seed) {}
 
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
+    int run() {
+        generate();
 
-            std::memcpy(&msg.crossID, buffer + 12, sizeof(msg.crossID));
+        size_t totalOrders = prefill.size() + workload.operations;
+        OrderPool pool;
+        std::unique_ptr<OrderIndex> sharedIndex;
+        if (workload.sharedIndex) {
+            sharedIndex = std::make_unique<OrderIndex>(totalOrders);
+        }
+        std::vector<std::unique_ptr<OrderBook>> books;
+        std::vector<SymbolHot> hot(workload.symbols);
+        size_t perBookCapacity = 2 * workload.depth * workload.ordersPerLevel * 2;
+        for (size_t symbol = 0; symbol < workload.symbols; ++symbol) {
+            books.push_back(std::make_unique<OrderBook>(&pool, sharedIndex.get(), perBookCapacity));
+            books.back()->setMarketByPrice(workload.marketByPrice);
+            books.back()->setTickSize(kTick);
+            hot[symbol].book = books.back().get();
+            hot[symbol].priceDivisor = 10000.0;
+            hot[symbol].priceScaleCode = 4;
+            hot[symbol].bar = {0, UINT32_MAX, kMidPrice, 0, 0};
+            hot[symbol].hasBar = true;
+        }
+        for (const Step& step : prefill) {
+            apply(step, books, hot);
+        }
 
-            std::memcpy(&msg.volume, buffer + 16, sizeof(msg.volume));
+        PerfCounters perf;
+        uint64_t allocationsBefore = benchAllocations.load(std::memory_order_relaxed);
+        perf.start();
+        auto startTime = std::chrono::steady_clock::now();
+        for (const Step& step : steps) {
+            apply(step, books, hot);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        perf.stop();
+        uint64_t allocations = benchAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        double operations = static_cast<double>(std::max<size_t>(steps.size(), 1));
+        size_t levels = 0;
+        for (const auto& book : books) {
+            levels += book->priceLevels();
+        }
 
-            std::cout << "Cross Correction Message Processed.\n";
-            break;
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << "Workload: " << workload.symbols << " symbol(s), " << workload.depth << " level(s) x "
+                  << workload.ordersPerLevel << " order(s) a side, distance decay " << workload.distanceDecay
+                  << ", " << (workload.marketByPrice ? "market by price" : "market by order")
+                  << (workload.sharedIndex ? ", shared index" : "") << "\n";
+        std::cout << "Operations:";
+        for (size_t i = 0; i < operationCounts.size(); ++i) {
+            std::cout << " " << kOperationNames[i] << " " << operationCounts[i];
         }
-        case MSG_TYPE_RETAIL_PRICE_IMPROVEMENT: {
-            if (size < sizeof(RetailPriceImprovementMessage)) {
-                std::cerr << "Invalid Retail Price Improvement Message size.\n";
-                return;
+        std::cout << "\n";
+        std::cout << "Time: " << seconds * 1e3 << " ms, " << seconds * 1e9 / operations << " ns/op, "
+                  << operations / seconds / 1e6 << " M op/s\n";
+        std::cout << "Allocations: " << allocations << " (" << std::setprecision(4) << allocations / operations
+                  << " per op)\n" << std::setprecision(2);
+        if (perf.results().empty()) {
+            std::cout << "Perf counters: unavailable (perf_event_open refused)\n";
+        } else {
+            std::cout << "Per op:";
+            for (const PerfCounters::Counter& counter : perf.results()) {
+                std::cout << " " << counter.name << " " << counter.value / operations;
             }
-            RetailPriceImprovementMessage msg;
-
-            std::memcpy(&msg.sourceTimeNS, buffer, sizeof(msg.sourceTimeNS));
-
-            std::memcpy(&msg.symbolIndex, buffer + 4, sizeof(msg.symbolIndex));
-
-            std::memcpy(&msg.symbolSeqNum, buffer + 8, sizeof(msg.symbolSeqNum));
-
-            msg.rpiIndicator = static_cast<char>(buffer[12]);
-
-            std::cout << "Retail Price Improvement Message Processed.\n";
-            break;
+            std::cout << "\n";
         }
-        default:
-            std::cerr << "Unknown message type: " << messageType << "\n";
-            break;
+        std::cout << "Final book: " << levels / workload.symbols << " price level(s) per symbol, both sides\n"
+                  << std::defaultfloat;
+        return 0;
     }
-}
+};
 
-void parsePillarStream(const uint8_t* data, uint16_t length) {
-    if (length < 16) {
-        std::cerr << "[Error] Insufficient data for Packet Header\n";
-        return;
+// Top Of Book Stress Definition
+// One writer thread rewrites a few shared-memory top of book slots as fast
+// as it can while reader processes forked from it copy them out. Every
+// book the writer stores is derived from one counter, so a reader can tell
+// a torn copy from a consistent one; any torn copy fails the run.
+class TopOfBookStress {
+public:
+    struct Settings {
+        uint32_t readers = 4;
+        uint32_t symbols = 8;
+        double seconds = 2.0;
+    };
+
+    static bool parseSettings(const std::string& spec, Settings& settings) {
+        bool known = forEachSetting(spec, [&](const std::string& key, const char* value) {
+            if (key == "readers") {
+                settings.readers = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            } else if (key == "symbols") {
+                settings.symbols = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            } else if (key == "seconds") {
+                settings.seconds = std::strtod(value, nullptr);
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return known && settings.readers > 0 && settings.symbols > 0 && settings.seconds > 0;
     }
 
-    // Parse Packet Header
-    uint16_t pktSize;
-    uint8_t numberOfMessages;
-    uint32_t sequenceNumber;
-    uint64_t sendTime;
-
-    std::memcpy(&pktSize, data, sizeof(pktSize));
-    numberOfMessages = *(data + 3);
-    std::memcpy(&sequenceNumber, data + 4, sizeof(sequenceNumber));
-    std::memcpy(&sendTime, data + 8, sizeof(sendTime));
-
-    // Validate packet size
-    if (pktSize != length) {
-        std::cerr << "[Error] Packet size mismatch. Expected: " << pktSize
-                  << ", Actual: " << length << "\n";
-        return;
+private:
+    struct ReaderResult {
+        uint64_t reads = 0;
+        uint64_t retries = 0;
+        uint64_t torn = 0;
+    };
+
+    Settings settings;
+
+    static void fill(TobBook& book, uint32_t counter) {
+        book.symbolSeqNum = counter;
+        book.sourceTimeNS = ~counter;
+        book.bidCount = static_cast<uint8_t>(counter % (kTobDepth + 1));
+        book.askCount = static_cast<uint8_t>(kTobDepth - book.bidCount);
+        for (uint32_t i = 0; i < kTobDepth; ++i) {
+            book.bids[i] = {static_cast<uint64_t>(counter) * 3 + i, counter - i, counter + i};
+            book.asks[i] = {static_cast<uint64_t>(counter) * 5 + i, counter + i + 1, counter ^ i};
+        }
+    }
+    static bool consistent(const TobBook& book) {
+        TobBook expected{};
+        fill(expected, book.symbolSeqNum);
+        std::memcpy(expected.symbol, book.symbol, sizeof(book.symbol));
+        return std::memcmp(&expected, &book, sizeof(book)) == 0;
+    }
+    ReaderResult read(const char* name) const {
+        ReaderResult result;
+        TopOfBookReader reader;
+        if (!reader.open(name)) {
+            result.torn = 1;
+            return result;
+        }
+        TobBook book;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(settings.seconds);
+        uint32_t symbolIndex = 0;
+        while ((result.reads & 1023) != 0 || std::chrono::steady_clock::now() < deadline) {
+            if (reader.read(symbolIndex, book, &result.retries)) {
+                result.torn += !consistent(book);
+            }
+            result.reads++;
+            symbolIndex = (symbolIndex + 1 == settings.symbols) ? 0 : symbolIndex + 1;
+        }
+        return result;
     }
 
-    // Start parsing messages
-    const uint8_t* messagePtr = data + 16;
-    uint16_t bytesProcessed = 16;
+public:
+    explicit TopOfBookStress(const Settings& settings) : settings(settings) {}
 
-    for (uint8_t i = 0; i < numberOfMessages; ++i) {
-        if ((bytesProcessed + 4) > length) {
-            std::cerr << "[Error] Insufficient data for Message Header\n";
-            break;
+    int run() {
+        std::string name = "order_book_tob_stress_" + std::to_string(getpid());
+        TopOfBookPublisher publisher;
+        if (!publisher.open(name.c_str(), settings.symbols)) {
+            return 1;
+        }
+        TobBook book{};
+        for (uint32_t symbolIndex = 0; symbolIndex < settings.symbols; ++symbolIndex) {
+            fill(book, symbolIndex);
+            publisher.write(symbolIndex, book);
         }
 
-        // Parse Message Header
-        uint16_t msgSize, msgType;
-        memcpy(&msgSize, messagePtr, sizeof(msgSize));
-        memcpy(&msgType, messagePtr + 2, sizeof(msgType));
-
-        // Pass message data for further processing
-        const uint8_t* msgData = messagePtr + 4;
-        
-        handleMessage(msgType, msgData, msgSize);
+        std::vector<std::pair<pid_t, int>> children;
+        for (uint32_t i = 0; i < settings.readers; ++i) {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                std::cerr << "pipe: " << std::strerror(errno) << "\n";
+                break;
+            }
+            std::cout << std::flush;
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                ReaderResult result = read(name.c_str());
+                ssize_t written = ::write(fds[1], &result, sizeof(result));
+                _exit(written == sizeof(result) ? 0 : 1);
+            }
+            close(fds[1]);
+            if (pid < 0) {
+                std::cerr << "fork: " << std::strerror(errno) << "\n";
+                close(fds[0]);
+                break;
+            }
+            children.emplace_back(pid, fds[0]);
+        }
 
-        // Advance to the next message
-        bytesProcessed += msgSize;
-        messagePtr += msgSize;
+        uint64_t writes = 0;
+        uint32_t counter = settings.symbols;
+        auto startTime = std::chrono::steady_clock::now();
+        auto deadline = startTime + std::chrono::duration<double>(settings.seconds);
+        while ((writes & 1023) != 0 || std::chrono::steady_clock::now() < deadline) {
+            fill(book, counter);
+            publisher.write(counter % settings.symbols, book);
+            counter++;
+            writes++;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        ReaderResult total;
+        bool complete = !children.empty();
+        for (const auto& child : children) {
+            ReaderResult result;
+            complete &= (::read(child.second, &result, sizeof(result)) == sizeof(result));
+            close(child.second);
+            int status = 0;
+            waitpid(child.first, &status, 0);
+            total.reads += result.reads;
+            total.retries += result.retries;
+            total.torn += result.torn;
+        }
+        shm_unlink(("/" + name).c_str());
+
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << "Top of book: 1 writer, " << children.size() << " reader process(es), " << settings.symbols
+                  << " slot(s), " << seconds << " s\n";
+        std::cout << "Writes: " << writes << ", " << writes / seconds / 1e6 << " M/s\n";
+        std::cout << "Reads: " << total.reads << ", " << total.reads / seconds / 1e6 << " M/s, " << total.retries
+                  << " retried, " << total.torn << " torn\n" << std::defaultfloat;
+        return (complete && total.torn == 0) ? 0 : 1;
     }
+};
+#endif
+
+// Print Usage Function
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <pcap_file> [<pcap_file>...]\n"
+              << "       " << program << " [options] --live GROUP:PORT [--live GROUP:PORT...]\n"
+              << "       " << program << " [--log-level LEVEL] --decode-log <log_file>\n"
+              << "       " << program << " --decode-md <md_file>\n"
+              << "       " << program << " --read-tob <shm_name>\n"
+              << "       " << program << " --generate <pcap_file> [KEY=VALUE,...]\n"
+#ifdef ORDER_BOOK_BENCH
+              << "       " << program << " --bench [KEY=VALUE,...]\n"
+              << "       " << program << " --bench-tob [KEY=VALUE,...]\n"
+#endif
+              << "Options:\n"
+              << "  --order-capacity N    Initial order index capacity (per symbol, or total when shared)\n"
+              << "  --shared-order-index  Use one order index for all symbols\n"
+              << "  --mbp                 Keep only per-price aggregates for every symbol\n"
+              << "  --mbp-symbol SYM      Keep only per-price aggregates for SYM (repeatable)\n"
+              << "  --log-level LEVEL     debug, info, warning, error or off (default debug)\n"
+              << "  --quiet               Same as --log-level off\n"
+              << "  --log-raw FILE        Write binary log records to FILE instead of formatting them\n"
+              << "  --decode-log FILE     Format a file written with --log-raw and exit\n"
+              << "  --bars LIST           Source-time OHLCV bars of trades for these intervals, e.g. 1s,1m,5m\n"
+              << "  --trade-tape          Keep every trade per symbol in a columnar tape\n"
+              << "  --tape-query Q        Print trades, volume and VWAP for SYMBOL or SYMBOL@FROM-TO at exit (repeatable)\n"
+              << "  --auctions            Track each symbol's auction state from Imbalance messages\n"
+              << "  --imbalance-threshold QTY  Also count imbalances of at least QTY as significant\n"
+              << "  --conflate POLICY     Publish each changed book once per packet, messages=N or interval=NS\n"
+              << "  --md-out FILE         Write binary market data messages to FILE\n"
+              << "  --md-shm NAME         Publish binary market data to the shared-memory ring /dev/shm/NAME\n"
+              << "  --md-shm-slots N      Messages the shared-memory ring holds (default 1048576)\n"
+              << "  --decode-md FILE      Format a file written with --md-out and exit\n"
+              << "  --tob-shm NAME        Keep each book's top ten levels in seqlocked slots of /dev/shm/NAME\n"
+              << "  --tob-symbols N       Symbol indexes the top of book segment has slots for (default 16384)\n"
+              << "  --read-tob NAME       Print every book in a top of book segment and exit\n"
+              << "  --libpcap             Read the capture through libpcap instead of mapping it\n"
+              << "  --hugepages           Ask for transparent huge pages on the mapped capture\n"
+              << "  --threads N           Split symbols across N book worker threads (default 1)\n"
+              << "  --pin-cores LIST      Pin book workers to these cores, e.g. 2,3,4,5\n"
+              << "  --parser-core C       Pin the capture parsing thread to core C\n"
+              << "  --live GROUP:PORT     Receive from a multicast group instead of a capture (repeatable)\n"
+              << "  --live-interface ADDR Join the groups on the interface with this address\n"
+              << "  --rcvbuf BYTES        Socket receive buffer size\n"
+              << "  --timestamps          Take kernel receive timestamps and report socket to book latency\n"
+              << "  --busy-poll USEC      Set SO_BUSY_POLL and spin on the sockets instead of sleeping\n"
+              << "  --pace SPEED          Release packets at SPEED times the rate of their capture timestamps\n"
+              << "  --checkpoint FILE     Write the book state to FILE at exit\n"
+              << "  --checkpoint-every N  Also write it every N packets\n"
+              << "  --restore FILE        Start from a checkpoint, resuming the capture where it was taken\n";
 }
 
 // Main Function
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <pcap_file>" << "\n";
+    std::vector<const char*> captureFiles;
+    size_t orderCapacity = 0;
+    bool useSharedIndex = false;
+    bool allMarketByPrice = false;
+    std::vector<std::string> marketByPriceSymbols;
+    LogLevel logLevel = LogLevel::Debug;
+    const char* rawLogFile = nullptr;
+    const char* decodeLogFile = nullptr;
+    const char* marketDataFile = nullptr;
+    const char* marketDataShm = nullptr;
+    size_t marketDataSlots = 1 << 20;
+    const char* topOfBookShm = nullptr;
+    uint32_t topOfBookSymbols = 16384;
+    const char* readTopOfBookShm = nullptr;
+    double paceSpeed = 0;
+    ConflationPolicy conflation;
+    std::vector<uint64_t> barIntervals;
+    bool tradeTape = false;
+    std::vector<TapeQuery> tapeQueries;
+    bool auctions = false;
+    uint32_t imbalanceThreshold = 0;
+    const char* decodeMarketDataFile = nullptr;
+    const char* generateFile = nullptr;
+    CaptureGenerator::Settings generatorSettings;
+#ifdef ORDER_BOOK_BENCH
+    bool runBench = false;
+    Benchmark::Workload workload;
+    bool runTopOfBookStress = false;
+    TopOfBookStress::Settings stressSettings;
+#endif
+    bool useLibpcap = false;
+    bool hugePages = false;
+    size_t threadCount = 1;
+    std::vector<int> workerCores;
+    int parserCore = -1;
+    std::vector<LiveReceiver::Endpoint> liveEndpoints;
+    LiveReceiver::Options liveOptions;
+    const char* checkpointFile = nullptr;
+    uint64_t checkpointEvery = 0;
+    const char* restoreFile = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--order-capacity" && i + 1 < argc) {
+            orderCapacity = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--shared-order-index") {
+            useSharedIndex = true;
+        } else if (arg == "--mbp") {
+            allMarketByPrice = true;
+        } else if (arg == "--mbp-symbol" && i + 1 < argc) {
+            marketByPriceSymbols.push_back(argv[++i]);
+        } else if (arg == "--log-level" && i + 1 < argc && parseLogLevel(argv[i + 1], logLevel)) {
+            ++i;
+        } else if (arg == "--quiet") {
+            logLevel = LogLevel::Off;
+        } else if (arg == "--log-raw" && i + 1 < argc) {
+            rawLogFile = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadCount = std::strtoull(argv[++i], nullptr, 10);
+            if (threadCount < 1 || threadCount > BookEngine::kMaxShards) {
+                std::cerr << "--threads must be between 1 and " << BookEngine::kMaxShards << "\n";
+                return 1;
+            }
+        } else if (arg == "--pin-cores" && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos < list.size();) {
+                size_t comma = list.find(',', pos);
+                workerCores.push_back(std::atoi(list.substr(pos, comma - pos).c_str()));
+                pos = (comma == std::string::npos) ? list.size() : comma + 1;
+            }
+        } else if (arg == "--parser-core" && i + 1 < argc) {
+            parserCore = std::atoi(argv[++i]);
+        } else if (arg == "--libpcap") {
+            useLibpcap = true;
+        } else if (arg == "--hugepages") {
+            hugePages = true;
+        } else if (arg == "--live" && i + 1 < argc) {
+            LiveReceiver::Endpoint endpoint;
+            if (!LiveReceiver::parseEndpoint(argv[++i], endpoint)) {
+                std::cerr << "--live expects GROUP:PORT, e.g. 239.1.1.1:20000\n";
+                return 1;
+            }
+            liveEndpoints.push_back(endpoint);
+        } else if (arg == "--live-interface" && i + 1 < argc) {
+            in_addr address;
+            if (inet_pton(AF_INET, argv[++i], &address) != 1) {
+                std::cerr << "--live-interface expects an IPv4 address\n";
+                return 1;
+            }
+            liveOptions.interfaceAddress = ntohl(address.s_addr);
+        } else if (arg == "--rcvbuf" && i + 1 < argc) {
+            liveOptions.receiveBufferBytes = std::atoi(argv[++i]);
+        } else if (arg == "--timestamps") {
+            liveOptions.kernelTimestamps = true;
+        } else if (arg == "--busy-poll" && i + 1 < argc) {
+            liveOptions.busyPollMicros = std::atoi(argv[++i]);
+        } else if (arg == "--pace" && i + 1 < argc) {
+            paceSpeed = std::strtod(argv[++i], nullptr);
+            if (!(paceSpeed > 0)) {
+                std::cerr << "--pace expects a speed above 0, e.g. 1 for the captured rate\n";
+                return 1;
+            }
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointFile = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpointEvery = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--restore" && i + 1 < argc) {
+            restoreFile = argv[++i];
+        } else if (arg == "--decode-log" && i + 1 < argc) {
+            decodeLogFile = argv[++i];
+        } else if (arg == "--bars" && i + 1 < argc) {
+            if (!BarEngine::parseIntervals(argv[++i], barIntervals)) {
+                std::cerr << "--bars expects up to " << BarEngine::kMaxIntervals << " intervals such as 1s,1m,5m,\n"
+                          << "in ms, s, m or h, each a multiple of the shortest\n";
+                return 1;
+            }
+        } else if (arg == "--trade-tape") {
+            tradeTape = true;
+        } else if (arg == "--tape-query" && i + 1 < argc) {
+            TapeQuery query;
+            if (!TapeQuery::parse(argv[++i], query)) {
+                std::cerr << "--tape-query expects SYMBOL or SYMBOL@FROM-TO in epoch seconds\n";
+                return 1;
+            }
+            tapeQueries.push_back(query);
+            tradeTape = true;
+        } else if (arg == "--auctions") {
+            auctions = true;
+        } else if (arg == "--imbalance-threshold" && i + 1 < argc) {
+            imbalanceThreshold = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            auctions = true;
+        } else if (arg == "--conflate" && i + 1 < argc) {
+            if (!ConflationPolicy::parse(argv[++i], conflation)) {
+                std::cerr << "--conflate expects packet, messages=N or interval=NS (at most 1000000000)\n";
+                return 1;
+            }
+        } else if (arg == "--md-out" && i + 1 < argc) {
+            marketDataFile = argv[++i];
+        } else if (arg == "--md-shm" && i + 1 < argc) {
+            marketDataShm = argv[++i];
+        } else if (arg == "--md-shm-slots" && i + 1 < argc) {
+            marketDataSlots = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--tob-shm" && i + 1 < argc) {
+            topOfBookShm = argv[++i];
+        } else if (arg == "--tob-symbols" && i + 1 < argc) {
+            topOfBookSymbols = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--read-tob" && i + 1 < argc) {
+            readTopOfBookShm = argv[++i];
+        } else if (arg == "--decode-md" && i + 1 < argc) {
+            decodeMarketDataFile = argv[++i];
+        } else if (arg == "--generate" && i + 1 < argc) {
+            generateFile = argv[++i];
+            if (i + 1 < argc && std::strchr(argv[i + 1], '=') != nullptr &&
+                !CaptureGenerator::parseSettings(argv[++i], generatorSettings)) {
+                std::cerr << "--generate expects KEY=VALUE,... with keys symbols, live, messages, depth, decay,\n"
+                          << "modify, execute, replace, skew, per-packet, burst, gap and seed\n";
+                return 1;
+            }
+#ifdef ORDER_BOOK_BENCH
+        } else if (arg == "--bench") {
+            runBench = true;
+            if (i + 1 < argc && std::strchr(argv[i + 1], '=') != nullptr &&
+                !Benchmark::parseWorkload(argv[++i], workload)) {
+                std::cerr << "--bench expects KEY=VALUE,... with keys symbols, depth, orders, ops, cancel, decay,\n"
+                          << "modify, execute, replace, mbp, shared and seed\n";
+                return 1;
+            }
+        } else if (arg == "--bench-tob") {
+            runTopOfBookStress = true;
+            if (i + 1 < argc && std::strchr(argv[i + 1], '=') != nullptr &&
+                !TopOfBookStress::parseSettings(argv[++i], stressSettings)) {
+                std::cerr << "--bench-tob expects KEY=VALUE,... with keys readers, symbols and seconds\n";
+                return 1;
+            }
+#endif
+        } else if (arg.rfind("--", 0) != 0) {
+            captureFiles.push_back(argv[i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (decodeLogFile != nullptr) {
+        return decodeLog(decodeLogFile, logLevel);
+    }
+    if (decodeMarketDataFile != nullptr) {
+        return decodeMarketData(decodeMarketDataFile);
+    }
+    if (readTopOfBookShm != nullptr) {
+        return readTopOfBook(readTopOfBookShm);
+    }
+    if (generateFile != nullptr) {
+        return CaptureGenerator(generatorSettings).write(generateFile) ? 0 : 1;
+    }
+#ifdef ORDER_BOOK_BENCH
+    // Book events are not logged while benchmarking; only the operations are timed
+    if (runBench) {
+        if (!logger.start(LogLevel::Off)) {
+            return 1;
+        }
+        int status = Benchmark(workload).run();
+        logger.stop();
+        return status;
+    }
+    if (runTopOfBookStress) {
+        return TopOfBookStress(stressSettings).run();
+    }
+#endif
+    if (captureFiles.empty() == liveEndpoints.empty()) {
+        printUsage(argv[0]);
         return 1;
     }
-
-    const char* file_name = argv[1];
-    char errbuf[PCAP_ERRBUF_SIZE];
-
-    // Open the PCAP file
-    pcap_t* handle = pcap_open_offline(file_name, errbuf);
-    if (handle == nullptr) {
-        std::cerr << "Error opening file: " << errbuf << "\n";
+    if (paceSpeed > 0 && captureFiles.size() != 1) {
+        std::cerr << "--pace replays a single capture\n";
         return 1;
     }
 
-    struct pcap_pkthdr* packet_header;
-    const u_char* packet_data;
-
-    extern std::unordered_map<uint32_t, bar_t> symbolBars;
-    const int printIntervalSeconds = 5;
-    auto lastPrintTime = std::chrono::steady_clock::now();
-    
-    // Loop through packets
-    while (pcap_next_ex(handle, &packet_header, &packet_data) > 0) {
-        // Parse Ethernet Header
-        mac_hdr_t eth_header;
-        if (!parseEthernetHeader(packet_data, eth_header)) {
-            std::cerr << "Error parsing Ethernet header\n";
-            continue;
-        }
+    std::ios::sync_with_stdio(false);
+#ifdef ORDER_BOOK_LATENCY
+    latencyStats.startSignalDumps();
+#endif
+    if (!logger.start(logLevel, rawLogFile)) {
+        return 1;
+    }
+    if ((marketDataFile != nullptr && !marketData.openFile(marketDataFile)) ||
+        (marketDataShm != nullptr && !marketData.openShm(marketDataShm, marketDataSlots)) ||
+        (topOfBookShm != nullptr && !topOfBook.open(topOfBookShm, topOfBookSymbols))) {
+        return 1;
+    }
 
-        // Handle only IPv4 packets
-        if (eth_header.ethertype != static_cast<uint16_t>(ethertype_e::ipv4)) {
-            std::cerr << "Skipping non-IPv4 packet\n";
-            continue;
+    if (parserCore >= 0 && !pinThread(pthread_self(), parserCore)) {
+        std::cerr << "Could not pin the parser thread to core " << parserCore << "\n";
+    }
+    bookEngine.configure(threadCount, useSharedIndex, orderCapacity, allMarketByPrice, marketByPriceSymbols,
+                         conflation, barIntervals, tradeTape, auctions, imbalanceThreshold);
+
+    Checkpoint::Summary restored;
+    double restoreMillis = 0;
+    if (restoreFile != nullptr) {
+        auto restoreStart = std::chrono::steady_clock::now();
+        if (!Checkpoint::restore(restoreFile, bookEngine, sequenceTracker, restored)) {
+            return 1;
         }
-
-        // Parse IPv4 Header
-        ipv4_hdr_t ipv4_header;
-        if (!parseIPv4Header(packet_data + sizeof(mac_hdr_t), ipv4_header)) {
-            std::cerr << "Error parsing IPv4 header\n";
-            continue;
+        restoreMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - restoreStart).count();
+        if (marketData.enabled() || topOfBook.enabled()) {
+            publishSnapshot(bookEngine);
         }
-
-        // Handle only UDP packets
-        if (ipv4_header.protocol != 17) { // Protocol 17 = UDP
-            std::cerr << "Skipping non-UDP packet\n";
-            continue;
+    }
+    marketData.start();
+    bookEngine.start(workerCores);
+
+    // Checkpoints record where in a single mapped capture to resume; other
+    // inputs resume by dropping the sequence numbers already applied
+    CaptureFile capture;
+    bool captureSeekable = false;
+    uint64_t packetCount = restored.packets;
+    Checkpoint::Summary written;
+    uint64_t checkpointsWritten = 0;
+    // Packets held behind a gap are past the expected sequence number a
+    // checkpoint records, so the gap is given up first
+    auto writeCheckpoint = [&]() {
+        sequenceTracker.flush(dispatchPillarMessages);
+        bookEngine.endPacket();
+        bookEngine.quiesce();
+        if (Checkpoint::write(checkpointFile, bookEngine, sequenceTracker, captureSeekable ? capture.position() : 0,
+                              packetCount, written)) {
+            checkpointsWritten++;
         }
+    };
 
-        // Calculate IPv4 Header Length (IHL * 4)
-        uint8_t ipv4_header_length = (ipv4_header.version_ihl & 0x0F) * 4;
+    const int printIntervalSeconds = 5;
+    auto lastPrintTime = std::chrono::steady_clock::now();
 
-        // Parse UDP Header
-        udp_hdr_t udp_header;
-        if (!parseUDPHeader(packet_data + sizeof(mac_hdr_t) + ipv4_header_length, udp_header)) {
-            std::cerr << "Error parsing UDP header\n";
-            continue;
-        }
-        
-        // Extract UDP Payload
-        uint16_t ipHeaderLength = (*(packet_data + 14) & 0x0F) * 4;
-        uint16_t udpHeaderOffset = 14 + ipHeaderLength;
-        uint16_t udpPayloadOffset = udpHeaderOffset + 8;
-        uint16_t udpPayloadLength = ntohs(*(reinterpret_cast<const uint16_t*>(packet_data + udpHeaderOffset + 4))) - 8;
-
-        if (udpPayloadOffset + udpPayloadLength > packet_header->len) {
-            std::cerr << "[Error] UDP payload exceeds packet length\n";
-            continue;
+    auto afterPacket = [&]() {
+        bookEngine.endPacket();
+        packetCount++;
+        if (checkpointFile != nullptr && checkpointEvery > 0 && packetCount % checkpointEvery == 0) {
+            writeCheckpoint();
         }
 
-        // Extract and parse Pillar stream
-        const uint8_t* pillarData = packet_data + udpPayloadOffset;
-        uint16_t pillarLength = udpPayloadLength;
-        parsePillarStream(pillarData, pillarLength);
-
         auto currentTime = std::chrono::steady_clock::now();
         auto elapsedTime = std::chrono::duration_cast<std::chrono::seconds>(currentTime - lastPrintTime);
 
-        if (elapsedTime.count() >= printIntervalSeconds) {
-            std::cout << "Printing bars at " << elapsedTime.count() << " seconds.\n";
-            printAllBars(symbolBars, symbolMappings);
+        if (barIntervals.empty() && elapsedTime.count() >= printIntervalSeconds) {
+            logEvent(LogLevel::Info, LogEvent::PrintingBars, elapsedTime.count());
+            bookEngine.printBars();
             lastPrintTime = currentTime;
         }
+    };
+    ReplayPacer pacer;
+    pacer.configure(paceSpeed);
+    auto handlePacket = [&](const uint8_t* data, uint32_t capturedLength, uint64_t timestampNS) {
+        if (pacer.enabled()) {
+            pacer.release(timestampNS);
+        }
+        processPacket(data, capturedLength);
+        afterPacket();
+        if (pacer.enabled()) {
+            pacer.handled();
+        }
+    };
+
+    // Live groups are received until interrupted. Several captures are merged
+    // by sendTime; a single one is walked in place when we can, otherwise
+    // libpcap reads it
+    std::unique_ptr<LiveReceiver> live;
+    const char* file_name = captureFiles.empty() ? nullptr : captureFiles[0];
+    if (!liveEndpoints.empty()) {
+        live = std::make_unique<LiveReceiver>(liveOptions);
+        if (!live->open(liveEndpoints) || !live->run(afterPacket)) {
+            return 1;
+        }
+    } else if (captureFiles.size() > 1) {
+        if (!mergeCaptures(captureFiles, hugePages, afterPacket)) {
+            return 1;
+        }
+    } else if (!useLibpcap && capture.open(file_name, hugePages)) {
+        captureSeekable = true;
+        if (restored.captureOffset > 0 && !capture.skipTo(restored.captureOffset)) {
+            std::cerr << "Checkpoint offset " << restored.captureOffset << " is not a record in " << file_name << "\n";
+            return 1;
+        }
+        CaptureFile::Packet packet;
+        while (capture.next(packet)) {
+            handlePacket(packet.data, packet.capturedLength, packet.timestampNS);
+        }
+        if (capture.truncated()) {
+            logEvent(LogLevel::Error, LogEvent::CaptureTruncated);
+        }
+    } else {
+#ifndef ORDER_BOOK_NO_LIBPCAP
+        char errbuf[PCAP_ERRBUF_SIZE];
+
+        // Open the PCAP file
+        pcap_t* handle = pcap_open_offline(file_name, errbuf);
+        if (handle == nullptr) {
+            std::cerr << "Error opening file: " << errbuf << "\n";
+            return 1;
+        }
+
+        struct pcap_pkthdr* packet_header;
+        const u_char* packet_data;
+        while (pcap_next_ex(handle, &packet_header, &packet_data) > 0) {
+            handlePacket(packet_data, packet_header->caplen,
+                         packet_header->ts.tv_sec * 1000000000ull + packet_header->ts.tv_usec * 1000ull);
+        }
+        pcap_close(handle);
+#else
+        std::cerr << "Error opening file: " << file_name << " is not a readable pcap or pcapng file\n";
+        return 1;
+#endif
     }
 
-    pcap_close(handle);
+    sequenceTracker.flush(dispatchPillarMessages);
+    bookEngine.endPacket();
+    bookEngine.stop();
+    if (checkpointFile != nullptr) {
+        writeCheckpoint();
+    }
+    marketData.stop();
+    logger.stop();
+    if (restoreFile != nullptr) {
+        std::cout << "Restored " << restored.symbols << " symbol(s) and " << restored.orders << " order(s) from "
+                  << restoreFile << " in " << std::fixed << std::setprecision(1) << restoreMillis << " ms, resuming after packet "
+                  << restored.packets << "\n" << std::defaultfloat;
+    }
+    if (checkpointsWritten > 0) {
+        std::cout << "Checkpoint: " << checkpointsWritten << " written, the last with " << written.symbols
+                  << " symbol(s) and " << written.orders << " order(s) after packet " << written.packets << "\n";
+    }
+    if (live) {
+        live->printStats();
+    }
+    pacer.printStats();
+    sequenceTracker.printStats();
+    bookEngine.printStats();
+    marketData.printStats();
+    topOfBook.printStats();
+    logger.printStats();
+    for (const TapeQuery& query : tapeQueries) {
+        printTapeQuery(bookEngine, query);
+    }
+    if (auctions) {
+        bookEngine.printImbalances();
+    }
+#ifdef ORDER_BOOK_LATENCY
+    std::cout << std::flush;
+    latencyStats.print(std::cerr);
+#endif
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""A/B line arbitration test.
+
+Writes two captures of one channel, line A and line B, with crafted drops on
+each line, a packet line B delivers late, a retransmitted duplicate, a gap
+both lines drop and a sequence reset, runs order_book on both and checks
+that every Add Order is applied exactly once and in order, that the gap
+both lines dropped is reported as lost while later packets are still
+arriving, and that the channel statistics agree.
+
+    python3 tests/sequence_arbitration_test.py ./order_book
+"""
+
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+PORT = 20000
+LINE_A = bytes([239, 1, 1, 1])
+LINE_B = bytes([239, 1, 2, 1])
+FIRST_SESSION = 300      # packets before the reset
+SECOND_SESSION = 100     # packets after it
+SEQUENCE_RESET_FLAG = 12
+
+
+def message(msg_type, body):
+    return struct.pack('<HH', 4 + len(body), msg_type) + body
+
+
+def symbol_mapping():
+    body = struct.pack('<I11sBHBcBcHIIBcHHH', 0, b'TEST', 0, 1, 1, b'N', 4, b'A', 100,
+                       0, 0, 1, b'Y', 1, 1, 0)
+    return message(3, body)
+
+
+def add_order(order_id, symbol_seq_num):
+    body = struct.pack('<IIIQIIc5sB', 0, 0, symbol_seq_num, order_id, 1000000 + order_id, 100,
+                       b'B', b'', 0)
+    return message(100, body)
+
+
+def packet(seq, send_time_ns, messages, flag=0):
+    payload = b''.join(messages)
+    header = struct.pack('<HBBIII', 16 + len(payload), flag, len(messages), seq,
+                         send_time_ns // 1000000000, send_time_ns % 1000000000)
+    return send_time_ns, header + payload
+
+
+def frame(line, send_time_ns, pillar):
+    ethernet = b'\x01\x00\x5e\x01\x01\x01' + b'\x02\x00\x00\x00\x00\x01' + b'\x08\x00'
+    ip = struct.pack('>BBHHHBBH4s4s', 0x45, 0, 20 + 8 + len(pillar), 0, 0, 64, 17, 0,
+                     bytes([10, 0, 0, 1]), line)
+    udp = struct.pack('>HHHH', PORT, PORT, 8 + len(pillar), 0)
+    data = ethernet + ip + udp + pillar
+    record = struct.pack('<IIII', send_time_ns // 1000000000, send_time_ns % 1000000000,
+                         len(data), len(data))
+    return record + data
+
+
+def write_capture(path, line, packets):
+    with open(path, 'wb') as out:
+        # Nanosecond-resolution pcap, Ethernet link type
+        out.write(struct.pack('<IHHiIII', 0xa1b23c4d, 2, 4, 0, 0, 65535, 1))
+        for send_time_ns, pillar in packets:
+            out.write(frame(line, send_time_ns, pillar))
+
+
+def build():
+    """Return (line A packets, line B packets, expected order IDs, lost order IDs)."""
+    start_ns = 1000 * 1000000000
+    orders = {}   # (session, seq) -> order ID
+    first = []    # session one, by sequence number
+    order_id = 0
+    first.append(packet(1, start_ns, [symbol_mapping()]))
+    for seq in range(2, FIRST_SESSION + 1):
+        order_id += 1
+        orders[(1, seq)] = order_id
+        first.append(packet(seq, start_ns + seq * 1000000, [add_order(order_id, order_id)]))
+
+    second = []
+    reset_ns = start_ns + (FIRST_SESSION + 1000) * 1000000
+    for seq in range(1, SECOND_SESSION + 1):
+        order_id += 1
+        orders[(2, seq)] = order_id
+        flag = SEQUENCE_RESET_FLAG if seq == 1 else 0
+        second.append(packet(seq, reset_ns + seq * 1000000, [add_order(order_id, order_id)], flag))
+
+    lost = {150, 151}     # dropped on both lines
+    late = 40             # dropped on A, delivered by B after three later packets
+    repeated = 60         # retransmitted on A after the packet that follows it
+
+    line_a = []
+    for seq, pkt in enumerate(first, 1):
+        if seq % 10 == 5 or seq in lost or seq == late:
+            continue
+        line_a.append(pkt)
+        if seq == repeated + 1:
+            line_a.append(first[repeated - 1])
+    line_a += [pkt for seq, pkt in enumerate(second, 1) if seq % 10 != 7]
+
+    line_b = []
+    for seq, pkt in enumerate(first, 1):
+        if seq % 10 == 8 or seq in lost or seq == late:
+            continue
+        line_b.append(pkt)
+        if seq == late + 3:
+            line_b.append(first[late - 1])
+    line_b += [pkt for seq, pkt in enumerate(second, 1) if seq % 10 != 3]
+
+    expected = [orders[key] for key in sorted(orders) if not (key[0] == 1 and key[1] in lost)]
+    lost_ids = [orders[(1, seq)] for seq in sorted(lost)]
+    return line_a, line_b, expected, lost_ids
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('usage: sequence_arbitration_test.py <order_book binary>', file=sys.stderr)
+        return 2
+    binary = sys.argv[1]
+    line_a, line_b, expected, lost_ids = build()
+
+    with tempfile.TemporaryDirectory() as directory:
+        path_a = os.path.join(directory, 'line_a.pcap')
+        path_b = os.path.join(directory, 'line_b.pcap')
+        write_capture(path_a, LINE_A, line_a)
+        write_capture(path_b, LINE_B, line_b)
+        result = subprocess.run([binary, '--log-level', 'info', path_a, path_b],
+                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                universal_newlines=True)
+
+    failures = []
+    if result.returncode != 0:
+        failures.append('order_book exited with %d' % result.returncode)
+    lines = result.stdout.splitlines()
+
+    applied = [int(match.group(1)) for match in
+               (re.match(r'Added Order: (\d+)$', line) for line in lines) if match]
+    if applied != expected:
+        repeated = sorted({order for order in applied if applied.count(order) > 1})
+        missing = sorted(set(expected) - set(applied))
+        unexpected = sorted(set(applied) - set(expected))
+        failures.append('applied %d orders, expected %d; repeated %s, missing %s, unexpected %s, in order: %s'
+                        % (len(applied), len(expected), repeated, missing, unexpected,
+                           applied == sorted(applied)))
+
+    lost_line = '[Warning] Channel %d lost 2 message(s) from sequence 150: ' % PORT
+    reported = [index for index, line in enumerate(lines) if line.startswith(lost_line)]
+    if len(reported) != 1:
+        failures.append('expected one report of the lost gap, found %d' % len(reported))
+    else:
+        # Reported while the feed was still running, not when the input ended
+        following = 'Added Order: %d' % (lost_ids[-1] + 1)
+        if following not in lines or lines.index(following) < reported[0]:
+            failures.append('lost gap was not reported before later packets were applied')
+
+    stats = [line for line in lines if line.startswith('Channel %d: ' % PORT)]
+    want = ('gap(s) of 3 message(s): 1 filled by another line, 2 lost in 1 gap(s)')
+    if len(stats) != 1 or not stats[0].endswith(want):
+        failures.append('unexpected channel statistics: %s' % stats)
+    elif not re.search(r' [1-9]\d* duplicate\(s\)', stats[0]):
+        failures.append('no duplicates counted: %s' % stats[0])
+
+    for failure in failures:
+        print('FAIL: ' + failure)
+    if failures:
+        return 1
+    print('PASS: %d orders applied once and in order, %d lost and reported' % (len(expected), len(lost_ids)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
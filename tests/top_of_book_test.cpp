@@ -0,0 +1,155 @@
+// Shared-memory top of book test
+//
+// One TopOfBookWriter thread rewrites every slot of a segment, round robin,
+// while N threads with their own TopOfBookReader mappings copy them out.
+// The n-th book written to a slot is derived from n alone, so each copy a
+// reader gets must match the book for its own symbolSeqNum field exactly.
+// Per reader and slot, neither that counter nor the slot's version may go
+// backwards, and the copy has to lie between the versions read just before
+// and just after it. Exits 1 on the first failure.
+//
+//     g++ -std=c++17 -O2 -pthread tests/top_of_book_test.cpp -o top_of_book_test
+//     ./top_of_book_test [readers] [slots] [seconds]
+
+#include "../top_of_book.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Book Fill Function
+// The book the writer stores on a slot's counter-th write
+void fillBook(TobBook& book, uint32_t symbolIndex, uint32_t counter) {
+    book = TobBook{};
+    book.symbolSeqNum = counter;
+    book.sourceTimeNS = ~counter;
+    book.bidCount = static_cast<uint8_t>(counter % (kTobDepth + 1));
+    book.askCount = static_cast<uint8_t>(kTobDepth - book.bidCount);
+    book.priceScaleCode = static_cast<uint8_t>(counter % 7);
+    std::snprintf(book.symbol, sizeof(book.symbol), "S%u", symbolIndex);
+    for (uint32_t i = 0; i < kTobDepth; ++i) {
+        book.bids[i] = {static_cast<uint64_t>(counter) * 3 + i, counter - i, counter + i};
+        book.asks[i] = {static_cast<uint64_t>(counter) * 5 + i, counter + i + 1, counter ^ i};
+    }
+}
+
+// Reader Result Definition
+struct ReaderResult {
+    uint64_t reads = 0;
+    uint64_t retries = 0;
+    std::string failure;
+};
+
+// Reader Function
+// Read slots round robin until the writer is done, checking every copy
+void readSlots(const char* name, uint32_t slots, const std::atomic<bool>& writing, ReaderResult& result) {
+    TopOfBookReader reader;
+    if (!reader.open(name) || reader.capacity() != slots) {
+        result.failure = "reader could not map the segment";
+        return;
+    }
+    std::vector<uint32_t> lastCounter(slots, 0);
+    std::vector<uint32_t> lastVersion(slots, 0);
+    TobBook book;
+    TobBook expected;
+    char message[160];
+    uint32_t symbolIndex = 0;
+    do {
+        uint32_t before = reader.version(symbolIndex);
+        if (reader.read(symbolIndex, book, &result.retries)) {
+            uint32_t after = reader.version(symbolIndex);
+            uint32_t counter = book.symbolSeqNum;
+            fillBook(expected, symbolIndex, counter);
+            if (std::memcmp(&expected, &book, sizeof(book)) != 0) {
+                std::snprintf(message, sizeof(message), "torn copy of slot %u at counter %u", symbolIndex, counter);
+            } else if (counter < lastCounter[symbolIndex]) {
+                std::snprintf(message, sizeof(message), "slot %u went back from counter %u to %u", symbolIndex,
+                              lastCounter[symbolIndex], counter);
+            } else if (before < lastVersion[symbolIndex] || after < before) {
+                std::snprintf(message, sizeof(message), "slot %u version went back: %u, then %u, then %u",
+                              symbolIndex, lastVersion[symbolIndex], before, after);
+            } else if (counter < before || counter > after) {
+                std::snprintf(message, sizeof(message), "slot %u copy of counter %u outside versions %u to %u",
+                              symbolIndex, counter, before, after);
+            } else {
+                message[0] = '\0';
+            }
+            if (message[0] != '\0') {
+                result.failure = message;
+                return;
+            }
+            lastCounter[symbolIndex] = counter;
+            lastVersion[symbolIndex] = after;
+        } else if (before != 0) {
+            std::snprintf(message, sizeof(message), "slot %u at version %u read as never written", symbolIndex,
+                          before);
+            result.failure = message;
+            return;
+        }
+        result.reads++;
+        symbolIndex = (symbolIndex + 1 == slots) ? 0 : symbolIndex + 1;
+    } while (writing.load(std::memory_order_relaxed));
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t readers = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 4;
+    uint32_t slots = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 4;
+    double seconds = argc > 3 ? std::strtod(argv[3], nullptr) : 1.0;
+    if (readers == 0 || slots == 0 || !(seconds > 0)) {
+        std::fprintf(stderr, "Usage: %s [readers] [slots] [seconds]\n", argv[0]);
+        return 2;
+    }
+
+    std::string name = "order_book_tob_test_" + std::to_string(getpid());
+    TopOfBookWriter writer;
+    if (!writer.open(name.c_str(), slots)) {
+        std::fprintf(stderr, "Error creating shared memory %s: %s\n", name.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    std::atomic<bool> writing{true};
+    std::vector<ReaderResult> results(readers);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < readers; ++i) {
+        threads.emplace_back(readSlots, name.c_str(), slots, std::cref(writing), std::ref(results[i]));
+    }
+
+    uint64_t writes = 0;
+    TobBook book;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while ((writes & 1023) != 0 || std::chrono::steady_clock::now() < deadline) {
+        uint32_t symbolIndex = static_cast<uint32_t>(writes % slots);
+        fillBook(book, symbolIndex, writer.version(symbolIndex) + 1);
+        writer.write(symbolIndex, book);
+        writes++;
+    }
+    writing.store(false, std::memory_order_relaxed);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    shm_unlink(("/" + name).c_str());
+
+    uint64_t reads = 0, retries = 0;
+    bool passed = true;
+    for (uint32_t i = 0; i < readers; ++i) {
+        if (!results[i].failure.empty()) {
+            std::printf("FAIL: reader %u: %s\n", i, results[i].failure.c_str());
+            passed = false;
+        }
+        reads += results[i].reads;
+        retries += results[i].retries;
+    }
+    if (passed && reads < readers) {
+        std::printf("FAIL: readers made %llu read(s)\n", static_cast<unsigned long long>(reads));
+        passed = false;
+    }
+    if (passed) {
+        std::printf("PASS: %llu write(s), %llu consistent read(s) by %u reader(s), %llu retried\n",
+                    static_cast<unsigned long long>(writes), static_cast<unsigned long long>(reads), readers,
+                    static_cast<unsigned long long>(retries));
+    }
+    return passed ? 0 : 1;
+}
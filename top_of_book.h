@@ -0,0 +1,248 @@
+// Shared-memory top of book
+//
+// Layout of the segment order_book writes with --tob-shm, the writer it
+// uses and a reader for other processes. The segment is a header followed by one slot per
+// symbolIndex, each holding the symbol's ten best levels a side. The
+// writer never waits for readers: it makes a slot's sequence odd, copies
+// the book in and makes it even again. A reader copies the book out
+// between two loads of the sequence and keeps the copy only if both are
+// the same even number, so any number of readers get consistent books
+// without locks. Include this header and link nothing else.
+#ifndef ORDER_BOOK_TOP_OF_BOOK_H
+#define ORDER_BOOK_TOP_OF_BOOK_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr char kTobMagic[8] = {'O', 'B', 'T', 'O', 'B', 'S', 'H', '1'};
+constexpr uint32_t kTobVersion = 1;
+constexpr size_t kTobDepth = 10;
+
+// Top Of Book Level Definition
+struct TobLevel {
+    uint64_t volume;
+    uint32_t price;
+    uint32_t orderCount;
+};
+
+// Top Of Book Definition
+// A symbol's book as of one message. Prices are raw feed integers; divide
+// by 10^priceScaleCode. Levels past bidCount or askCount are zero.
+struct TobBook {
+    uint32_t symbolSeqNum;
+    uint32_t sourceTimeNS;
+    uint8_t bidCount;
+    uint8_t askCount;
+    uint8_t priceScaleCode;
+    uint8_t padding;
+    char symbol[12];
+    TobLevel bids[kTobDepth];
+    TobLevel asks[kTobDepth];
+};
+
+// Top Of Book Slot Definition
+// Sequence 0 means never written; odd means a write is under way
+struct alignas(64) TobSlot {
+    std::atomic<uint32_t> sequence;
+    uint32_t padding;
+    TobBook book;
+};
+static_assert(sizeof(TobSlot) % 64 == 0, "TobSlot should fill whole cache lines");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "slot sequences are shared between processes");
+
+// Top Of Book Header Definition
+// Readers wait for the magic, which the writer fills in last
+struct alignas(64) TobHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t slotCount;
+    uint32_t depth;
+};
+static_assert(sizeof(TobHeader) == 64, "TobHeader should fill one cache line");
+
+// Top Of Book Writer Definition
+// Each slot must have a single writer; different slots may be written from
+// different threads at once.
+class TopOfBookWriter {
+private:
+    void* mapping = MAP_FAILED;
+    size_t bytes = 0;
+    TobSlot* slots = nullptr;
+    uint32_t slotCount = 0;
+
+public:
+    TopOfBookWriter() = default;
+    TopOfBookWriter(const TopOfBookWriter&) = delete;
+    TopOfBookWriter& operator=(const TopOfBookWriter&) = delete;
+    ~TopOfBookWriter() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, bytes);
+        }
+    }
+
+    // Create /dev/shm/NAME with a slot for each symbol index below `symbols`,
+    // replacing any existing segment; false with errno set if that fails
+    bool open(const char* name, uint32_t symbols) {
+        std::string path = (name[0] == '/') ? name : std::string("/") + name;
+        int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bytes = sizeof(TobHeader) + static_cast<size_t>(symbols) * sizeof(TobSlot);
+        if (ftruncate(fd, bytes) == 0) {
+            mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        int error = errno;
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            errno = error;
+            return false;
+        }
+        auto* header = static_cast<TobHeader*>(mapping);
+        slots = reinterpret_cast<TobSlot*>(static_cast<uint8_t*>(mapping) + sizeof(TobHeader));
+        slotCount = symbols;
+        header->version = kTobVersion;
+        header->slotSize = sizeof(TobSlot);
+        header->slotCount = symbols;
+        header->depth = kTobDepth;
+        // Readers wait for the magic, so it goes in last
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, kTobMagic, sizeof(kTobMagic));
+        return true;
+    }
+
+    uint32_t capacity() const {
+        return slotCount;
+    }
+    // Times a symbol's slot has been written, as TopOfBookReader::version
+    uint32_t version(uint32_t symbolIndex) const {
+        return symbolIndex < slotCount ? slots[symbolIndex].sequence.load(std::memory_order_relaxed) / 2 : 0;
+    }
+    // Replace a symbol's book; false if symbolIndex has no slot. The
+    // sequence is odd while the copy is under way and skips 0, which
+    // readers take as never written.
+    bool write(uint32_t symbolIndex, const TobBook& book) {
+        if (symbolIndex >= slotCount) {
+            return false;
+        }
+        TobSlot& slot = slots[symbolIndex];
+        uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&slot.book, &book, sizeof(book));
+        uint32_t next = sequence + 2;
+        slot.sequence.store(next != 0 ? next : 2, std::memory_order_release);
+        return true;
+    }
+};
+
+// Top Of Book Reader Definition
+class TopOfBookReader {
+private:
+    void* mapping = MAP_FAILED;
+    size_t bytes = 0;
+    const TobHeader* header = nullptr;
+    const TobSlot* slots = nullptr;
+
+public:
+    TopOfBookReader() = default;
+    TopOfBookReader(const TopOfBookReader&) = delete;
+    TopOfBookReader& operator=(const TopOfBookReader&) = delete;
+    ~TopOfBookReader() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, bytes);
+        }
+    }
+
+    // Map /dev/shm/NAME read-only; false if it is missing, not yet
+    // initialised or from another version
+    bool open(const char* name) {
+        std::string path = (name[0] == '/') ? name : std::string("/") + name;
+        int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TobHeader)) {
+            close(fd);
+            return false;
+        }
+        bytes = static_cast<size_t>(info.st_size);
+        mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        header = static_cast<const TobHeader*>(mapping);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (std::memcmp(header->magic, kTobMagic, sizeof(kTobMagic)) != 0 || header->version != kTobVersion ||
+            header->slotSize != sizeof(TobSlot) ||
+            sizeof(TobHeader) + static_cast<size_t>(header->slotCount) * sizeof(TobSlot) > bytes) {
+            munmap(mapping, bytes);
+            mapping = MAP_FAILED;
+            header = nullptr;
+            return false;
+        }
+        slots = reinterpret_cast<const TobSlot*>(static_cast<const uint8_t*>(mapping) + sizeof(TobHeader));
+        return true;
+    }
+
+    uint32_t capacity() const {
+        return header != nullptr ? header->slotCount : 0;
+    }
+    // Times a symbol's slot has been written, which a poller can compare
+    // to see whether anything changed since its last read
+    uint32_t version(uint32_t symbolIndex) const {
+        return symbolIndex < capacity() ? slots[symbolIndex].sequence.load(std::memory_order_acquire) / 2 : 0;
+    }
+    // Copy a consistent book for symbolIndex, retrying while the writer is
+    // in the middle of it and yielding now and then in case the writer was
+    // preempted there; false if the symbol was never published. Adds the
+    // number of retries to `retries` if given.
+    bool read(uint32_t symbolIndex, TobBook& book, uint64_t* retries = nullptr) const {
+        if (symbolIndex >= capacity()) {
+            return false;
+        }
+        const TobSlot& slot = slots[symbolIndex];
+        for (uint32_t attempt = 1;; ++attempt) {
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before == 0) {
+                return false;
+            }
+            if ((before & 1) == 0) {
+                std::memcpy(&book, &slot.book, sizeof(book));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) == before) {
+                    return true;
+                }
+            }
+            if (retries != nullptr) {
+                (*retries)++;
+            }
+            if (attempt % 64 == 0) {
+                sched_yield();
+            }
+        }
+    }
+    // Index of the slot publishing `symbol`, or -1
+    int64_t find(const char* symbol) const {
+        TobBook book;
+        for (uint32_t symbolIndex = 0; symbolIndex < capacity(); ++symbolIndex) {
+            if (read(symbolIndex, book) && std::strncmp(book.symbol, symbol, sizeof(book.symbol)) == 0) {
+                return symbolIndex;
+            }
+        }
+        return -1;
+    }
+};
+
+#endif